@@ -0,0 +1,160 @@
+#include <argparse/argparse.hpp>
+#include <array>
+#include <asio.hpp>
+#include <atomic>
+#include <bighorn/recursive_lookup.hpp>
+#include <bighorn/static_lookup.hpp>
+#include <bighorn/udp.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+
+// Sends queries one at a time to a UdpNameServer whose RecursiveLookup has
+// to resolve every one of them from a local upstream, so that each runs the
+// whole serving pipeline, and reports the heap allocations the serving thread
+// makes per query, by size. Coroutine frames come from asio's per-thread
+// recycling cache and only reach operator new when it misses; the cache holds
+// ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE frames (set with
+// BIGHORN_FRAME_CACHE_SIZE) of at most 1020 bytes each.
+
+namespace {
+
+const size_t BucketBytes = 64;
+const size_t Buckets = 32;
+
+std::array<std::atomic<size_t>, Buckets + 1> allocations_by_size{};
+thread_local bool counted = false;
+
+struct alignas(std::max_align_t) AllocationHeader {
+    size_t size;
+};
+
+}  // namespace
+
+void *operator new(size_t size) {
+    auto *header = static_cast<AllocationHeader *>(
+        std::malloc(sizeof(AllocationHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    if (counted) {
+        auto bucket = std::min(size / BucketBytes, Buckets);
+        allocations_by_size[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+    return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr != nullptr) {
+        std::free(static_cast<AllocationHeader *>(ptr) - 1);
+    }
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+bighorn::Labels host_name(size_t i) {
+    return {"host" + std::to_string(i), "example", "com"};
+}
+
+void report(size_t queries) {
+    auto per_query = [&](size_t count) {
+        return static_cast<double>(count) / static_cast<double>(queries);
+    };
+    size_t total = 0;
+    for (size_t bucket = 0; bucket <= Buckets; ++bucket) {
+        auto count = allocations_by_size[bucket].load();
+        total += count;
+        if (per_query(count) < 0.01) {
+            continue;
+        }
+        if (bucket == Buckets) {
+            std::cout << "  " << Buckets * BucketBytes << "+ bytes: ";
+        } else {
+            std::cout << "  " << bucket * BucketBytes << "-"
+                      << (bucket + 1) * BucketBytes - 1 << " bytes: ";
+        }
+        std::cout << per_query(count) << " per query\n";
+    }
+    std::cout << per_query(total) << " allocations per query with a frame "
+              << "cache of " << ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE << '\n';
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_frames");
+    program.add_argument("--queries")
+        .help("number of queries, each for a different name")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(20000);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+    auto queries = static_cast<size_t>(program.get<int>("queries"));
+    auto loopback = asio::ip::address_v4::loopback();
+
+    asio::io_context upstream_io;
+    bighorn::StaticLookup records;
+    for (size_t i = 0; i < queries; ++i) {
+        records.add_record(
+            bighorn::Rr::a_record(host_name(i), static_cast<uint32_t>(i), 300));
+    }
+    bighorn::UdpNameServer upstream(upstream_io,
+                                    asio::ip::udp::endpoint(loopback, 0),
+                                    bighorn::Responder(std::move(records)));
+    asio::co_spawn(upstream_io, upstream.start(), asio::detached);
+    std::jthread upstream_thread([&] { upstream_io.run(); });
+
+    asio::io_context io;
+    bighorn::DefaultResolver resolver(
+        io, {bighorn::DnsServer{.ip = loopback.to_uint(),
+                                .port = upstream.port(),
+                                .conn_method = bighorn::ServerConnMethod::Udp,
+                                .recursive = true}});
+    bighorn::UdpNameServer server(
+        io, asio::ip::udp::endpoint(loopback, 0),
+        bighorn::Responder(
+            bighorn::RecursiveLookup<bighorn::DefaultResolver>(
+                io, std::move(resolver))));
+    asio::co_spawn(io, server.start(), asio::detached);
+    std::jthread server_thread([&] {
+        counted = true;
+        io.run();
+    });
+
+    asio::io_context client_io;
+    asio::ip::udp::socket client(client_io,
+                                 asio::ip::udp::endpoint(loopback, 0));
+    asio::ip::udp::endpoint server_endpoint(loopback, server.port());
+    std::array<uint8_t, 512> reply{};
+    size_t answered = 0;
+    for (size_t i = 0; i < queries; ++i) {
+        bighorn::Question question{.labels = host_name(i),
+                                   .qtype = bighorn::RrType::A,
+                                   .qclass = bighorn::RrClass::In};
+        bighorn::Message query{
+            .header = {.id = static_cast<uint16_t>(i),
+                       .opcode = bighorn::Opcode::Query,
+                       .rd = 1},
+            .questions = {question}};
+        client.send_to(asio::buffer(query.bytes()), server_endpoint);
+        asio::ip::udp::endpoint from;
+        client.receive_from(asio::buffer(reply), from);
+        ++answered;
+    }
+    report(answered);
+    io.stop();
+    upstream_io.stop();
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <argparse/argparse.hpp>
+#include <bighorn/frozen_static_lookup.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Compares exact-match query latency of StaticLookup (hash map) and
+// FrozenStaticLookup (minimal perfect hash) on a zone of single-A names,
+// using a shuffled stream of hits and misses.
+
+template <typename L>
+void run(const char *label, const L &lookup,
+         const std::vector<bighorn::Labels> &queries) {
+    size_t answers = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &labels : queries) {
+        answers += lookup
+                       .find_records_sync(labels, bighorn::RrType::A,
+                                          bighorn::RrClass::In, false)
+                       .records.size();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << label << ": " << elapsed.count() / queries.size()
+              << " ns/query, " << answers << " answers\n";
+}
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_frozen_lookup");
+    program.add_argument("--names")
+        .help("number of names in the zone")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(1000000);
+    program.add_argument("--queries")
+        .help("number of queries to time")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(2000000);
+    program.add_argument("--hit-percent")
+        .help("share of queries for names in the zone")
+        .scan<'i', int>()
+        .metavar("PERCENT")
+        .default_value(80);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+
+    auto names = static_cast<uint32_t>(program.get<int>("names"));
+    auto query_count = static_cast<size_t>(program.get<int>("queries"));
+    auto hit_percent = static_cast<uint32_t>(program.get<int>("hit-percent"));
+
+    bighorn::StaticLookup lookup;
+    for (uint32_t i = 0; i < names; ++i) {
+        lookup.add_record(bighorn::Rr::a_record(
+            {"host" + std::to_string(i), "bench", "example", "com"}, i, 300));
+    }
+    lookup.compact();
+
+    auto start = std::chrono::steady_clock::now();
+    bighorn::FrozenStaticLookup frozen(lookup);
+    std::chrono::duration<double> build =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "Froze " << names << " names in " << build.count() << " s\n";
+
+    std::mt19937 rng(42);
+    std::vector<bighorn::Labels> queries;
+    queries.reserve(query_count);
+    for (size_t i = 0; i < query_count; ++i) {
+        auto prefix = rng() % 100 < hit_percent ? "host" : "miss";
+        queries.push_back({prefix + std::to_string(rng() % names), "bench",
+                           "example", "com"});
+    }
+
+    run("StaticLookup", lookup, queries);
+    run("FrozenStaticLookup", frozen, queries);
+    return 0;
+}
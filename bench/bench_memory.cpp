@@ -0,0 +1,136 @@
+#include <argparse/argparse.hpp>
+#include <bighorn/static_lookup.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <unordered_map>
+
+// Reports heap bytes per record for the previous StaticLookup layout (a map
+// of owner name to std::vector<Rr>, with wildcards stored twice) and for the
+// RecordStore layout. Allocations are counted by replacing operator new; the
+// per-allocation figure approximates malloc's own header and rounding.
+
+namespace {
+
+const size_t MallocOverhead = 16;
+size_t live_bytes = 0;
+size_t live_allocations = 0;
+
+struct alignas(std::max_align_t) AllocationHeader {
+    size_t size;
+};
+
+}  // namespace
+
+void *operator new(size_t size) {
+    auto *header = static_cast<AllocationHeader *>(
+        std::malloc(sizeof(AllocationHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    live_bytes += size;
+    ++live_allocations;
+    return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto *header = static_cast<AllocationHeader *>(ptr) - 1;
+    live_bytes -= header->size;
+    --live_allocations;
+    std::free(header);
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+struct LegacyStaticLookup {
+    std::unordered_map<std::string, std::vector<bighorn::Rr>> records;
+    std::unordered_map<std::string, std::vector<bighorn::Rr>> wildcard_records;
+
+    void add_record(const bighorn::Rr &record) {
+        records[bighorn::labels_to_string(record.labels)].push_back(record);
+        if (record.labels.size() >= 2 && record.labels[0] == "*") {
+            wildcard_records[bighorn::labels_to_string(record.labels)]
+                .push_back(record);
+        }
+    }
+};
+
+// Each host gets A, AAAA, MX and TXT records; every hundredth is a wildcard
+template <typename F>
+size_t generate(size_t hosts, F &&add) {
+    size_t count = 0;
+    for (size_t i = 0; i < hosts; ++i) {
+        bighorn::Labels name{i % 100 == 0 ? "*" : "host" + std::to_string(i),
+                             "zone" + std::to_string(i % 1000), "example",
+                             "com"};
+        add(bighorn::Rr::a_record(name, static_cast<uint32_t>(i), 300));
+        add(bighorn::Rr::aaaa_record(name, {0x20, 0x01, 0x0d, 0xb8}, 300));
+        add(bighorn::Rr::mx_record(name, 10, {"mail", "example", "com"}, 300));
+        bighorn::Rr txt{.labels = name,
+                        .rtype = bighorn::RrType::Txt,
+                        .rclass = bighorn::RrClass::In,
+                        .ttl = 300,
+                        .rdata = {}};
+        txt.rdata.push_back(25);
+        std::string spf = "v=spf1 include:_spf ~all";
+        txt.rdata.insert(txt.rdata.end(), spf.begin(), spf.end());
+        txt.rdata.push_back(0);
+        add(std::move(txt));
+        count += 4;
+    }
+    return count;
+}
+
+template <typename L>
+void measure(const char *label, size_t hosts) {
+    auto bytes_before = live_bytes;
+    auto allocations_before = live_allocations;
+    auto *lookup = new L();
+    size_t records = generate(hosts, [&](bighorn::Rr record) {
+        lookup->add_record(record);
+    });
+    if constexpr (requires { lookup->compact(); }) {
+        lookup->compact();
+    }
+    auto bytes = live_bytes - bytes_before;
+    auto allocations = live_allocations - allocations_before;
+    auto total = bytes + allocations * MallocOverhead;
+    std::cout << label << ": " << records << " records, "
+              << static_cast<double>(bytes) / records << " bytes/record, "
+              << static_cast<double>(allocations) / records
+              << " allocations/record, "
+              << static_cast<double>(total) / records
+              << " bytes/record with malloc overhead\n";
+    delete lookup;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_memory");
+    program.add_argument("--hosts")
+        .help("number of owner names to generate (four records each)")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(250000);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+
+    auto hosts = static_cast<size_t>(program.get<int>("hosts"));
+    measure<LegacyStaticLookup>("vector<Rr> per name", hosts);
+    measure<bighorn::StaticLookup>("RecordStore", hosts);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <argparse/argparse.hpp>
+#include <bighorn/record_cache.hpp>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+
+// Replays a Zipf-distributed stream of names against RecordCache, inserting
+// on every miss as a forwarding resolver would, and reports the hit ratio
+// and time per operation at increasing thread counts.
+
+// Draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s
+class ZipfDistribution {
+   public:
+    ZipfDistribution(size_t n, double s) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            cdf_[i] = sum;
+        }
+        for (auto &p : cdf_) {
+            p /= sum;
+        }
+    }
+
+    size_t operator()(std::mt19937 &rng) {
+        auto p = std::uniform_real_distribution<double>(0, 1)(rng);
+        auto found = std::lower_bound(cdf_.begin(), cdf_.end(), p);
+        return std::min<size_t>(found - cdf_.begin(), cdf_.size() - 1);
+    }
+
+   private:
+    std::vector<double> cdf_;
+};
+
+void run(unsigned threads, size_t capacity,
+         const std::vector<bighorn::Labels> &names,
+         const std::vector<std::vector<size_t>> &streams) {
+    bighorn::RecordCache cache({.capacity = capacity});
+    auto now = bighorn::RecordCache::Clock::now();
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (auto i : streams[t]) {
+                    const auto &name = names[i];
+                    if (!cache.find(name, bighorn::RrType::A,
+                                    bighorn::RrClass::In, now)) {
+                        cache.insert(name, bighorn::RrType::A,
+                                     bighorn::RrClass::In,
+                                     {bighorn::Rr::a_record(
+                                         name, static_cast<uint32_t>(i), 300)},
+                                     now);
+                    }
+                }
+            });
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    auto stats = cache.stats();
+    auto lookups = stats.hits + stats.misses;
+    std::cout << threads << " threads: "
+              << elapsed.count() * threads / static_cast<double>(lookups)
+              << " ns/lookup per thread, "
+              << static_cast<double>(lookups) / elapsed.count() * 1e3
+              << " M lookups/s, hit ratio "
+              << static_cast<double>(stats.hits) /
+                     static_cast<double>(lookups)
+              << ", " << stats.evictions << " evictions\n";
+}
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_record_cache");
+    program.add_argument("--names")
+        .help("number of distinct names queried")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(1000000);
+    program.add_argument("--capacity")
+        .help("cache capacity in RRsets")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(100000);
+    program.add_argument("--queries")
+        .help("number of queries per thread")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(1000000);
+    program.add_argument("--skew")
+        .help("Zipf exponent")
+        .scan<'g', double>()
+        .metavar("S")
+        .default_value(1.0);
+    program.add_argument("--max-threads")
+        .help("largest thread count to run")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(static_cast<int>(
+            std::max(std::thread::hardware_concurrency(), 1U)));
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+
+    auto name_count = static_cast<size_t>(program.get<int>("names"));
+    auto capacity = static_cast<size_t>(program.get<int>("capacity"));
+    auto query_count = static_cast<size_t>(program.get<int>("queries"));
+    auto max_threads = static_cast<unsigned>(program.get<int>("max-threads"));
+
+    std::vector<bighorn::Labels> names;
+    names.reserve(name_count);
+    for (size_t i = 0; i < name_count; ++i) {
+        names.push_back(
+            {"host" + std::to_string(i), "bench", "example", "com"});
+    }
+    ZipfDistribution zipf(name_count, program.get<double>("skew"));
+    std::vector<std::vector<size_t>> streams(max_threads);
+    for (unsigned t = 0; t < max_threads; ++t) {
+        std::mt19937 rng(t);
+        streams[t].reserve(query_count);
+        for (size_t i = 0; i < query_count; ++i) {
+            streams[t].push_back(zipf(rng));
+        }
+    }
+
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        run(threads, capacity, names, streams);
+    }
+    return 0;
+}
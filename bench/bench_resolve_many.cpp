@@ -0,0 +1,176 @@
+#include <argparse/argparse.hpp>
+#include <asio.hpp>
+#include <atomic>
+#include <bighorn/bulk_resolve.hpp>
+#include <bighorn/static_lookup.hpp>
+#include <bighorn/udp.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+
+// Resolves a generated stream of names through resolve_many against a local
+// UdpNameServer standing in for an upstream, and reports the queries per
+// second along with the peak heap in use. The peak should not grow with
+// --queries, only with --concurrency.
+
+namespace {
+
+std::atomic<size_t> live_bytes = 0;
+std::atomic<size_t> peak_bytes = 0;
+
+struct alignas(std::max_align_t) AllocationHeader {
+    size_t size;
+};
+
+}  // namespace
+
+void *operator new(size_t size) {
+    auto *header = static_cast<AllocationHeader *>(
+        std::malloc(sizeof(AllocationHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    auto live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_bytes.compare_exchange_weak(
+                              peak, live, std::memory_order_relaxed)) {
+    }
+    return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto *header = static_cast<AllocationHeader *>(ptr) - 1;
+    live_bytes.fetch_sub(header->size, std::memory_order_relaxed);
+    std::free(header);
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+bighorn::Labels host_name(size_t i) {
+    return {"host" + std::to_string(i), "example", "com"};
+}
+
+}  // namespace
+
+using namespace std::chrono_literals;
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_resolve_many");
+    program.add_argument("--names")
+        .help("number of distinct names served")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(10000);
+    program.add_argument("--queries")
+        .help("number of questions resolved")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(200000);
+    program.add_argument("--concurrency")
+        .help("resolutions in flight at once")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(100);
+    program.add_argument("--max-qps")
+        .help("rate cap on the server, or 0 for none")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(0);
+    program.add_argument("--threads")
+        .help("threads running the resolver")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(2);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+    auto names = static_cast<size_t>(program.get<int>("names"));
+    auto queries = static_cast<size_t>(program.get<int>("queries"));
+    auto threads = std::max(program.get<int>("threads"), 1);
+    auto max_qps = static_cast<uint32_t>(program.get<int>("max-qps"));
+    auto concurrency = static_cast<size_t>(program.get<int>("concurrency"));
+
+    asio::io_context server_io;
+    bighorn::StaticLookup lookup;
+    for (size_t i = 0; i < names; ++i) {
+        lookup.add_record(
+            bighorn::Rr::a_record(host_name(i), static_cast<uint32_t>(i), 300));
+    }
+    bighorn::UdpNameServer server(
+        server_io,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0),
+        bighorn::Responder(std::move(lookup)));
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        server_io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+    std::jthread server_thread([&] { server_io.run(); });
+
+    asio::io_context io;
+    bighorn::DefaultResolver resolver(
+        io, {bighorn::DnsServer{
+                .ip = asio::ip::address_v4::loopback().to_uint(),
+                .port = server.port(),
+                .conn_method = bighorn::ServerConnMethod::Udp,
+                .recursive = false,
+                .max_qps = max_qps}});
+
+    size_t generated = 0;
+    auto next = [&]() -> std::optional<bighorn::Question> {
+        if (generated == queries) {
+            return std::nullopt;
+        }
+        return bighorn::Question{.labels = host_name(generated++ % names),
+                                 .qtype = bighorn::RrType::A,
+                                 .qclass = bighorn::RrClass::In};
+    };
+    size_t failures = 0;
+    auto on_result = [&](bighorn::BulkResult result) {
+        if (result.resolution.err) {
+            ++failures;
+        }
+    };
+
+    auto baseline = live_bytes.load();
+    peak_bytes = baseline;
+    auto start = std::chrono::steady_clock::now();
+    asio::co_spawn(
+        io,
+        bighorn::resolve_many(resolver, next, on_result,
+                              {.concurrency = concurrency, .timeout = 5s}),
+        [&](const std::exception_ptr &ex, size_t) {
+            if (ex) {
+                std::cerr << "resolve_many failed\n";
+            }
+            asio::post(server_io, [&] {
+                cancel_server.emit(asio::cancellation_type::terminal);
+            });
+        });
+    {
+        std::vector<std::jthread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&] { io.run(); });
+        }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << queries << " queries in " << elapsed.count() << " s: "
+              << static_cast<double>(queries) / elapsed.count() << " qps, "
+              << failures << " failures, peak heap "
+              << (peak_bytes.load() - baseline) / 1024 << " KiB above start\n";
+    return 0;
+}
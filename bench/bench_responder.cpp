@@ -0,0 +1,207 @@
+#include <argparse/argparse.hpp>
+#include <asio.hpp>
+#include <bighorn/responder.hpp>
+#include <bighorn/static_lookup.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+
+// Times Responder::respond over a StaticLookup and counts its allocations.
+// The synchronous path is compared with the awaitable one, and with a lookup
+// that only offers the awaitable find_records, which is how every lookup was
+// queried before SyncLookup. The serialized paths are also run against a
+// ResponseCache, which answers repeated questions without the lookup.
+
+namespace {
+
+size_t allocations = 0;
+
+struct alignas(std::max_align_t) AllocationHeader {
+    size_t size;
+};
+
+}  // namespace
+
+void *operator new(size_t size) {
+    auto *header = static_cast<AllocationHeader *>(
+        std::malloc(sizeof(AllocationHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    ++allocations;
+    return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr != nullptr) {
+        std::free(static_cast<AllocationHeader *>(ptr) - 1);
+    }
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+// A StaticLookup seen only through the awaitable interface
+class AwaitableOnlyLookup : public bighorn::Lookup {
+   public:
+    explicit AwaitableOnlyLookup(std::shared_ptr<bighorn::StaticLookup> lookup)
+        : lookup_(std::move(lookup)) {}
+
+    asio::awaitable<bighorn::FoundRecords> find_records(
+        std::span<std::string const> labels, bighorn::RrType qtype,
+        bighorn::RrClass qclass, bool recursive) override {
+        co_return lookup_->find_records_sync(labels, qtype, qclass, recursive);
+    }
+
+    std::vector<bighorn::DomainAuthority> find_authorities(
+        std::span<std::string const> labels, bighorn::RrClass rclass) override {
+        return lookup_->find_authorities(labels, rclass);
+    }
+
+    bool supports_recursion() override { return false; }
+
+   private:
+    std::shared_ptr<bighorn::StaticLookup> lookup_;
+};
+
+void fill(bighorn::StaticLookup &lookup, size_t hosts) {
+    for (size_t i = 0; i < hosts; ++i) {
+        lookup.add_record(bighorn::Rr::a_record(
+            {"host" + std::to_string(i), "example", "com"},
+            static_cast<uint32_t>(i), 300));
+    }
+    lookup.compact();
+}
+
+void report(const char *label, std::chrono::steady_clock::duration elapsed,
+            size_t allocated, size_t queries) {
+    std::chrono::duration<double, std::nano> ns = elapsed;
+    std::cout << label << ": " << ns.count() / static_cast<double>(queries)
+              << " ns/query, "
+              << static_cast<double>(allocated) / static_cast<double>(queries)
+              << " allocations/query\n";
+}
+
+// Answers every query from one coroutine, so that only respond is measured
+template <typename L>
+void run_awaitable(const char *label, bighorn::Responder<L> &responder,
+                   const std::vector<bighorn::Message> &queries) {
+    asio::io_context io;
+    auto before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    asio::co_spawn(
+        io,
+        [&]() -> asio::awaitable<void> {
+            for (const auto &query : queries) {
+                auto response = co_await responder.respond(query);
+                if (response.answers.empty()) {
+                    std::cerr << "missing answer\n";
+                }
+            }
+        },
+        asio::detached);
+    io.run();
+    report(label, std::chrono::steady_clock::now() - start,
+           allocations - before, queries.size());
+}
+
+// The same, serializing each response as the servers do
+template <typename L>
+void run_bytes(const char *label, bighorn::Responder<L> &responder,
+               const std::vector<bighorn::Message> &queries) {
+    asio::io_context io;
+    auto before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    asio::co_spawn(
+        io,
+        [&]() -> asio::awaitable<void> {
+            for (const auto &query : queries) {
+                auto bytes = co_await responder.respond_bytes(query);
+                if (bytes.empty()) {
+                    std::cerr << "missing response\n";
+                }
+            }
+        },
+        asio::detached);
+    io.run();
+    report(label, std::chrono::steady_clock::now() - start,
+           allocations - before, queries.size());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_responder");
+    program.add_argument("--hosts")
+        .help("number of names in the zone")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(10000);
+    program.add_argument("--queries")
+        .help("number of queries answered on each path")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(1000000);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+    auto hosts = static_cast<size_t>(program.get<int>("hosts"));
+    auto query_count = static_cast<size_t>(program.get<int>("queries"));
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> host(0, hosts - 1);
+    std::vector<bighorn::Message> queries;
+    for (size_t i = 0; i < query_count; ++i) {
+        bighorn::Question question{
+            .labels = {"host" + std::to_string(host(rng)), "example", "com"},
+            .qtype = bighorn::RrType::A,
+            .qclass = bighorn::RrClass::In};
+        queries.push_back(bighorn::Message{
+            .header = {.id = 1, .opcode = bighorn::Opcode::Query, .rd = 0},
+            .questions = {question}});
+    }
+
+    bighorn::StaticLookup lookup;
+    fill(lookup, hosts);
+    bighorn::Responder responder(std::move(lookup));
+    auto shared = std::make_shared<bighorn::StaticLookup>();
+    fill(*shared, hosts);
+    bighorn::Responder awaitable_only(AwaitableOnlyLookup{shared});
+    bighorn::StaticLookup cached_lookup;
+    fill(cached_lookup, hosts);
+    bighorn::Responder cached(std::move(cached_lookup),
+                              std::make_shared<bighorn::ResponseCache>());
+    bighorn::Responder awaitable_cached(
+        AwaitableOnlyLookup{shared},
+        std::make_shared<bighorn::ResponseCache>());
+
+    auto before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &query : queries) {
+        auto response = responder.respond_sync(query);
+        if (response.answers.empty()) {
+            std::cerr << "missing answer\n";
+        }
+    }
+    report("respond_sync", std::chrono::steady_clock::now() - start,
+           allocations - before, queries.size());
+    run_awaitable("respond, SyncLookup", responder, queries);
+    run_awaitable("respond, awaitable lookup", awaitable_only, queries);
+    run_bytes("respond_bytes, SyncLookup", responder, queries);
+    run_bytes("respond_bytes, SyncLookup, cached", cached, queries);
+    run_bytes("respond_bytes, awaitable lookup", awaitable_only, queries);
+    run_bytes("respond_bytes, awaitable lookup, cached", awaitable_cached,
+              queries);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <argparse/argparse.hpp>
+#include <asio.hpp>
+#include <bighorn/recursive_lookup.hpp>
+#include <bighorn/responder.hpp>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+// Answers queries through Responder and RecursiveLookup while the only
+// upstream never replies, so that every query fails after its retries, and
+// reports the CPU time spent per failed query. Failures are reported as
+// error codes; for comparison the same run is repeated with a resolver that
+// throws them instead, as the resolvers used to, unwinding through every
+// coroutine frame between it and the caller.
+
+namespace {
+
+// Turns failed resolutions back into exceptions
+class ThrowingResolver : public bighorn::Resolver {
+   public:
+    explicit ThrowingResolver(bighorn::DefaultResolver resolver)
+        : resolver_(std::move(resolver)) {}
+
+    asio::awaitable<bighorn::Resolution> resolve(
+        bighorn::Labels labels, bighorn::RrType qtype, bighorn::RrClass qclass,
+        bool recursion_desired, std::chrono::milliseconds timeout) override {
+        auto resolution = co_await resolver_.resolve(
+            std::move(labels), qtype, qclass, recursion_desired, timeout);
+        if (resolution.err) {
+            throw std::runtime_error("Resolution failed");
+        }
+        co_return resolution;
+    }
+
+   private:
+    bighorn::DefaultResolver resolver_;
+};
+
+// Makes the resolver from the io_context the run uses
+template <typename MakeResolver>
+void run(const char *label, MakeResolver make_resolver, size_t queries,
+         std::chrono::milliseconds timeout) {
+    using R = std::invoke_result_t<MakeResolver, asio::io_context &>;
+    asio::io_context io;
+    bighorn::RecursiveLookup<R> lookup(io, make_resolver(io), timeout);
+    bighorn::Responder<bighorn::RecursiveLookup<R>> responder(
+        std::move(lookup));
+    size_t failures = 0;
+    size_t exceptions = 0;
+    std::vector<bighorn::Message> requests;
+    for (size_t i = 0; i < queries; ++i) {
+        bighorn::Question question{
+            .labels = {"host" + std::to_string(i), "example", "com"},
+            .qtype = bighorn::RrType::A,
+            .qclass = bighorn::RrClass::In};
+        requests.push_back(bighorn::Message{
+            .header = {.id = 1, .opcode = bighorn::Opcode::Query, .rd = 1},
+            .questions = {question}});
+    }
+
+    auto cpu_start = std::clock();
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &request : requests) {
+        asio::co_spawn(io, responder.respond(request),
+                       [&](const std::exception_ptr &ex,
+                           const bighorn::Message &response) {
+                           if (ex) {
+                               ++exceptions;
+                           } else if (response.header.rcode ==
+                                      bighorn::ResponseCode::ServerFailure) {
+                               ++failures;
+                           }
+                       });
+    }
+    io.run();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    auto cpu_us = static_cast<double>(std::clock() - cpu_start) * 1e6 /
+                  CLOCKS_PER_SEC;
+    std::cout << label << ": " << cpu_us / static_cast<double>(queries)
+              << " us CPU per query, " << elapsed.count() << " s wall, "
+              << failures << " SERVFAIL, " << exceptions << " exceptions\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench_upstream_outage");
+    program.add_argument("--queries")
+        .help("number of queries, each for a different name")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(20000);
+    program.add_argument("--timeout-ms")
+        .help("upstream timeout for each attempt")
+        .scan<'i', int>()
+        .metavar("MS")
+        .default_value(5);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+    auto queries = static_cast<size_t>(program.get<int>("queries"));
+    auto timeout = std::chrono::milliseconds(program.get<int>("timeout-ms"));
+
+    // Takes queries and never answers them
+    asio::io_context silent_io;
+    asio::ip::udp::socket silent_server(
+        silent_io,
+        asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    bighorn::DnsServer upstream{
+        .ip = asio::ip::address_v4::loopback().to_uint(),
+        .port = silent_server.local_endpoint().port(),
+        .conn_method = bighorn::ServerConnMethod::Udp,
+        .recursive = true};
+
+    run(
+        "error codes",
+        [&](asio::io_context &io) {
+            return bighorn::DefaultResolver(io, {upstream});
+        },
+        queries, timeout);
+    run(
+        "exceptions",
+        [&](asio::io_context &io) {
+            return ThrowingResolver(bighorn::DefaultResolver(io, {upstream}));
+        },
+        queries, timeout);
+    return 0;
+}
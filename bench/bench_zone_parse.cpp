@@ -0,0 +1,136 @@
+#include <argparse/argparse.hpp>
+#include <atomic>
+#include <bighorn/zone_file.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <thread>
+
+// Writes a synthetic zone of roughly the requested size, then measures parse
+// throughput and peak heap use with one thread and with every core, or as
+// many threads as asked for. The
+// sink drops each record, so the peak is what the parser itself holds on to.
+// Heap use is tracked by replacing operator new.
+
+namespace {
+
+std::atomic<size_t> live_bytes = 0;
+std::atomic<size_t> peak_bytes = 0;
+
+struct alignas(std::max_align_t) AllocationHeader {
+    size_t size;
+};
+
+}  // namespace
+
+void *operator new(size_t size) {
+    auto *header = static_cast<AllocationHeader *>(
+        std::malloc(sizeof(AllocationHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    auto live = live_bytes += size;
+    auto peak = peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+    return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto *header = static_cast<AllocationHeader *>(ptr) - 1;
+    live_bytes -= header->size;
+    std::free(header);
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
+
+void write_zone(const std::string& path, uint64_t target_bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "$ORIGIN bench.example.\n$TTL 3600\n";
+    out << "@ IN SOA ns1 hostmaster ( 1 7200 600 3600000 60 )\n";
+    std::string entry;
+    for (uint64_t i = 0; static_cast<uint64_t>(out.tellp()) < target_bytes;
+         ++i) {
+        entry = "host" + std::to_string(i);
+        out << entry << " 300 IN A 10." << (i >> 16 & 0xFF) << "."
+            << (i >> 8 & 0xFF) << "." << (i & 0xFF) << "\n";
+        out << "    IN AAAA 2001:db8::" << std::hex << (i & 0xFFFF) << std::dec
+            << "\n";
+        out << "    MX 10 mail" << i % 1000 << "\n";
+        out << "    TXT \"v=spf1 include:_spf.bench.example ~all\"\n";
+    }
+}
+
+void run(const std::string& path, unsigned threads) {
+    size_t records = 0;
+    bighorn::ZoneParseOptions options{.origin = {}, .threads = threads};
+    peak_bytes = live_bytes.load();
+    auto baseline = peak_bytes.load();
+    auto start = std::chrono::steady_clock::now();
+    auto result = bighorn::parse_zone_file(
+        path, options, [&](bighorn::Rr /*record*/) { ++records; });
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (result.err) {
+        std::cerr << "Parse failed on line " << result.line << ": "
+                  << result.err.message() << "\n";
+        return;
+    }
+    auto size = static_cast<double>(std::filesystem::file_size(path));
+    std::cout << threads << " thread(s): " << records << " records in "
+              << elapsed.count() << " s, "
+              << static_cast<uint64_t>(records / elapsed.count())
+              << " records/s, " << size / elapsed.count() / (1 << 20)
+              << " MiB/s, peak heap "
+              << static_cast<double>(peak_bytes - baseline) / (1 << 20)
+              << " MiB\n";
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("bench_zone_parse");
+    program.add_argument("--size-mb")
+        .help("size of the synthetic zone")
+        .scan<'i', int>()
+        .metavar("MB")
+        .default_value(4096);
+    program.add_argument("--threads")
+        .help("threads for the threaded run")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(static_cast<int>(
+            std::max(1U, std::thread::hardware_concurrency())));
+    program.add_argument("--path")
+        .help("where to write the synthetic zone")
+        .metavar("PATH")
+        .default_value(
+            (std::filesystem::temp_directory_path() / "bighorn_bench.zone")
+                .string());
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+
+    auto path = program.get<std::string>("path");
+    auto target =
+        static_cast<uint64_t>(program.get<int>("size-mb")) * (1ULL << 20);
+    std::cout << "Writing " << (target >> 20) << " MiB zone to " << path
+              << "\n";
+    write_zone(path, target);
+
+    run(path, 1);
+    run(path, static_cast<unsigned>(program.get<int>("threads")));
+    std::filesystem::remove(path);
+    return 0;
+}
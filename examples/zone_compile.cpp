@@ -0,0 +1,51 @@
+#include <argparse/argparse.hpp>
+#include <bighorn/zone_file.hpp>
+#include <bighorn/zone_image.hpp>
+#include <iostream>
+#include <thread>
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("zone_compile");
+    program.add_argument("zone").help("RFC 1035 master file to compile");
+    program.add_argument("image").help("output path of the compiled image");
+    program.add_argument("--origin")
+        .help("origin for relative names before any $ORIGIN")
+        .metavar("NAME")
+        .default_value(std::string(""));
+    program.add_argument("--threads")
+        .help("parser threads (all cores by default)")
+        .scan<'i', int>()
+        .metavar("N")
+        .default_value(0);
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << '\n';
+        std::cerr << program;
+        return 1;
+    }
+
+    auto threads = program.get<int>("threads");
+    bighorn::ZoneParseOptions options{
+        .origin = bighorn::string_to_labels(program.get<std::string>("origin")),
+        .threads = threads > 0
+                       ? static_cast<unsigned>(threads)
+                       : std::max(1U, std::thread::hardware_concurrency())};
+    bighorn::ZoneCompiler compiler;
+    auto zone_path = program.get<std::string>("zone");
+    auto result = bighorn::parse_zone_file(
+        zone_path, options,
+        [&](bighorn::Rr record) { compiler.add_record(std::move(record)); });
+    if (result.err) {
+        std::cerr << zone_path << ":" << result.line << ": "
+                  << result.err.message() << "\n";
+        return 1;
+    }
+    auto err = compiler.write(program.get<std::string>("image"));
+    if (err) {
+        std::cerr << "Could not write image: " << err.message() << "\n";
+        return 1;
+    }
+    std::cout << "Compiled " << result.record_count << " records\n";
+    return 0;
+}
@@ -53,7 +53,7 @@ class DataBuffer {
 
     [[nodiscard]] size_t pos() const { return i_; }
     void seek(size_t i) { i_ = i; }
-    void limit(uint8_t limit) { limit_ = limit; }
+    void limit(size_t limit) { limit_ = limit; }
 
    private:
     std::span<uint8_t const> data_;
@@ -0,0 +1,64 @@
+#pragma once
+#include <asio.hpp>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <ranges>
+
+#include "resolver.hpp"
+
+namespace bighorn {
+
+struct BulkOptions {
+    // Resolutions in flight at once
+    size_t concurrency = 100;
+    std::chrono::milliseconds timeout = 5s;
+    bool recursion_desired = true;
+};
+
+// A failed resolution has resolution.err set
+struct BulkResult {
+    Question question;
+    Resolution resolution;
+};
+
+// Gives the next question, or nothing once there are no more
+using QuestionSource = std::function<std::optional<Question>()>;
+using BulkResultHandler = std::function<void(BulkResult)>;
+
+// Resolves every question from the source, keeping options.concurrency
+// resolutions in flight. Questions are pulled only as resolutions finish,
+// so memory does not grow with the number of questions. Results are handed
+// to on_result as they complete, in no particular order. The source and the
+// handler are called from one strand, never at the same time. Rate caps are
+// those of the resolver's servers (DnsServer::max_qps). Cancelling it cancels
+// the resolutions in flight, and it returns once they have all finished.
+// Returns the number of questions resolved.
+asio::awaitable<size_t> resolve_many(Resolver& resolver, QuestionSource next,
+                                     BulkResultHandler on_result,
+                                     BulkOptions options = {});
+
+// As above, taking the questions from a range. The range is read lazily, so
+// it may be a view that generates them.
+template <std::ranges::input_range Questions>
+    requires std::convertible_to<std::ranges::range_reference_t<Questions>,
+                                 Question>
+asio::awaitable<size_t> resolve_many(Resolver& resolver, Questions&& questions,
+                                     BulkResultHandler on_result,
+                                     BulkOptions options = {}) {
+    auto it = std::ranges::begin(questions);
+    auto end = std::ranges::end(questions);
+    co_return co_await resolve_many(
+        resolver,
+        [&it, &end]() -> std::optional<Question> {
+            if (it == end) {
+                return std::nullopt;
+            }
+            Question question = *it;
+            ++it;
+            return question;
+        },
+        std::move(on_result), options);
+}
+
+}  // namespace bighorn
@@ -10,8 +10,10 @@
 #include <array>
 #include <asio.hpp>
 #include <cstdint>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 #include "buffer.hpp"
 #include "error.hpp"
@@ -59,7 +61,16 @@ using Ipv4Type = uint32_t;
 using Ipv6Type = std::array<uint8_t, 16>;
 using IpType = std::variant<Ipv4Type, Ipv6Type>;
 
+// Dotted form of a name. Dots and backslashes within a label are escaped
+// with a backslash, so that the string reads back into the same labels.
 std::string labels_to_string(std::span<std::string const> labels);
+Labels string_to_labels(std::string_view name);
+// Names compare without regard to ASCII case (RFC 4343)
+bool is_same_name(std::span<std::string const> a,
+                  std::span<std::string const> b);
+// Whether the name is the zone or a name below it
+bool is_within(std::span<std::string const> name,
+               std::span<std::string const> zone);
 
 struct Rr {
     std::vector<std::string> labels;
@@ -82,6 +93,10 @@ struct Rr {
                            RrClass rclass = RrClass::In);
     static Rr hinfo_record(Labels labels, std::string cpu, std::string os,
                            uint32_t ttl, RrClass rclass = RrClass::In);
+    static Rr soa_record(Labels labels, Labels mname, Labels rname,
+                         uint32_t serial, uint32_t refresh, uint32_t retry,
+                         uint32_t expire, uint32_t minimum, uint32_t ttl,
+                         RrClass rclass = RrClass::In);
 };
 
 [[nodiscard]] std::error_code read_labels(DataBuffer &buffer,
@@ -125,12 +140,23 @@ struct Question {
 [[nodiscard]] std::error_code read_question(DataBuffer &buffer,
                                             Question &question);
 
+// What a request's OPT pseudo-record (RFC 6891) asks for
+struct Edns {
+    // Largest UDP response the requester takes
+    uint16_t udp_size = 512;
+    // Set by requesters that want DNSSEC records (RFC 3225)
+    bool dnssec_ok = false;
+    bool operator==(const Edns &) const = default;
+};
+
 struct Message {
     Header header;
     std::vector<Question> questions{};
     std::vector<Rr> answers{};
     std::vector<Rr> authorities{};
     std::vector<Rr> additional{};
+    // Only read from requests; bytes() does not write an OPT record
+    std::optional<Edns> edns{};
     bool operator==(const Message &) const = default;
     [[nodiscard]] std::vector<uint8_t> bytes() const;
 };
@@ -138,4 +164,10 @@ struct Message {
 [[nodiscard]] std::error_code read_message(DataBuffer &buffer,
                                            Message &message);
 
+// Reads the header and questions of a request, and the OPT record if it
+// has one, and ignores the rest. The header is kept even when a question
+// cannot be read.
+[[nodiscard]] std::error_code read_request(DataBuffer &buffer,
+                                           Message &request);
+
 }  // namespace bighorn
@@ -19,6 +19,26 @@ enum class ResolutionError {
     RecursionLimit,
     RemoteFailure,
     RemoteRefused,
+    NonExistentDomain,
+    NoData,
+    TooManyWaiters,
+    TooManyReferrals,
+    NoReachableServers,
+};
+
+enum class ZoneError {
+    InvalidImage = 1,
+    UnsupportedVersion,
+    SyntaxError,
+    UnbalancedParentheses,
+    UnknownType,
+    InvalidTtl,
+    InvalidName,
+    InvalidRdata,
+    MissingOwner,
+    UnsupportedDirective,
+    RdataTooLong,
+    ZoneTooLarge,
 };
 
 struct MessageErrorCategory : std::error_category {
@@ -31,11 +51,18 @@ struct ResolutionErrorCategory : std::error_category {
     std::string message(int ev) const override;
 };
 
+struct ZoneErrorCategory : std::error_category {
+    const char *name() const noexcept override;
+    std::string message(int ev) const override;
+};
+
 const MessageErrorCategory msgErrCategory{};
 const ResolutionErrorCategory resolutionErrCategory{};
+const ZoneErrorCategory zoneErrCategory{};
 
 std::error_code make_error_code(bighorn::MessageError e);
 std::error_code make_error_code(bighorn::ResolutionError e);
+std::error_code make_error_code(bighorn::ZoneError e);
 
 }  // namespace bighorn
 
@@ -47,4 +74,7 @@ struct is_error_code_enum<bighorn::MessageError> : true_type {};
 template <>
 struct is_error_code_enum<bighorn::ResolutionError> : true_type {};
 
+template <>
+struct is_error_code_enum<bighorn::ZoneError> : true_type {};
+
 }  // namespace std
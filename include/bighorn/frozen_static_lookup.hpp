@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lookup.hpp"
+#include "static_lookup.hpp"
+#include "zone_file.hpp"
+
+namespace bighorn {
+
+// Immutable lookup for zones that are loaded once and then only read. Names
+// are indexed by a minimal perfect hash (hash and displace), and records live
+// in flat structure-of-arrays tables, so an exact match touches the pilot
+// table, one slot and the slot's name. Answers match the StaticLookup it was
+// built from.
+class FrozenStaticLookup : public Lookup {
+   public:
+    FrozenStaticLookup() = default;
+    explicit FrozenStaticLookup(const StaticLookup &source);
+
+    // Parses a master file straight into a frozen index
+    static ZoneParseResult from_zone_file(const std::string &path,
+                                          const ZoneParseOptions &options,
+                                          FrozenStaticLookup &lookup);
+
+    asio::awaitable<FoundRecords> find_records(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        bool recursive) override;
+    std::vector<DomainAuthority> find_authorities(
+        std::span<std::string const> labels, RrClass rclass) override;
+
+    [[nodiscard]] FoundRecords find_records_sync(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        bool recursive) const;
+
+    bool supports_recursion() override { return false; }
+
+    [[nodiscard]] size_t name_count() const { return fingerprints_.size(); }
+
+   private:
+    static constexpr uint32_t NoSlot = UINT32_MAX;
+
+    uint64_t seed_ = 0;
+    std::vector<uint32_t> pilots_;
+
+    // One entry per slot; offset arrays carry a trailing end marker
+    std::vector<uint64_t> fingerprints_;
+    std::vector<uint32_t> name_offsets_;
+    std::vector<uint32_t> first_rrsets_;
+    std::string names_;
+
+    std::vector<RrType> rrset_types_;
+    std::vector<RrClass> rrset_classes_;
+    std::vector<uint32_t> first_records_;
+
+    std::vector<uint32_t> ttls_;
+    std::vector<uint32_t> rdata_offsets_;
+    std::vector<uint8_t> rdata_;
+    // Slot of the name each MX or NS record points to, or NoSlot
+    std::vector<uint32_t> target_slots_;
+
+    size_t wildcard_count_ = 0;
+    std::vector<DomainAuthority> authorities_;
+
+    [[nodiscard]] uint32_t find_slot(std::string_view key) const;
+    // Also notes in targets the slots the records point to, if given
+    void append_records(uint32_t slot, RrType qtype, RrClass qclass,
+                        bool allow_cname, RecordList &matching_records,
+                        std::vector<uint32_t> *targets = nullptr) const;
+    void append_addresses(std::span<uint32_t const> targets, RrClass qclass,
+                          RecordList &additional) const;
+};
+
+}  // namespace bighorn
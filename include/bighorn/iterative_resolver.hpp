@@ -0,0 +1,92 @@
+#pragma once
+#include <asio.hpp>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "resolver.hpp"
+
+namespace bighorn {
+
+// The servers for one zone, as learned from a referral
+struct ZoneCut {
+    Labels zone;
+    std::shared_ptr<DefaultResolver> servers;
+    std::chrono::steady_clock::time_point expiry;
+};
+
+// Resolves names itself instead of forwarding them. Each query starts at the
+// closest zone cut it knows of, falling back to the root hints, and follows
+// referrals down from there. Referrals are cached per zone until their NS
+// records expire, and the servers of a cut keep their health between
+// queries. The number of cached cuts is bounded; when full, expired cuts are
+// dropped first, then those closest to expiry. Glue is only trusted for
+// names within the zone that gave it; when there is none, the A and AAAA
+// records of a few name servers are looked up in parallel and the first
+// name to resolve is used.
+class IterativeResolver : public Resolver {
+   public:
+    // Servers learned from referrals are queried on server_port. With no
+    // root hints the IANA root servers are used.
+    explicit IterativeResolver(
+        asio::io_context& io, std::vector<DnsServer> root_hints = {},
+        int server_port = 53,
+        std::shared_ptr<UpstreamTransport> transport = nullptr);
+
+    asio::awaitable<Resolution> resolve(
+        Labels labels, RrType qtype, RrClass qclass, bool recursion_desired,
+        std::chrono::milliseconds timeout) override;
+
+    // Zone cuts learned from referrals, not counting the root
+    [[nodiscard]] size_t cached_zone_count() const;
+
+   private:
+    asio::io_context& io_;
+    std::shared_ptr<UpstreamTransport> transport_;
+    int server_port_;
+    ZoneCut root_;
+    std::unique_ptr<std::shared_mutex> cuts_mutex_;
+    std::unordered_map<std::string, ZoneCut> cuts_;
+    // The keys of cuts_ in order of expiry, so that the cut to drop is
+    // found without a scan
+    std::set<std::pair<std::chrono::steady_clock::time_point, std::string>>
+        cut_expiries_;
+
+    // Resolves the name, following CNAMEs from the closest cut of each name
+    // in the chain. Depth counts the name server lookups this one is for.
+    asio::awaitable<Resolution> iterate(Labels labels, RrType qtype,
+                                        RrClass qclass,
+                                        std::chrono::milliseconds timeout,
+                                        int depth);
+
+    // Asks the closest cut and follows referrals until a server answers
+    asio::awaitable<UpstreamReply> descend(const Labels& labels, RrType qtype,
+                                           RrClass qclass,
+                                           std::chrono::milliseconds timeout,
+                                           int depth);
+
+    // Builds and caches the cut a referral points to. Fails with
+    // NoReachableServers when no address is known or found for its servers.
+    asio::awaitable<std::error_code> follow_referral(
+        const ZoneCut& parent, Labels zone, const Message& referral,
+        std::chrono::milliseconds timeout, int depth, ZoneCut& cut);
+
+    // Looks up the addresses of the name servers in parallel. Returns the
+    // servers of the first one to resolve, over IPv4 and IPv6 alike. Waits
+    // for the lookups it cancels, since they use the resolver. Runs on a
+    // strand.
+    asio::awaitable<std::vector<DnsServer>> resolve_name_servers(
+        std::vector<Labels> names, std::chrono::milliseconds timeout,
+        int depth);
+
+    ZoneCut closest_cut(std::span<std::string const> labels) const;
+};
+
+}  // namespace bighorn
@@ -1,7 +1,9 @@
 #pragma once
+#include <concepts>
 #include <span>
 
 #include "data.hpp"
+#include "record_list.hpp"
 #include "resolver.hpp"
 
 namespace bighorn {
@@ -18,17 +20,38 @@ struct DomainAuthority {
 
 bool is_label_match(std::span<std::string const> labels, const Rr &candidate);
 
+// Exact-name type match, where CNAME records also answer A queries
+bool is_type_match(RrType qtype, RrType rtype);
+
 bool is_authority_match(std::span<std::string const> labels,
                         const DomainAuthority &authority,
                         RrClass rclass = RrClass::In);
 
+// Whether records of the type point to a name whose addresses belong in the
+// additional section (RFC 1035 section 3.3): MX exchanges and NS hosts
+bool has_additional_target(RrType rtype);
+
+// Reads that name from the record's rdata. Returns false for other types,
+// or when the rdata cannot be read.
+bool read_additional_target(RrType rtype, std::span<uint8_t const> rdata,
+                            Labels &target);
+
+// An empty result with err NonExistentDomain or NoData is a definite
+// negative answer, and the authorities may hold the SOA that vouches for it.
+// Additional holds the A and AAAA records of the names the records point to,
+// as far as the lookup knows them. Records may refer to where the lookup
+// keeps them, so a result must not outlive the lookup.
 struct FoundRecords {
-    std::vector<Rr> records;
+    RecordList records;
+    RecordList authorities{};
+    RecordList additional{};
     std::error_code err;
 };
 
 class Lookup {
    public:
+    // Lookups that wait on anything stop when the awaiting coroutine is
+    // cancelled, as when the request's deadline passes
     virtual asio::awaitable<FoundRecords> find_records(
         std::span<std::string const> labels, RrType qtype, RrClass qclass,
         bool recursive) = 0;
@@ -37,4 +60,22 @@ class Lookup {
     virtual bool supports_recursion() = 0;
 };
 
+// A lookup that never has to wait can also answer without a coroutine, which
+// saves a frame allocation per call
+template <typename L>
+concept SyncLookup = requires(const L &lookup,
+                              std::span<std::string const> labels,
+                              RrType qtype, RrClass qclass, bool recursive) {
+    {
+        lookup.find_records_sync(labels, qtype, qclass, recursive)
+    } -> std::same_as<FoundRecords>;
+};
+
+// A lookup that can tell when its data changes. Responses cached under one
+// generation are not served once it has moved on.
+template <typename L>
+concept VersionedLookup = requires(const L &lookup) {
+    { lookup.generation() } -> std::convertible_to<uint64_t>;
+};
+
 }  // namespace bighorn
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <system_error>
+
+namespace bighorn {
+
+// Read-only memory mapping of a whole file. Pages are shared with every other
+// process mapping the same file.
+class MappedFile {
+   public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    ~MappedFile();
+
+    [[nodiscard]] std::span<uint8_t const> bytes() const {
+        return {data_, size_};
+    }
+
+   private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void *mapping_ = nullptr;
+#endif
+
+    void unmap();
+
+    friend std::error_code map_file(const std::string &path, MappedFile &file);
+};
+
+[[nodiscard]] std::error_code map_file(const std::string &path,
+                                       MappedFile &file);
+
+}  // namespace bighorn
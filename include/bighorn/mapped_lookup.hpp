@@ -0,0 +1,48 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string_view>
+
+#include "lookup.hpp"
+#include "mapped_file.hpp"
+#include "zone_image.hpp"
+
+namespace bighorn {
+
+// Serves a zone image produced by ZoneCompiler directly from a read-only
+// mapping. Copies share the mapping.
+class MappedLookup : public Lookup {
+   public:
+    MappedLookup() = default;
+
+    [[nodiscard]] static std::error_code open(const std::string &path,
+                                              MappedLookup &lookup);
+
+    asio::awaitable<FoundRecords> find_records(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        bool recursive) override;
+    std::vector<DomainAuthority> find_authorities(
+        std::span<std::string const> labels, RrClass rclass) override;
+
+    [[nodiscard]] FoundRecords find_records_sync(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        bool recursive) const;
+
+    bool supports_recursion() override { return false; }
+
+   private:
+    std::shared_ptr<const MappedFile> file_;
+    const ZoneImageHeader *header_ = nullptr;
+    std::span<const ZoneImageName> names_;
+    std::span<const ZoneImageRrset> rrsets_;
+    std::string_view strings_;
+    std::span<uint8_t const> data_;
+    std::vector<DomainAuthority> authorities_;
+
+    [[nodiscard]] const ZoneImageName *find_name(std::string_view key) const;
+    void append_records(const ZoneImageName &name, RrType qtype,
+                        RrClass qclass, bool allow_cname,
+                        RecordList &matching_records) const;
+};
+
+}  // namespace bighorn
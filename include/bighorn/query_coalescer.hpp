@@ -0,0 +1,66 @@
+#pragma once
+#include <asio.hpp>
+#include <asio/experimental/channel.hpp>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lookup.hpp"
+
+namespace bighorn {
+
+// Merges identical lookups that are in flight at the same time. The first
+// caller for a key starts the lookup, and every caller waits for its one
+// result. The lookup runs detached, so it completes for the callers that
+// joined it whatever happens to the one that started it. A caller that is
+// cancelled stops waiting, and once every caller has, the lookup is
+// cancelled too, unless one of them asked for it to finish regardless. The
+// bookkeeping runs on a strand.
+class QueryCoalescer {
+   public:
+    using LookupFn = std::function<asio::awaitable<FoundRecords>()>;
+
+    explicit QueryCoalescer(asio::io_context &io, size_t max_waiters = 1000);
+
+    // Starts the lookup, or joins the one already running for the key. Fails
+    // with TooManyWaiters once max_waiters callers are waiting on it. With
+    // keep_running the lookup completes even if every caller gives up, as
+    // when it refreshes a cache.
+    asio::awaitable<FoundRecords> run(std::string key, LookupFn lookup,
+                                      bool keep_running = false);
+
+    // Callers that joined a running lookup instead of starting one
+    [[nodiscard]] size_t coalesced_count() const { return coalesced_; }
+
+   private:
+    using ResultChannel = asio::experimental::channel<void(
+        std::error_code, std::exception_ptr, FoundRecords)>;
+
+    // One running lookup and the callers waiting on it
+    struct Flight {
+        std::vector<std::shared_ptr<ResultChannel>> waiters;
+        asio::cancellation_signal cancel;
+        bool keep_running = false;
+    };
+
+    asio::io_context &io_;
+    asio::strand<asio::io_context::executor_type> strand_;
+    size_t max_waiters_;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights_;
+    std::atomic_size_t coalesced_ = 0;
+
+    asio::awaitable<FoundRecords> join(std::string key, LookupFn lookup,
+                                       bool keep_running);
+    asio::awaitable<void> lead(std::string key, std::shared_ptr<Flight> flight,
+                               LookupFn lookup);
+
+    // Drops a caller that gave up, cancelling the lookup if it was the last
+    void leave(const std::string &key, const std::shared_ptr<Flight> &flight,
+               const std::shared_ptr<ResultChannel> &waiter);
+};
+
+}  // namespace bighorn
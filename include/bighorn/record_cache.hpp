@@ -0,0 +1,153 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "data.hpp"
+#include "record_list.hpp"
+
+namespace bighorn {
+
+struct RecordCacheOptions {
+    // Maximum number of cached RRsets across all shards
+    size_t capacity = 100000;
+    size_t shard_count = 16;
+    // An entry hit at least prefetch_min_hits times is due for a refresh
+    // once less than this fraction of its TTL is left. Zero disables it.
+    double prefetch_fraction = 0.1;
+    uint32_t prefetch_min_hits = 3;
+    // How long past expiry an entry may still be served stale (RFC 8767)
+    std::chrono::seconds stale_window = std::chrono::hours(24);
+};
+
+struct RecordCacheStats {
+    uint64_t hits = 0;
+    // Hits that answered NXDOMAIN or NODATA, included in hits
+    uint64_t negative_hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    // Hits that found the entry due for a refresh
+    uint64_t prefetches = 0;
+    // Expired entries served from the stale window, not included in hits
+    uint64_t stale_hits = 0;
+};
+
+// A cached answer. Negative answers have no records; their rcode tells
+// NXDOMAIN from NODATA and the authorities hold the zone's SOA. The records
+// are shared with the cache entry, carrying the time left as their TTLs.
+struct CachedAnswer {
+    RecordList records;
+    RecordList authorities;
+    ResponseCode rcode = ResponseCode::Ok;
+    // Set on the one hit that finds a popular entry close to expiry; the
+    // caller should refresh it in the background
+    bool prefetch = false;
+};
+
+// Sharded cache of answers keyed by (name, type, class). Entries expire at an
+// absolute time and are returned with their TTLs rewritten to the time left.
+// Each shard evicts with S3-FIFO: new entries go through a small probationary
+// queue, and only entries that were hit again, or that were recently evicted
+// and came back, reach the main queue. One-off names from scans cannot push
+// out popular ones. Lookups share a read lock; hits only bump an atomic.
+// Negative answers are cached as in RFC 2308, and an NXDOMAIN also answers
+// for every name below it (RFC 8020).
+class RecordCache {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RecordCache(RecordCacheOptions options = {});
+
+    [[nodiscard]] std::optional<CachedAnswer> find(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        Clock::time_point now);
+
+    // The entry even if it expired, as long as that was less than
+    // stale_window ago. Its TTLs are set to the 30 seconds RFC 8767
+    // recommends. For use when the upstreams cannot refresh it.
+    [[nodiscard]] std::optional<CachedAnswer> find_stale(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        Clock::time_point now);
+
+    // Caches the records until the smallest TTL among them runs out
+    void insert(std::span<std::string const> labels, RrType qtype,
+                RrClass qclass, std::vector<Rr> records, Clock::time_point now);
+
+    // Caches an NXDOMAIN (rcode NameError) or NODATA (rcode Ok) answer for
+    // the lesser of the SOA's TTL and minimum field. Without an SOA in the
+    // authorities nothing is cached. An answer reached through a CNAME chain
+    // is cached with the chain, only for the question's type, and for no
+    // longer than the shortest TTL in the chain.
+    void insert_negative(std::span<std::string const> labels, RrType qtype,
+                         RrClass qclass, ResponseCode rcode,
+                         std::vector<Rr> authorities, Clock::time_point now,
+                         std::vector<Rr> chain = {});
+
+    // Key under which answers to the question are cached, ignoring case
+    static std::string key(std::span<std::string const> labels, RrType qtype,
+                           RrClass qclass);
+
+    [[nodiscard]] RecordCacheStats stats() const;
+    [[nodiscard]] size_t size() const;
+
+   private:
+    // Replaced rather than modified, so answers still holding the old
+    // records keep them
+    struct Entry {
+        SharedRrs records;
+        SharedRrs authorities;
+        ResponseCode rcode = ResponseCode::Ok;
+        Clock::time_point expiry;
+        Clock::duration ttl{};
+        mutable std::atomic<uint8_t> frequency = 0;
+        mutable std::atomic<uint32_t> hits = 0;
+        mutable std::atomic_flag prefetching;
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::deque<const std::string *> small;
+        std::deque<const std::string *> main;
+        std::deque<std::string> ghost;
+        std::unordered_set<std::string> ghost_keys;
+        size_t small_capacity = 1;
+        size_t main_capacity = 1;
+
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> negative_hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<uint64_t> insertions = 0;
+        std::atomic<uint64_t> evictions = 0;
+        std::atomic<uint64_t> prefetches = 0;
+        std::atomic<uint64_t> stale_hits = 0;
+
+        void evict_small();
+        void evict_main();
+        void remember_ghost(const std::string &key);
+    };
+
+    RecordCacheOptions options_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    Shard &shard_for(const std::string &key);
+    std::optional<CachedAnswer> find_key(const std::string &key,
+                                         Clock::time_point now,
+                                         bool may_prefetch);
+    std::optional<CachedAnswer> find_stale_key(const std::string &key,
+                                               Clock::time_point now);
+    void store(std::string key, std::vector<Rr> records,
+               std::vector<Rr> authorities, ResponseCode rcode,
+               Clock::time_point now, Clock::duration ttl);
+};
+
+}  // namespace bighorn
@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "data.hpp"
+
+namespace bighorn {
+
+// Records shared by everything that answers with them. Never modified once
+// shared, so that no answer needs a copy of its own.
+using SharedRrs = std::shared_ptr<const std::vector<Rr>>;
+
+// A record whose owner and rdata stay where they are kept. The owner is
+// given by its labels or, when there are none, by its name in the escaped
+// dotted form lookups index by; the root has neither. The TTL is the one to
+// write, which need not be the stored record's.
+struct RrRef {
+    std::span<std::string const> labels{};
+    std::string_view name{};
+    RrType rtype;
+    RrClass rclass;
+    uint32_t ttl;
+    std::span<uint8_t const> rdata;
+
+    static RrRef of(const Rr &record) {
+        return RrRef{.labels = record.labels,
+                     .rtype = record.rtype,
+                     .rclass = record.rclass,
+                     .ttl = record.ttl,
+                     .rdata = record.rdata};
+    }
+
+    [[nodiscard]] Labels owner() const {
+        return labels.empty() ? string_to_labels(name)
+                              : Labels(labels.begin(), labels.end());
+    }
+    // A record that owns a copy of the data
+    [[nodiscard]] Rr to_rr() const {
+        return Rr{.labels = owner(),
+                  .rtype = rtype,
+                  .rclass = rclass,
+                  .ttl = ttl,
+                  .rdata = {rdata.begin(), rdata.end()}};
+    }
+    // Size in wire format, without compression
+    [[nodiscard]] size_t wire_size() const;
+
+    bool operator==(const RrRef &other) const {
+        return rtype == other.rtype && rclass == other.rclass &&
+               ttl == other.ttl && std::ranges::equal(rdata, other.rdata) &&
+               owner() == other.owner();
+    }
+    bool operator==(const Rr &other) const { return *this == of(other); }
+};
+
+// The records of one section of an answer, referred to rather than copied.
+// They are either kept by the lookup that found them, which outlives the
+// answer, or shared sets of records that the list holds on to.
+class RecordList {
+   public:
+    using value_type = RrRef;
+    using const_iterator = std::vector<RrRef>::const_iterator;
+    using iterator = const_iterator;
+
+    RecordList() = default;
+    // Takes the records over, to be written with their own TTLs
+    RecordList(std::vector<Rr> records)  // NOLINT(google-explicit-constructor)
+        : RecordList(std::make_shared<const std::vector<Rr>>(
+              std::move(records))) {}
+    explicit RecordList(SharedRrs records) {
+        if (records == nullptr) {
+            return;
+        }
+        refs_.reserve(records->size());
+        for (const auto &record : *records) {
+            refs_.push_back(RrRef::of(record));
+        }
+        kept_.push_back(std::move(records));
+    }
+    // The shared records, each to be written with the given TTL
+    RecordList(SharedRrs records, uint32_t ttl)
+        : RecordList(std::move(records)) {
+        for (auto &record : refs_) {
+            record.ttl = ttl;
+        }
+    }
+
+    // A record kept by the lookup that found it, for longer than the list
+    void push_back(const RrRef &record) { refs_.push_back(record); }
+
+    // The records of other that pred accepts, holding on to their data
+    template <typename Pred>
+    void append_if(const RecordList &other, Pred pred) {
+        bool appended = false;
+        for (const auto &record : other.refs_) {
+            if (pred(record)) {
+                refs_.push_back(record);
+                appended = true;
+            }
+        }
+        if (!appended) {
+            return;
+        }
+        for (const auto &records : other.kept_) {
+            if (std::find(kept_.begin(), kept_.end(), records) ==
+                kept_.end()) {
+                kept_.push_back(records);
+            }
+        }
+    }
+    void append(const RecordList &other) {
+        append_if(other, [](const RrRef &) { return true; });
+    }
+    void clear() {
+        refs_.clear();
+        kept_.clear();
+    }
+
+    [[nodiscard]] const_iterator begin() const { return refs_.begin(); }
+    [[nodiscard]] const_iterator end() const { return refs_.end(); }
+    [[nodiscard]] size_t size() const { return refs_.size(); }
+    [[nodiscard]] bool empty() const { return refs_.empty(); }
+    const RrRef &operator[](size_t i) const { return refs_[i]; }
+    [[nodiscard]] const RrRef &front() const { return refs_.front(); }
+    [[nodiscard]] const RrRef &back() const { return refs_.back(); }
+
+    // Copies of the records, for a Message
+    [[nodiscard]] std::vector<Rr> to_rrs() const;
+    [[nodiscard]] size_t wire_size() const;
+
+    bool operator==(const RecordList &other) const {
+        return refs_ == other.refs_;
+    }
+
+   private:
+    std::vector<RrRef> refs_;
+    std::vector<SharedRrs> kept_;
+};
+
+// Size of a response with the questions and sections, without compression
+size_t response_size(std::span<Question const> questions,
+                     const RecordList &answers, const RecordList &authorities,
+                     const RecordList &additional);
+
+// Writes a response in one allocation, counting the questions and records
+// in the header. Each record is written with the TTL its reference carries.
+std::vector<uint8_t> response_bytes(const Header &header,
+                                    std::span<Question const> questions,
+                                    const RecordList &answers,
+                                    const RecordList &authorities,
+                                    const RecordList &additional);
+
+}  // namespace bighorn
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "data.hpp"
+#include "record_list.hpp"
+
+namespace bighorn {
+
+// Compact in-memory storage for a zone. Each owner name is interned once,
+// rdata is packed into large arena chunks addressed by 32-bit offsets, and
+// records are fixed-size entries kept together by RRset under their owner.
+//
+//   for (auto i = store.find(key); i != RecordStore::NoEntry;
+//        i = store.entry(i).next) { ... }
+class RecordStore {
+   public:
+    static constexpr uint32_t NoEntry = UINT32_MAX;
+    static constexpr size_t ArenaChunkSize = 1 << 20;
+
+    struct Entry {
+        uint32_t owner;
+        uint32_t next;
+        uint32_t rdata;
+        uint32_t ttl;
+        uint16_t rdlength;
+        RrType rtype;
+        RrClass rclass;
+    };
+
+    // Fails with RdataTooLong for rdata over 65535 bytes, and ZoneTooLarge
+    // once the arena's 4 GiB of rdata are used up
+    [[nodiscard]] std::error_code add(const Rr &record);
+
+    // Rewrites the entry table so every RRset, and every name, occupies one
+    // contiguous run. Call once loading is finished. The index of RRsets used
+    // while loading is dropped, and rebuilt if records are added afterwards.
+    void compact();
+
+    // Index of the first record owned by the name, or NoEntry
+    [[nodiscard]] uint32_t find(const std::string &owner) const;
+
+    [[nodiscard]] const Entry &entry(uint32_t index) const {
+        return entries_[index];
+    }
+    [[nodiscard]] std::span<uint8_t const> rdata(const Entry &entry) const;
+    // The record in place. Names and rdata never move once added, so it
+    // stays valid for as long as the store.
+    [[nodiscard]] RrRef ref(const Entry &entry) const;
+
+    // Calls f(owner, first_index) for every name in insertion order
+    template <typename F>
+    void for_each_name(F &&f) const {
+        for (const auto &owner : owners_) {
+            f(*owner.key, owner.first);
+        }
+    }
+
+    [[nodiscard]] size_t name_count() const { return owners_.size(); }
+    [[nodiscard]] size_t record_count() const { return entries_.size(); }
+    [[nodiscard]] size_t wildcard_count() const { return wildcard_count_; }
+
+   private:
+    struct Owner {
+        // The interned name, in the escaped dotted form it is looked up by
+        const std::string *key;
+        uint32_t first;
+        uint32_t last;
+    };
+
+    // The RRset a record joins, by owner, type and class
+    struct RrsetKey {
+        uint32_t owner;
+        RrType rtype;
+        RrClass rclass;
+
+        bool operator==(const RrsetKey &) const = default;
+    };
+    struct RrsetKeyHash {
+        size_t operator()(const RrsetKey &key) const {
+            return std::hash<uint64_t>{}(
+                static_cast<uint64_t>(key.owner) << 32 |
+                static_cast<uint64_t>(key.rtype) << 16 |
+                static_cast<uint64_t>(key.rclass));
+        }
+    };
+
+    std::unordered_map<std::string, uint32_t> names_;
+    // Last entry of each RRset, which the next record of it is linked after.
+    // Only kept while loading.
+    std::unordered_map<RrsetKey, uint32_t, RrsetKeyHash> rrset_tails_;
+    std::vector<Owner> owners_;
+    std::vector<Entry> entries_;
+    std::vector<std::unique_ptr<uint8_t[]>> arena_;
+    size_t arena_used_ = ArenaChunkSize;
+    size_t wildcard_count_ = 0;
+
+    std::error_code store_rdata(std::span<uint8_t const> rdata,
+                                uint32_t &offset);
+    void index_rrsets();
+};
+
+}  // namespace bighorn
@@ -1,13 +1,63 @@
+#include <algorithm>
+#include <asio/experimental/awaitable_operators.hpp>
+#include <atomic>
+#include <memory>
+
+#include "bulk_resolve.hpp"
 #include "lookup.hpp"
+#include "query_coalescer.hpp"
+#include "record_cache.hpp"
 
 namespace bighorn {
 
+struct RecursiveLookupOptions {
+    // Most queries that may wait on one upstream resolution
+    size_t max_waiters = 1000;
+    // Most background refreshes of cache entries running at once
+    size_t max_prefetches = 16;
+    // How long a query for an expired entry waits on the refresh before it
+    // is answered from stale data (the client response timer of RFC 8767)
+    std::chrono::milliseconds stale_answer_budget = 1800ms;
+    // How long a fresh answer waits on the addresses of the names it points
+    // to. It is returned without the rest once this runs out, well before
+    // a client gives up on it.
+    std::chrono::milliseconds additional_budget = 300ms;
+};
+
+struct PrefetchStats {
+    uint64_t started = 0;
+    // Refreshes not started because max_prefetches were already running
+    uint64_t skipped = 0;
+    uint64_t failed = 0;
+    // Total time spent waiting on upstreams for refreshes
+    std::chrono::microseconds upstream_time{0};
+};
+
 template <std::derived_from<Resolver> R>
 class RecursiveLookup : public Lookup {
    public:
+    // Lookups may share one cache; each gets its own by default. Concurrent
+    // misses for the same question share one resolution. Popular entries
+    // the cache finds close to expiry are refreshed in the background, and
+    // expired entries are served stale when the upstreams fail or are slow.
+    // Answers carry the addresses of the names their MX and NS records point
+    // to, as far as they are cached or came with the reply; the rest are
+    // resolved together before a fresh answer is returned, for up to
+    // additional_budget, and in the background for a cached one. Cancelling
+    // a query, as when its client's deadline passes, cancels the upstream
+    // resolution once no other query is waiting on it.
     RecursiveLookup(asio::io_context &io, R resolver,
-                    std::chrono::milliseconds timeout = 5s)
-        : io_(io), resolver_(std::move(resolver)), timeout_(timeout) {}
+                    std::chrono::milliseconds timeout = 5s,
+                    std::shared_ptr<RecordCache> cache = nullptr,
+                    RecursiveLookupOptions options = {})
+        : io_(io),
+          resolver_(std::move(resolver)),
+          timeout_(timeout),
+          options_(options),
+          cache_(cache ? std::move(cache) : std::make_shared<RecordCache>()),
+          coalescer_(
+              std::make_shared<QueryCoalescer>(io, options.max_waiters)),
+          prefetch_(std::make_shared<PrefetchCounters>()) {}
 
     asio::awaitable<FoundRecords> find_records(
         std::span<std::string const> labels, RrType qtype, RrClass qclass,
@@ -20,24 +70,370 @@ class RecursiveLookup : public Lookup {
 
     bool supports_recursion() override { return true; }
 
+    [[nodiscard]] const RecordCache &cache() const { return *cache_; }
+    [[nodiscard]] const QueryCoalescer &coalescer() const {
+        return *coalescer_;
+    }
+    [[nodiscard]] PrefetchStats prefetch_stats() const {
+        return PrefetchStats{
+            .started = prefetch_->started,
+            .skipped = prefetch_->skipped,
+            .failed = prefetch_->failed,
+            .upstream_time =
+                std::chrono::microseconds(prefetch_->upstream_us.load())};
+    }
+
    private:
+    struct PrefetchCounters {
+        std::atomic_size_t running = 0;
+        std::atomic<uint64_t> started = 0;
+        std::atomic<uint64_t> skipped = 0;
+        std::atomic<uint64_t> failed = 0;
+        std::atomic<int64_t> upstream_us = 0;
+    };
+
     asio::io_context &io_;
     R resolver_;
     std::chrono::milliseconds timeout_;
+    RecursiveLookupOptions options_;
+    std::shared_ptr<RecordCache> cache_;
+    std::shared_ptr<QueryCoalescer> coalescer_;
+    std::shared_ptr<PrefetchCounters> prefetch_;
+
+    // Starts a detached refresh, unless too many are running already
+    void prefetch(Labels labels, RrType qtype, RrClass qclass);
+
+    // Resolves through the coalescer. The resolution finishes even if the
+    // caller gives up, since it refreshes the cache.
+    asio::awaitable<FoundRecords> refresh(Labels labels, RrType qtype,
+                                          RrClass qclass);
+
+    asio::awaitable<FoundRecords> resolve_and_cache(Labels labels,
+                                                    RrType qtype,
+                                                    RrClass qclass);
+
+    // Caches the resolution and turns it into the lookup's result
+    FoundRecords cache_resolution(std::span<std::string const> labels,
+                                  RrType qtype, RrClass qclass,
+                                  Resolution resolution);
+
+    // Adds the addresses of the names the records point to, from the cache
+    // or else from those the upstream offered. Offered addresses of names
+    // within the bailiwick are cached as well; others are only trusted for
+    // this answer. Returns the questions for the addresses that are still
+    // missing.
+    std::vector<Question> add_known_additional(
+        FoundRecords &found, RrClass qclass, const RecordList &offered = {},
+        std::span<std::string const> bailiwick = {});
+
+    // Resolves the missing addresses together, caching what comes back.
+    // Those not resolved within additional_budget are left to the
+    // background.
+    asio::awaitable<void> fetch_additional(FoundRecords &found,
+                                           std::vector<Question> missing);
+
+    // Caches the answer under the question, and each link of a CNAME chain
+    // on its own, so that a query for any name along it is answered from
+    // the rest of the chain
+    void cache_chain(std::span<std::string const> labels, RrType qtype,
+                     RrClass qclass, const std::vector<Rr> &records);
 };
 
+namespace detail {
+
+inline std::error_code negative_answer_error(ResponseCode rcode,
+                                             bool has_records) {
+    if (rcode == ResponseCode::NameError) {
+        return ResolutionError::NonExistentDomain;
+    }
+    if (rcode == ResponseCode::Ok && !has_records) {
+        return ResolutionError::NoData;
+    }
+    return {};
+}
+
+// The name a negative answer is about, which is the end of any CNAME chain
+// leading to it
+inline Labels negative_answer_name(std::span<std::string const> labels,
+                                   const std::vector<Rr> &records) {
+    if (!records.empty() && records.back().rtype == RrType::Cname) {
+        Labels target;
+        DataBuffer buffer(records.back().rdata);
+        if (!read_labels(buffer, target)) {
+            return target;
+        }
+    }
+    return Labels(labels.begin(), labels.end());
+}
+
+// Whether a CNAME chain ends in a name without records of the type, which
+// the SOA in the authorities vouches for
+inline bool is_chain_to_nodata(RrType qtype, const Resolution &resolution) {
+    return resolution.rcode == ResponseCode::Ok &&
+           qtype != RrType::Cname && qtype != RrType::All &&
+           !resolution.records.empty() &&
+           resolution.records.back().rtype == RrType::Cname &&
+           !resolution.authorities.empty();
+}
+
+// Whether the lookup failed, as opposed to giving a negative answer
+inline bool is_failure(const std::error_code &err) {
+    return err && err != ResolutionError::NoData &&
+           err != ResolutionError::NonExistentDomain;
+}
+
+inline FoundRecords found_from_cache(CachedAnswer answer) {
+    auto err = negative_answer_error(answer.rcode, !answer.records.empty());
+    return FoundRecords{.records = std::move(answer.records),
+                        .authorities = std::move(answer.authorities),
+                        .err = err};
+}
+
+}  // namespace detail
+
 template <std::derived_from<Resolver> R>
 inline asio::awaitable<FoundRecords> RecursiveLookup<R>::find_records(
     std::span<std::string const> labels, RrType qtype, RrClass qclass,
     bool /*recursive*/) {
-    Labels label_vec(labels.begin(), labels.end());
+    auto now = RecordCache::Clock::now();
+    if (auto cached = cache_->find(labels, qtype, qclass, now)) {
+        if (cached->prefetch) {
+            prefetch(Labels(labels.begin(), labels.end()), qtype, qclass);
+        }
+        auto found = detail::found_from_cache(std::move(*cached));
+        for (auto &question : add_known_additional(found, qclass)) {
+            prefetch(std::move(question.labels), question.qtype, qclass);
+        }
+        co_return found;
+    }
+    auto stale = cache_->find_stale(labels, qtype, qclass, now);
+    if (!stale.has_value()) {
+        co_return co_await coalescer_->run(
+            RecordCache::key(labels, qtype, qclass),
+            [this, label_vec = Labels(labels.begin(), labels.end()), qtype,
+             qclass] { return resolve_and_cache(label_vec, qtype, qclass); });
+    }
+
+    // Stale data is the fallback if the refresh fails or is slow, in which
+    // case the refresh carries on in the background
+    using namespace asio::experimental::awaitable_operators;
+    asio::steady_timer budget(co_await asio::this_coro::executor,
+                              options_.stale_answer_budget);
+    auto refreshed = co_await (
+        refresh(Labels(labels.begin(), labels.end()), qtype, qclass) ||
+        budget.async_wait(asio::as_tuple(asio::use_awaitable)));
+    if (refreshed.index() == 0 &&
+        !detail::is_failure(std::get<0>(refreshed).err)) {
+        co_return std::get<0>(std::move(refreshed));
+    }
+    auto found = detail::found_from_cache(std::move(*stale));
+    for (auto &question : add_known_additional(found, qclass)) {
+        prefetch(std::move(question.labels), question.qtype, qclass);
+    }
+    co_return found;
+}
+
+template <std::derived_from<Resolver> R>
+inline asio::awaitable<FoundRecords> RecursiveLookup<R>::refresh(
+    Labels labels, RrType qtype, RrClass qclass) {
+    co_return co_await coalescer_->run(
+        RecordCache::key(labels, qtype, qclass),
+        [this, labels, qtype, qclass] {
+            return resolve_and_cache(labels, qtype, qclass);
+        },
+        true);
+}
+
+template <std::derived_from<Resolver> R>
+inline void RecursiveLookup<R>::prefetch(Labels labels, RrType qtype,
+                                         RrClass qclass) {
+    auto counters = prefetch_;
+    if (counters->running.fetch_add(1) >= options_.max_prefetches) {
+        --counters->running;
+        ++counters->skipped;
+        return;
+    }
+    ++counters->started;
+    auto key = RecordCache::key(labels, qtype, qclass);
+    auto start = std::chrono::steady_clock::now();
+    // Goes through the coalescer, so misses that arrive meanwhile join it
+    asio::co_spawn(
+        io_,
+        coalescer_->run(
+            std::move(key),
+            [this, labels = std::move(labels), qtype, qclass] {
+                return resolve_and_cache(labels, qtype, qclass);
+            },
+            true),
+        [counters, start](const std::exception_ptr &ex, FoundRecords found) {
+            counters->upstream_us +=
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+            if (ex || detail::is_failure(found.err)) {
+                ++counters->failed;
+            }
+            --counters->running;
+        });
+}
+
+template <std::derived_from<Resolver> R>
+inline asio::awaitable<FoundRecords> RecursiveLookup<R>::resolve_and_cache(
+    Labels labels, RrType qtype, RrClass qclass) {
     Resolution resolution =
-        co_await resolver_.resolve(label_vec, qtype, qclass, true, timeout_);
-    std::error_code err;
+        co_await resolver_.resolve(labels, qtype, qclass, true, timeout_);
+    RecordList offered = std::move(resolution.additional);
+    auto found = cache_resolution(labels, qtype, qclass, std::move(resolution));
+    // The zone that answered is at most the parent of the name asked about
+    std::span<std::string const> bailiwick = labels;
+    auto missing = add_known_additional(
+        found, qclass, offered,
+        bailiwick.subspan(std::min<size_t>(bailiwick.size(), 1)));
+    if (!missing.empty()) {
+        co_await fetch_additional(found, std::move(missing));
+    }
+    co_return found;
+}
+
+template <std::derived_from<Resolver> R>
+inline FoundRecords RecursiveLookup<R>::cache_resolution(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    Resolution resolution) {
+    if (resolution.err) {
+        return FoundRecords{.records = {}, .err = resolution.err};
+    }
+    auto err = detail::negative_answer_error(resolution.rcode,
+                                             !resolution.records.empty());
     if (resolution.rcode == ResponseCode::Refused) {
         err = ResolutionError::RemoteRefused;
+    } else if (err || detail::is_chain_to_nodata(qtype, resolution)) {
+        auto now = RecordCache::Clock::now();
+        cache_->insert_negative(
+            detail::negative_answer_name(labels, resolution.records), qtype,
+            qclass, resolution.rcode, resolution.authorities, now);
+        if (!resolution.records.empty()) {
+            cache_->insert_negative(labels, qtype, qclass, resolution.rcode,
+                                    resolution.authorities, now,
+                                    resolution.records);
+        }
+    } else if (resolution.rcode == ResponseCode::Ok) {
+        cache_chain(labels, qtype, qclass, resolution.records);
+    }
+    return FoundRecords{.records = std::move(resolution.records),
+                        .authorities = std::move(resolution.authorities),
+                        .err = err};
+}
+
+template <std::derived_from<Resolver> R>
+inline std::vector<Question> RecursiveLookup<R>::add_known_additional(
+    FoundRecords &found, RrClass qclass, const RecordList &offered,
+    std::span<std::string const> bailiwick) {
+    std::vector<Question> missing;
+    std::vector<Labels> targets;
+    Labels target;
+    for (const auto &record : found.records) {
+        if (!read_additional_target(record.rtype, record.rdata, target) ||
+            std::ranges::any_of(targets, [&](const auto &seen) {
+                return is_same_name(seen, target);
+            })) {
+            continue;
+        }
+        targets.push_back(target);
+    }
+    auto now = RecordCache::Clock::now();
+    for (auto &name : targets) {
+        for (auto rtype : {RrType::A, RrType::Aaaa}) {
+            auto is_address = [&](const RrRef &record) {
+                return record.rtype == rtype;
+            };
+            if (auto cached = cache_->find(name, rtype, qclass, now)) {
+                // This hit may be the one that finds the entry due
+                if (cached->prefetch) {
+                    prefetch(name, rtype, qclass);
+                }
+                found.additional.append_if(cached->records, is_address);
+                continue;
+            }
+            auto before = found.additional.size();
+            found.additional.append_if(offered, [&](const RrRef &record) {
+                return record.rtype == rtype && record.rclass == qclass &&
+                       is_same_name(record.labels, name);
+            });
+            if (found.additional.size() == before) {
+                missing.push_back(
+                    Question{.labels = name, .qtype = rtype, .qclass = qclass});
+            } else if (!bailiwick.empty() && is_within(name, bailiwick)) {
+                std::vector<Rr> addresses;
+                for (auto i = before; i < found.additional.size(); ++i) {
+                    addresses.push_back(found.additional[i].to_rr());
+                }
+                cache_->insert(name, rtype, qclass, std::move(addresses), now);
+            }
+        }
+    }
+    return missing;
+}
+
+template <std::derived_from<Resolver> R>
+inline asio::awaitable<void> RecursiveLookup<R>::fetch_additional(
+    FoundRecords &found, std::vector<Question> missing) {
+    using namespace asio::experimental::awaitable_operators;
+    BulkOptions options{.concurrency = missing.size(),
+                        .timeout = timeout_,
+                        .recursion_desired = true};
+    std::vector<Question> resolved;
+    asio::steady_timer budget(co_await asio::this_coro::executor,
+                              options_.additional_budget);
+    // Either way both sides have finished before found goes out of scope
+    co_await (
+        resolve_many(
+            resolver_, missing,
+            [&](BulkResult result) {
+                const auto &question = result.question;
+                if (result.resolution.err) {
+                    return;
+                }
+                auto addresses = cache_resolution(
+                    question.labels, question.qtype, question.qclass,
+                    std::move(result.resolution));
+                found.additional.append_if(
+                    addresses.records, [&](const RrRef &record) {
+                        return record.rtype == question.qtype;
+                    });
+                resolved.push_back(question);
+            },
+            options) ||
+        budget.async_wait(asio::as_tuple(asio::use_awaitable)));
+    for (auto &question : missing) {
+        if (std::ranges::none_of(resolved, [&](const auto &done) {
+                return done.qtype == question.qtype &&
+                       is_same_name(done.labels, question.labels);
+            })) {
+            prefetch(std::move(question.labels), question.qtype,
+                     question.qclass);
+        }
+    }
+}
+
+template <std::derived_from<Resolver> R>
+inline void RecursiveLookup<R>::cache_chain(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    const std::vector<Rr> &records) {
+    auto now = RecordCache::Clock::now();
+    cache_->insert(labels, qtype, qclass, records, now);
+    if (qtype == RrType::Cname) {
+        return;
+    }
+    // Resolvers return chains in order, each CNAME followed by its target
+    for (size_t i = 0;
+         i < records.size() && records[i].rtype == RrType::Cname; ++i) {
+        cache_->insert(records[i].labels, RrType::Cname, qclass,
+                       {records[i]}, now);
+        if (i + 1 < records.size()) {
+            cache_->insert(records[i + 1].labels, qtype, qclass,
+                           {records.begin() + i + 1, records.end()}, now);
+        }
     }
-    co_return FoundRecords{.records = resolution.records, .err = err};
 }
 
 }  // namespace bighorn
\ No newline at end of file
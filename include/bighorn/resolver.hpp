@@ -1,7 +1,9 @@
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <future>
-#include <shared_mutex>
+#include <memory>
+#include <optional>
 #include <span>
 #include <string>
 #include <utility>
@@ -9,25 +11,123 @@
 #include <vector>
 
 #include "data.hpp"
+#include "upstream_transport.hpp"
 
 namespace bighorn {
 
 using asio::ip::udp;
 using namespace std::chrono_literals;
 
-enum class ServerConnMethod { Udp };
+// Servers reached over UDP are asked again over TCP when a reply is
+// truncated. Tcp skips UDP altogether.
+enum class ServerConnMethod { Udp, Tcp };
 
 struct DnsServer {
     std::variant<Ipv4Type, Ipv6Type> ip;
     int port = 53;
     ServerConnMethod conn_method;
     bool recursive;
+    // Most queries per second sent to the server, or zero for no cap
+    uint32_t max_qps = 0;
     bool operator==(const DnsServer&) const = default;
 };
 
 struct Resolution {
     std::vector<Rr> records;
     ResponseCode rcode;
+    // Authority section of the final reply, which carries the SOA for
+    // negative answers
+    std::vector<Rr> authorities{};
+    // Additional section of the final reply, such as the addresses of MX
+    // exchanges. Not vouched for by the zone that answered.
+    std::vector<Rr> additional{};
+    // Set when no usable reply was had at all, such as when every upstream
+    // timed out. Failures are reported here rather than thrown, so that an
+    // outage costs no more per query than an answer does.
+    std::error_code err{};
+
+    static Resolution failed(std::error_code err) {
+        return Resolution{.records = {},
+                          .rcode = ResponseCode::ServerFailure,
+                          .authorities = {},
+                          .err = err};
+    }
+};
+
+// Moves the records answering the name from the answers to the chain,
+// following CNAMEs through the answers given. Sets next to the name still to
+// be asked about when the chain ends at a CNAME whose target was not
+// answered, or to nothing. An ANY query follows CNAMEs too, unless the name
+// has other records. Fails with InvalidResponse when a CNAME target cannot be
+// read.
+[[nodiscard]] std::error_code follow_cname_chain(
+    std::vector<Rr>& answers, Labels name, RrType qtype,
+    std::vector<Rr>& chain, std::optional<Labels>& next);
+
+// Health of one upstream server. Round-trip times are smoothed as in RFC
+// 6298. Consecutive failures past a threshold put the server in backoff,
+// doubling each time. Once a backoff ends, a single probe query may try the
+// server again, and a success clears its record. State is kept in atomics,
+// so reading it takes no locks.
+class UpstreamHealth {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    void record_success(std::chrono::microseconds rtt);
+    // A timeout also counts as a round trip of the whole timeout
+    void record_timeout(std::chrono::microseconds timeout,
+                        Clock::time_point now);
+    void record_failure(Clock::time_point now);
+
+    // SRTT + 4 * RTTVAR, or the fallback before the first sample
+    [[nodiscard]] std::chrono::microseconds expected_rtt(
+        std::chrono::microseconds fallback) const;
+
+    [[nodiscard]] bool backing_off(Clock::time_point now) const;
+
+    // Whether the caller may send the probe for a server whose backoff has
+    // ended. Only one caller wins; the others see the server still backing
+    // off until the probe's result is recorded.
+    [[nodiscard]] bool claim_probe(Clock::time_point now);
+
+   private:
+    std::atomic<int64_t> srtt_us_ = -1;
+    std::atomic<int64_t> rttvar_us_ = 0;
+    std::atomic<uint32_t> failures_ = 0;
+    // Clock ticks since the epoch; zero when not backing off
+    std::atomic<Clock::rep> retry_at_ = 0;
+
+    [[nodiscard]] Clock::duration backoff() const;
+};
+
+// Paces queries to a rate with the generic cell rate algorithm, allowing
+// bursts of a tenth of a second's worth. Callers are given a later slot
+// rather than turned away. The schedule is one atomic, so reserving a slot
+// takes no locks.
+class RateLimiter {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    // A rate of zero never delays
+    explicit RateLimiter(uint32_t per_second);
+
+    // Takes the next free slot, returning how long until it comes
+    [[nodiscard]] Clock::duration reserve(Clock::time_point now);
+
+   private:
+    Clock::duration interval_{};
+    Clock::duration burst_{};
+    // Clock ticks since the epoch at which the schedule is next free
+    std::atomic<Clock::rep> next_free_ = 0;
+};
+
+struct Upstream {
+    explicit Upstream(DnsServer server)
+        : server(server), limiter(server.max_qps) {}
+
+    DnsServer server;
+    UpstreamHealth health;
+    RateLimiter limiter;
 };
 
 class Resolver {
@@ -39,25 +139,44 @@ class Resolver {
 
 class DefaultResolver : public Resolver {
    public:
-    explicit DefaultResolver(asio::io_context& io,
-                             std::vector<DnsServer> servers = {})
-        : io_(io),
-          slist_(std::move(servers)),
-          slist_mutex_(std::make_unique<std::shared_mutex>()) {}
+    // Resolvers may share one transport; each gets its own by default
+    explicit DefaultResolver(
+        asio::io_context& io, std::vector<DnsServer> servers = {},
+        std::shared_ptr<UpstreamTransport> transport = nullptr);
 
     asio::awaitable<Resolution> resolve(
         Labels labels, RrType qtype, RrClass qclass, bool recursion_desired,
         std::chrono::milliseconds timeout) override;
 
+    // Sends the query to the servers, retrying failed attempts, and returns
+    // the first good reply as it came, without following CNAMEs. Cancelling
+    // it cancels the queries in flight and stops the retries.
+    asio::awaitable<UpstreamReply> exchange(Message query,
+                                            std::chrono::milliseconds timeout);
+
+    // Replaces the server list. Servers that stay keep their health, and
+    // resolutions already running finish with the list they started with.
+    void set_servers(const std::vector<DnsServer>& servers);
+
    private:
+    using UpstreamList = std::vector<std::shared_ptr<Upstream>>;
+
     asio::io_context& io_;
-    std::vector<DnsServer> slist_;
-    std::unique_ptr<std::shared_mutex> slist_mutex_;
+    std::shared_ptr<UpstreamTransport> transport_;
+    // Published copy-on-write, so that a resolution holds the list it
+    // started with while set_servers() replaces it. The atomic is not
+    // lock-free in libstdc++, which guards it with a short internal lock;
+    // only the pointer swap is under it, never the list itself.
+    std::unique_ptr<std::atomic<std::shared_ptr<const UpstreamList>>>
+        upstreams_;
 
-    template <class CompletionToken>
-    auto async_query_server(const DnsServer& server, Message query,
-                            std::chrono::milliseconds timeout,
-                            CompletionToken&& token);
+    // Queries the servers best first, hedging to the next one when a reply
+    // is later than the current server's expected RTT. Servers backing off
+    // are skipped, except for a probe sent alongside the first query. The
+    // first good reply wins and the other queries are cancelled. Runs on a
+    // strand.
+    asio::awaitable<UpstreamReply> fan_out(Message query,
+                                           std::chrono::milliseconds timeout);
 };
 
 }  // namespace bighorn
\ No newline at end of file
@@ -1,100 +1,294 @@
 #pragma once
 #include <asio.hpp>
+#include <memory>
 
 #include "data.hpp"
 #include "lookup.hpp"
+#include "record_list.hpp"
 #include "resolver.hpp"
+#include "response_cache.hpp"
 
 namespace bighorn {
 
 template <std::derived_from<Lookup> L>
 class Responder {
    public:
-    explicit Responder(L lookup) : lookup_(std::move(lookup)) {}
+    // Serialized responses are cached if given a cache. Without a
+    // VersionedLookup, they are only dropped when their TTLs run out, so a
+    // lookup whose records change while in use is answered stale until then.
+    // StaticLookup is versioned; FrozenStaticLookup and MappedLookup cannot
+    // change.
+    explicit Responder(L lookup, std::shared_ptr<ResponseCache> cache = nullptr)
+        : Responder(std::make_shared<L>(std::move(lookup)),
+                    std::move(cache)) {}
 
+    // Shares the lookup, so that its data can still be changed through the
+    // pointer, or through lookup(), once the responder is in use. Changes
+    // must not race with responses being computed, as when both run on the
+    // server's strand.
+    explicit Responder(std::shared_ptr<L> lookup,
+                       std::shared_ptr<ResponseCache> cache = nullptr)
+        : lookup_(std::move(lookup)), cache_(std::move(cache)) {}
+
+    [[nodiscard]] L &lookup() { return *lookup_; }
+    [[nodiscard]] const L &lookup() const { return *lookup_; }
+
+    // Cancelling the response cancels the lookups it is waiting on. A
+    // SyncLookup is answered without a coroutine per lookup.
     asio::awaitable<Message> respond(const Message &query) {
-        Message response;
+        if constexpr (SyncLookup<L>) {
+            co_return respond_sync(query);
+        } else {
+            co_return to_message(co_await draft(query));
+        }
+    }
+
+    // The same response, computed in place
+    Message respond_sync(const Message &query)
+        requires SyncLookup<L>
+    {
+        return to_message(draft_sync(query));
+    }
+
+    // The response serialized in at most max_size bytes, written straight
+    // from where the lookup keeps the records. A cached response is sent as
+    // it was, with only its ID, question name and TTLs patched.
+    asio::awaitable<std::vector<uint8_t>> respond_bytes(
+        const Message &query, size_t max_size = UINT16_MAX) {
+        if constexpr (SyncLookup<L>) {
+            co_return respond_bytes_sync(query, max_size);
+        } else {
+            auto now = ResponseCache::Clock::now();
+            auto generation = lookup_generation();
+            if (cache_ != nullptr) {
+                if (auto cached =
+                        cache_->find(query, max_size, generation, now)) {
+                    co_return std::move(*cached);
+                }
+            }
+            auto response = co_await draft(query);
+            co_return store_bytes(query, response, max_size, generation, now);
+        }
+    }
+
+    std::vector<uint8_t> respond_bytes_sync(const Message &query,
+                                            size_t max_size = UINT16_MAX)
+        requires SyncLookup<L>
+    {
+        auto now = ResponseCache::Clock::now();
+        auto generation = lookup_generation();
+        if (cache_ != nullptr) {
+            if (auto cached = cache_->find(query, max_size, generation, now)) {
+                return std::move(*cached);
+            }
+        }
+        auto response = draft_sync(query);
+        return store_bytes(query, response, max_size, generation, now);
+    }
+
+   private:
+    // A response whose records are still where the lookup found them. It
+    // refers to the query's questions, so must not outlive the query.
+    struct Draft {
+        Header header;
+        std::span<Question const> questions;
+        RecordList answers;
+        RecordList authorities;
+        RecordList additional;
+    };
+
+    std::shared_ptr<L> lookup_;
+    std::shared_ptr<ResponseCache> cache_;
+
+    // Read before the lookup, so that a response computed while the data
+    // changed is stored under the old generation and never served
+    uint64_t lookup_generation() const {
+        if constexpr (VersionedLookup<L>) {
+            return lookup_->generation();
+        } else {
+            return 0;
+        }
+    }
+
+    asio::awaitable<Draft> draft(const Message &query) {
+        Draft response;
+        if (!begin_response(query, response)) {
+            co_return response;
+        }
+        const auto &question = query.questions[0];
+        auto recursion_desired = query.header.rd == 1;
+        auto found_records = co_await lookup_->find_records(
+            question.labels, question.qtype, question.qclass,
+            recursion_desired);
+        if (add_answers(found_records, response) &&
+            add_authorities(question, found_records, response)) {
+            check_name_exists(co_await lookup_->find_records(
+                                  question.labels, RrType::All,
+                                  question.qclass, recursion_desired),
+                              response);
+        }
+        co_return response;
+    }
+
+    Draft draft_sync(const Message &query)
+        requires SyncLookup<L>
+    {
+        Draft response;
+        if (!begin_response(query, response)) {
+            return response;
+        }
+        const auto &question = query.questions[0];
+        auto recursion_desired = query.header.rd == 1;
+        auto found_records = lookup_->find_records_sync(
+            question.labels, question.qtype, question.qclass,
+            recursion_desired);
+        if (add_answers(found_records, response) &&
+            add_authorities(question, found_records, response)) {
+            check_name_exists(
+                lookup_->find_records_sync(question.labels, RrType::All,
+                                           question.qclass, recursion_desired),
+                response);
+        }
+        return response;
+    }
+
+    // A response that owns copies of the records
+    static Message to_message(const Draft &response) {
+        Message message{
+            .header = response.header,
+            .questions = {response.questions.begin(),
+                          response.questions.end()},
+            .answers = response.answers.to_rrs(),
+            .authorities = response.authorities.to_rrs(),
+            .additional = response.additional.to_rrs()};
+        message.header.qdcount = message.questions.size();
+        message.header.ancount = message.answers.size();
+        message.header.nscount = message.authorities.size();
+        message.header.arcount = message.additional.size();
+        return message;
+    }
+
+    // The response in at most max_size bytes. Additional records are
+    // dropped first; if the answer still does not fit it is left out and TC
+    // is set, so that the client asks again over TCP.
+    static std::vector<uint8_t> fit_bytes(Draft &response, size_t max_size) {
+        auto size = [&] {
+            return response_size(response.questions, response.answers,
+                                 response.authorities, response.additional);
+        };
+        if (size() > max_size) {
+            response.additional.clear();
+        }
+        if (size() > max_size) {
+            response.header.tc = 1;
+            response.answers.clear();
+            response.authorities.clear();
+        }
+        return response_bytes(response.header, response.questions,
+                              response.answers, response.authorities,
+                              response.additional);
+    }
+
+    std::vector<uint8_t> store_bytes(const Message &query, Draft &response,
+                                     size_t max_size, uint64_t generation,
+                                     ResponseCache::Clock::time_point now) {
+        auto bytes = fit_bytes(response, max_size);
+        if (cache_ != nullptr) {
+            cache_->insert(query, max_size, generation, bytes, now);
+        }
+        return bytes;
+    }
+
+    // Whether the lookup failed, as opposed to finding nothing
+    static bool is_failure(const std::error_code &err) {
+        return err && err != ResolutionError::NoData &&
+               err != ResolutionError::NonExistentDomain;
+    }
+
+    // Sets up the header. Returns false when there is nothing to look up.
+    bool begin_response(const Message &query, Draft &response) {
         response.questions = query.questions;
         response.header = query.header;
         response.header.qr = 1;
         response.header.aa = 1;
         response.header.z = 0;  // No extensions currently supported
-        if (lookup_.supports_recursion()) {
+        if (lookup_->supports_recursion()) {
             response.header.ra = 1;
-        } else if (!lookup_.supports_recursion() && query.header.rd) {
+        } else if (query.header.rd) {
             response.header.rcode = ResponseCode::Refused;
-            co_return response;
+            return false;
         }
-        if (query.questions.empty()) {
-            co_return response;
+        return !query.questions.empty();
+    }
+
+    // Moves the answers, and the addresses of the names they point to, into
+    // the response, or sets the error in their place. Returns false when the
+    // response is complete.
+    static bool add_answers(FoundRecords &found_records, Draft &response) {
+        if (found_records.err == ResolutionError::RemoteRefused) {
+            response.header.rcode = ResponseCode::Refused;
+            return false;
         }
-        try {
-            auto question = query.questions[0];
-            auto recursion_desired = query.header.rd == 1;
-            auto found_records = co_await lookup_.find_records(
-                question.labels, question.qtype, question.qclass,
-                recursion_desired);
-            if (found_records.err == ResolutionError::RemoteRefused) {
-                response.header.rcode = ResponseCode::Refused;
-                co_return response;
-            }
-            auto records = found_records.records;
-            std::copy(records.begin(), records.end(),
-                      std::back_inserter(response.answers));
-            if (question.qtype == RrType::Mx) {
-                co_await add_additional_records_for_mx(
-                    question.labels, response, recursion_desired);
-            }
-            if (records.size() == 0) {
-                check_authorities(question, response);
-                if (response.authorities.empty()) {
-                    auto all_related_records = co_await lookup_.find_records(
-                        question.labels, RrType::All, question.qclass,
-                        recursion_desired);
-                    if (all_related_records.records.size() == 0) {
-                        response.header.rcode = ResponseCode::NameError;
-                    }
-                }
-            }
-        } catch (std::exception &e) {
+        if (found_records.err == ResolutionError::NonExistentDomain) {
+            response.header.rcode = ResponseCode::NameError;
+            // Any CNAMEs leading to the name that does not exist
+            response.answers = std::move(found_records.records);
+            response.authorities = std::move(found_records.authorities);
+            return false;
+        }
+        if (is_failure(found_records.err)) {
             response.header.rcode = ResponseCode::ServerFailure;
+            return false;
         }
-        response.header.ancount = response.answers.size();
-        response.header.arcount = response.additional.size();
-        response.header.qdcount = response.questions.size();
-        response.header.nscount = response.authorities.size();
-        co_return response;
+        response.answers = std::move(found_records.records);
+        response.additional = std::move(found_records.additional);
+        return true;
     }
 
-   private:
-    L lookup_;
+    // Adds the authorities for an empty answer. Returns true when whether
+    // the name exists at all is still to be checked.
+    bool add_authorities(const Question &question, FoundRecords &found_records,
+                         Draft &response) {
+        if (found_records.err == ResolutionError::NoData) {
+            // The name exists, so there is no need to ask about it again
+            response.authorities = std::move(found_records.authorities);
+            return false;
+        }
+        if (!response.answers.empty()) {
+            return false;
+        }
+        check_authorities(question, response);
+        return response.authorities.empty();
+    }
 
-    asio::awaitable<void> add_additional_records_for_mx(
-        std::span<std::string const> labels, Message &response,
-        bool recursive) {
-        auto found_records = co_await lookup_.find_records(
-            labels, RrType::A, RrClass::In, recursive);
-        for (auto &record : found_records.records) {
-            response.additional.push_back(record);
+    static void check_name_exists(const FoundRecords &all_related_records,
+                                  Draft &response) {
+        if (is_failure(all_related_records.err)) {
+            response.header.rcode = ResponseCode::ServerFailure;
+        } else if (all_related_records.records.empty()) {
+            response.header.rcode = ResponseCode::NameError;
         }
-        co_return;
     }
 
-    void check_authorities(const Question &question, Message &response) {
+    void check_authorities(const Question &question, Draft &response) {
         auto authorities =
-            lookup_.find_authorities(question.labels, question.qclass);
+            lookup_->find_authorities(question.labels, question.qclass);
+        if (authorities.empty()) {
+            return;
+        }
+        std::vector<Rr> name_servers;
+        std::vector<Rr> addresses;
         for (auto &authority : authorities) {
-            auto ns_record =
-                Rr::ns_record(authority.domain, authority.name, authority.ttl);
-            response.authorities.push_back(ns_record);
+            name_servers.push_back(
+                Rr::ns_record(std::move(authority.domain), authority.name,
+                              authority.ttl));
             for (auto &ip : authority.ips) {
-                auto a_record = Rr::a_record(authority.name, ip, 0);
-                response.additional.push_back(a_record);
+                addresses.push_back(Rr::a_record(authority.name, ip, 0));
             }
         }
-        if (authorities.size() != 0) {
-            response.header.aa = 0;
-        }
+        response.authorities.append(std::move(name_servers));
+        response.additional.append(std::move(addresses));
+        response.header.aa = 0;
     }
 };
 
@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "data.hpp"
+
+namespace bighorn {
+
+struct ResponseCacheOptions {
+    // Maximum number of cached responses
+    size_t capacity = 10000;
+};
+
+struct ResponseCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+};
+
+// Serialized responses, keyed by the question (ignoring case), the RD, CD
+// and DO bits of the query, the UDP size its EDNS record advertises, and the
+// size the response had to fit in. A hit is copied
+// with only its ID, question name and TTLs patched, so it skips both the
+// lookup and serialization. Entries expire with their smallest TTL, and are
+// dropped when the generation they were stored under is no longer current.
+// Oldest entries are evicted first.
+class ResponseCache {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ResponseCache(ResponseCacheOptions options = {});
+
+    // The cached response to the query, ready to send
+    [[nodiscard]] std::optional<std::vector<uint8_t>> find(
+        const Message &query, size_t max_size, uint64_t generation,
+        Clock::time_point now);
+
+    // Caches the response until the smallest TTL in it runs out. Responses
+    // without records, with a zero TTL, or with an rcode other than Ok or
+    // NameError are not cached.
+    void insert(const Message &query, size_t max_size, uint64_t generation,
+                std::vector<uint8_t> response, Clock::time_point now);
+
+    [[nodiscard]] ResponseCacheStats stats() const;
+    [[nodiscard]] size_t size() const;
+
+   private:
+    struct Entry {
+        std::vector<uint8_t> bytes;
+        // Where each record's TTL is in bytes
+        std::vector<uint16_t> ttl_offsets;
+        uint64_t generation = 0;
+        Clock::time_point stored;
+        Clock::time_point expiry;
+    };
+
+    ResponseCacheOptions options_;
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::deque<std::string> order_;
+
+    std::atomic<uint64_t> hits_ = 0;
+    std::atomic<uint64_t> misses_ = 0;
+    std::atomic<uint64_t> insertions_ = 0;
+    std::atomic<uint64_t> evictions_ = 0;
+};
+
+}  // namespace bighorn
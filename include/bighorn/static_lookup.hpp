@@ -1,36 +1,87 @@
 #pragma once
+#include <atomic>
+#include <unordered_map>
+
 #include "lookup.hpp"
+#include "record_store.hpp"
 
 namespace bighorn {
 class StaticLookup : public Lookup {
    public:
     StaticLookup() = default;
+    StaticLookup(StaticLookup&& other) noexcept
+        : records_(std::move(other.records_)),
+          authorities_(std::move(other.authorities_)),
+          generation_(other.generation_.load()),
+          additional_links_(std::move(other.additional_links_)) {}
+    StaticLookup& operator=(StaticLookup&& other) noexcept {
+        records_ = std::move(other.records_);
+        authorities_ = std::move(other.authorities_);
+        generation_ = other.generation_.load();
+        additional_links_ = std::move(other.additional_links_);
+        return *this;
+    }
     asio::awaitable<FoundRecords> find_records(
         std::span<std::string const> labels, RrType qtype, RrClass qclass,
         bool recursive) override;
     std::vector<DomainAuthority> find_authorities(
         std::span<std::string const> labels, RrClass rclass) override;
 
-    void add_record(Rr record) {
-        records_[labels_to_string(record.labels)].push_back(record);
-        if (record.labels.at(0) == "*" && record.labels.size() >= 2) {
-            wildcard_records_[labels_to_string(record.labels)].push_back(
-                record);
+    // Never modifies the index, so any number of threads may query
+    // concurrently once all records have been added. Records are referred
+    // to where the store keeps them.
+    [[nodiscard]] FoundRecords find_records_sync(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        bool recursive) const;
+
+    // Fails as RecordStore::add does, leaving the lookup as it was
+    std::error_code add_record(const Rr &record) {
+        if (auto err = records_.add(record)) {
+            return err;
+        }
+        ++generation_;
+        if (!additional_links_.empty()) {
+            additional_links_.clear();
         }
+        return {};
     }
 
+    // Packs the records of each name contiguously, and links each MX and NS
+    // record to the name it points to, once loading is finished. Without the
+    // links, those names are looked up with every answer.
+    void compact();
+
     void add_authority(const DomainAuthority& authority) {
         authorities_.push_back(authority);
+        ++generation_;
     }
 
+    // Moves on with every record or authority added, so that responses
+    // cached before the change are not served after it. Changes must not
+    // race with lookups, but the generation may be read from any thread.
+    [[nodiscard]] uint64_t generation() const { return generation_; }
+
     bool supports_recursion() override { return false; }
 
+    [[nodiscard]] size_t name_count() const { return records_.name_count(); }
+    [[nodiscard]] const RecordStore &records() const { return records_; }
+    [[nodiscard]] const std::vector<DomainAuthority> &authorities() const {
+        return authorities_;
+    }
+
    private:
-    std::unordered_map<std::string, std::vector<Rr>> records_;
-    std::unordered_map<std::string, std::vector<Rr>> wildcard_records_;
+    RecordStore records_;
     std::vector<DomainAuthority> authorities_;
+    std::atomic<uint64_t> generation_ = 0;
+    // First record of the name each MX or NS record points to, by index
+    std::unordered_map<uint32_t, uint32_t> additional_links_;
 
     void match_wildcards(std::span<std::string const> labels, RrType qtype,
-                         RrClass qclass, std::vector<Rr>& matching_records);
+                         RrClass qclass, RecordList& matching_records,
+                         std::vector<uint32_t>& targets) const;
+    // Notes the name the record at index points to, if it is in the zone
+    void add_target(uint32_t index, std::vector<uint32_t>& targets) const;
+    void append_addresses(uint32_t first, RrClass qclass,
+                          RecordList& additional) const;
 };
-}  // namespace bighorn
\ No newline at end of file
+}  // namespace bighorn
@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <asio.hpp>
+#include <asio/experimental/awaitable_operators.hpp>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <set>
+
+#include "responder.hpp"
+
+namespace bighorn {
+
+// Serves DNS over TCP (RFC 7766), where each message is preceded by its
+// length. Clients may pipeline requests on a connection; each is answered as
+// soon as it is resolved, so replies can come back out of order. At most
+// max_in_flight requests per connection are resolved or waiting to be
+// written at once, and no more is read until one of them is done. A
+// connection is closed when a message takes longer than idle_timeout to
+// arrive, and all of them when the server stops. Everything runs on the
+// acceptor's strand.
+template <std::derived_from<Lookup> L>
+class TcpNameServer {
+   public:
+    // Listens on the port for both IPv4 and IPv6 where the host allows it
+    TcpNameServer(asio::io_service &io, int port, Responder<L> responder,
+                  std::chrono::milliseconds idle_timeout = 10s,
+                  size_t max_in_flight = 16)
+        : TcpNameServer(io,
+                        asio::ip::tcp::endpoint(asio::ip::tcp::v6(), port),
+                        std::move(responder), idle_timeout, max_in_flight) {}
+
+    TcpNameServer(asio::io_service &io, asio::ip::tcp::endpoint endpoint,
+                  Responder<L> responder,
+                  std::chrono::milliseconds idle_timeout = 10s,
+                  size_t max_in_flight = 16)
+        : acceptor_(asio::make_strand(io)),
+          responder_(std::move(responder)),
+          idle_timeout_(idle_timeout),
+          max_in_flight_(std::max<size_t>(max_in_flight, 1)) {
+        acceptor_.open(endpoint.protocol());
+        if (endpoint.address().is_v6()) {
+            std::error_code ignore_err;
+            acceptor_.set_option(asio::ip::v6_only(false), ignore_err);
+        }
+        acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+    }
+
+    asio::awaitable<void> start() {
+        co_await asio::co_spawn(acceptor_.get_executor(), accept_loop(),
+                                asio::use_awaitable);
+    }
+
+    int port() { return acceptor_.local_endpoint().port(); }
+
+   private:
+    struct Connection {
+        explicit Connection(asio::ip::tcp::socket socket)
+            : socket(std::move(socket)),
+              request_done(this->socket.get_executor()) {}
+
+        asio::ip::tcp::socket socket;
+        // Framed responses waiting for the one write in progress
+        std::deque<std::vector<uint8_t>> outbox;
+        bool writing = false;
+        // Requests read whose responses are not yet written
+        size_t in_flight = 0;
+        // Never expires; cancelled to wake the reader when a request is done
+        asio::steady_timer request_done;
+    };
+
+    asio::ip::tcp::acceptor acceptor_;
+    Responder<L> responder_;
+    std::chrono::milliseconds idle_timeout_;
+    size_t max_in_flight_;
+    std::set<std::shared_ptr<Connection>> connections_;
+
+    asio::awaitable<void> accept_loop() {
+        try {
+            while (true) {
+                auto socket = co_await acceptor_.async_accept(
+                    acceptor_.get_executor(), asio::use_awaitable);
+                auto connection =
+                    std::make_shared<Connection>(std::move(socket));
+                connections_.insert(connection);
+                asio::co_spawn(acceptor_.get_executor(), serve(connection),
+                               asio::detached);
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Exception caught: " << e.what() << "\n";
+        }
+        for (const auto &connection : connections_) {
+            std::error_code ignore_err;
+            connection->socket.close(ignore_err);
+            connection->request_done.cancel();
+        }
+        connections_.clear();
+    }
+
+    asio::awaitable<void> serve(std::shared_ptr<Connection> connection) {
+        using namespace asio::experimental::awaitable_operators;
+        asio::steady_timer idle(acceptor_.get_executor());
+        // Reads into the buffer, giving up once the idle timer expires
+        auto read_within = [&](asio::mutable_buffer buffer)
+            -> asio::awaitable<bool> {
+            auto read = co_await (
+                asio::async_read(connection->socket, buffer,
+                                 asio::as_tuple(asio::use_awaitable)) ||
+                idle.async_wait(asio::as_tuple(asio::use_awaitable)));
+            co_return read.index() == 0 && !std::get<0>(std::get<0>(read));
+        };
+        while (true) {
+            while (connection->in_flight >= max_in_flight_ &&
+                   connection->socket.is_open()) {
+                connection->request_done.expires_at(
+                    asio::steady_timer::time_point::max());
+                co_await connection->request_done.async_wait(
+                    asio::as_tuple(asio::use_awaitable));
+            }
+            // The whole message, length and all, must arrive in time
+            std::array<uint8_t, 2> length{};
+            idle.expires_after(idle_timeout_);
+            if (!co_await read_within(asio::buffer(length))) {
+                break;
+            }
+            std::vector<uint8_t> data(length[0] << 8 | length[1]);
+            if (!co_await read_within(asio::buffer(data))) {
+                break;
+            }
+            ++connection->in_flight;
+            DataBuffer buffer(data);
+            Message request;
+            if (read_request(buffer, request)) {
+                Message response{.header = request.header};
+                response.header.rcode = ResponseCode::FormatError;
+                queue_response(connection, response.bytes());
+            } else if constexpr (SyncLookup<L>) {
+                // Answered in place, without a coroutine of its own
+                queue_response(connection,
+                               responder_.respond_bytes_sync(request));
+            } else {
+                asio::co_spawn(
+                    acceptor_.get_executor(),
+                    handle_request(connection, std::move(request)),
+                    asio::detached);
+            }
+        }
+        std::error_code ignore_err;
+        connection->socket.close(ignore_err);
+        connections_.erase(connection);
+    }
+
+    asio::awaitable<void> handle_request(std::shared_ptr<Connection> connection,
+                                         Message request) {
+        queue_response(connection, co_await responder_.respond_bytes(request));
+    }
+
+    void queue_response(const std::shared_ptr<Connection> &connection,
+                        const std::vector<uint8_t> &response_bytes) {
+        std::vector<uint8_t> framed{
+            static_cast<uint8_t>(response_bytes.size() >> 8),
+            static_cast<uint8_t>(response_bytes.size() & 0xFF)};
+        framed.insert(framed.end(), response_bytes.begin(),
+                      response_bytes.end());
+        connection->outbox.push_back(std::move(framed));
+        if (!connection->writing) {
+            connection->writing = true;
+            asio::co_spawn(acceptor_.get_executor(), write_queued(connection),
+                           asio::detached);
+        }
+    }
+
+    asio::awaitable<void> write_queued(std::shared_ptr<Connection> connection) {
+        while (!connection->outbox.empty()) {
+            auto bytes = std::move(connection->outbox.front());
+            connection->outbox.pop_front();
+            auto [err, _] = co_await asio::async_write(
+                connection->socket, asio::buffer(bytes),
+                asio::as_tuple(asio::use_awaitable));
+            --connection->in_flight;
+            connection->request_done.cancel();
+            if (err) {
+                connection->in_flight -= connection->outbox.size();
+                connection->outbox.clear();
+                break;
+            }
+        }
+        connection->writing = false;
+    }
+};
+
+}  // namespace bighorn
@@ -1,5 +1,7 @@
 #pragma once
 #include <asio.hpp>
+#include <asio/experimental/awaitable_operators.hpp>
+#include <chrono>
 #include <iostream>
 #ifndef NDEBUG
 #include <format>
@@ -12,21 +14,34 @@ namespace bighorn {
 template <std::derived_from<Lookup> L>
 class UdpNameServer {
    public:
-    UdpNameServer(asio::io_service &io, int port, Responder<L> responder)
-        : socket_(io, asio::ip::udp::endpoint(asio::ip::udp::v6(), port)),
-          responder_(std::move(responder)) {
-        std::error_code ignore_err;
-        socket_.set_option(asio::ip::v6_only(false), ignore_err);
+    // Listens on the port for both IPv4 and IPv6 where the host allows it.
+    // A request not answered within request_timeout is cancelled, along with
+    // the upstream work it started, and answered with SERVFAIL; stub
+    // resolvers have usually given up on it by then.
+    UdpNameServer(asio::io_service &io, int port, Responder<L> responder,
+                  std::chrono::milliseconds request_timeout = 2s)
+        : UdpNameServer(io,
+                        asio::ip::udp::endpoint(asio::ip::udp::v6(), port),
+                        std::move(responder), request_timeout) {}
+
+    UdpNameServer(asio::io_service &io, asio::ip::udp::endpoint endpoint,
+                  Responder<L> responder,
+                  std::chrono::milliseconds request_timeout = 2s)
+        : socket_(asio::make_strand(io), endpoint),
+          responder_(std::move(responder)),
+          request_timeout_(request_timeout) {
+        if (endpoint.address().is_v6()) {
+            std::error_code ignore_err;
+            socket_.set_option(asio::ip::v6_only(false), ignore_err);
+        }
     }
 
+    // Each request that has to wait is handled in its own coroutine, so a slow
+    // upstream resolution does not hold up the requests behind it. Everything
+    // touching the socket runs on the socket's strand.
     asio::awaitable<void> start() {
-        try {
-            while (true) {
-                co_await handle_recv();
-            }
-        } catch (const std::exception &e) {
-            std::cerr << "Exception caught: " << e.what() << "\n";
-        }
+        co_await asio::co_spawn(socket_.get_executor(), receive_loop(),
+                                asio::use_awaitable);
     }
 
     int port() { return socket_.local_endpoint().port(); }
@@ -34,41 +49,74 @@ class UdpNameServer {
    private:
     asio::ip::udp::socket socket_;
     Responder<L> responder_;
-    asio::ip::udp::endpoint remote_endpoint_;
-    std::array<uint8_t, 512> data_{};
+    std::chrono::milliseconds request_timeout_;
 
-    asio::awaitable<void> handle_recv() {
-        auto bytes_recv = co_await socket_.async_receive_from(
-            asio::buffer(data_), remote_endpoint_, asio::use_awaitable);
-        std::error_code err;
-        DataBuffer buffer(data_);
-        buffer.limit(bytes_recv);
+    static constexpr size_t MaxDatagramSize = 512;
 
-        Header header;
-        err = read_header(buffer, header);
-        if (err) {
-            header.rcode = ResponseCode::FormatError;
-            Message response = Message{.header = header};
-            co_await socket_.async_send_to(asio::buffer(response.bytes()),
-                                           remote_endpoint_,
-                                           asio::use_awaitable);
-            co_return;
+    asio::awaitable<std::vector<uint8_t>> respond_by_deadline(
+        const Message &request) {
+        using namespace asio::experimental::awaitable_operators;
+        asio::steady_timer deadline(socket_.get_executor(), request_timeout_);
+        auto responded = co_await (
+            responder_.respond_bytes(request, MaxDatagramSize) ||
+            deadline.async_wait(asio::as_tuple(asio::use_awaitable)));
+        if (responded.index() == 0) {
+            co_return std::get<0>(std::move(responded));
         }
-        std::vector<Question> question_rrs;
-        for (int i = 0; i < header.qdcount; ++i) {
-            Question question;
-            err = read_question(buffer, question);
-            if (err) {
-                header.rcode = ResponseCode::FormatError;
-                Message response = Message{.header = header};
-                co_await socket_.async_send_to(asio::buffer(response.bytes()),
-                                               remote_endpoint_,
-                                               asio::use_awaitable);
-                co_return;
+        Message response{.header = request.header,
+                         .questions = request.questions};
+        response.header.qr = 1;
+        response.header.rcode = ResponseCode::ServerFailure;
+        co_return response.bytes();
+    }
+
+    // Requests the lookup can answer in place are answered here, without
+    // starting a coroutine for them; the others each get their own.
+    asio::awaitable<void> receive_loop() {
+        try {
+            std::array<uint8_t, 512> data{};
+            while (true) {
+                asio::ip::udp::endpoint remote_endpoint;
+                auto bytes_recv = co_await socket_.async_receive_from(
+                    asio::buffer(data), remote_endpoint, asio::use_awaitable);
+                DataBuffer buffer(data, bytes_recv);
+                Message request;
+                std::vector<uint8_t> response_bytes;
+                if (read_request(buffer, request)) {
+                    Message response{.header = request.header};
+                    response.header.rcode = ResponseCode::FormatError;
+                    response_bytes = response.bytes();
+                } else if constexpr (SyncLookup<L>) {
+                    log_request(request);
+                    response_bytes =
+                        responder_.respond_bytes_sync(request, MaxDatagramSize);
+                } else {
+                    log_request(request);
+                    asio::co_spawn(
+                        socket_.get_executor(),
+                        handle_request(std::move(request), remote_endpoint),
+                        asio::detached);
+                    continue;
+                }
+                co_await socket_.async_send_to(
+                    asio::buffer(response_bytes), remote_endpoint,
+                    asio::as_tuple(asio::use_awaitable));
             }
-            question_rrs.push_back(std::move(question));
+        } catch (const std::exception &e) {
+            std::cerr << "Exception caught: " << e.what() << "\n";
         }
-        Message request{.header = header, .questions = std::move(question_rrs)};
+    }
+
+    // Takes the parsed request rather than the datagram, which keeps the
+    // frame small enough for asio to recycle
+    asio::awaitable<void> handle_request(
+        Message request, asio::ip::udp::endpoint remote_endpoint) {
+        auto response_bytes = co_await respond_by_deadline(request);
+        co_await socket_.async_send_to(asio::buffer(response_bytes),
+                                       remote_endpoint, asio::use_awaitable);
+    }
+
+    static void log_request([[maybe_unused]] const Message &request) {
 #ifndef NDEBUG
         std::cout << "Received request\n";
         std::cout << "- Header:\n";
@@ -81,7 +129,7 @@ class UdpNameServer {
         if (request.questions.empty()) {
             std::cout << "- No question\n";
         } else {
-            auto question = request.questions[0];
+            const auto &question = request.questions[0];
             std::cout << "- Question:\n";
             std::cout << std::format("    {}\n",
                                      labels_to_string(question.labels));
@@ -90,14 +138,6 @@ class UdpNameServer {
                                      static_cast<uint8_t>(question.qtype));
         }
 #endif
-        Message response = co_await responder_.respond(std::move(request));
-        auto response_bytes = response.bytes();
-        if (response_bytes.size() > 512) {
-            response.header.tc = 1;
-            response_bytes.resize(512);
-        }
-        co_await socket_.async_send_to(asio::buffer(response_bytes),
-                                       remote_endpoint_, asio::use_awaitable);
     }
 };
 
@@ -0,0 +1,143 @@
+#pragma once
+#include <asio.hpp>
+#include <asio/experimental/channel.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "data.hpp"
+
+namespace bighorn {
+
+struct UpstreamReply {
+    Message message;
+    std::error_code err;
+};
+
+// Shared pool of UDP sockets and TCP connections for upstream queries. Each
+// UDP socket is bound to an ephemeral port chosen by the OS and carries many
+// queries at once. Each server reached over TCP gets one persistent
+// connection, on which queries are pipelined. Every query gets a random ID,
+// and a reply is only accepted if its ID, sender and question match an
+// outstanding query. Sockets only read while they have queries outstanding,
+// so an idle transport keeps no work on the io_context.
+class UpstreamTransport {
+   public:
+    explicit UpstreamTransport(asio::io_context &io, size_t socket_count = 4);
+
+    // Sends the query with a fresh ID and waits for the matching reply. The
+    // timeout covers the whole exchange.
+    asio::awaitable<UpstreamReply> query(asio::ip::udp::endpoint server,
+                                         Message query,
+                                         std::chrono::milliseconds timeout);
+
+    // As query, but over the server's TCP connection, which is opened on
+    // first use and kept for later queries. Replies may come in any order.
+    // A connection that fails is replaced on the next query. Servers may
+    // close idle connections, which only shows once a query is sent on one;
+    // a query that finds its reused connection closed before any reply is
+    // sent once more on a new one.
+    asio::awaitable<UpstreamReply> query_tcp(asio::ip::tcp::endpoint server,
+                                             Message query,
+                                             std::chrono::milliseconds timeout);
+
+    // Replies dropped because they matched no outstanding query
+    [[nodiscard]] size_t rejected_count() const { return rejected_; }
+
+    // TCP connections opened so far
+    [[nodiscard]] size_t tcp_connect_count() const { return tcp_connects_; }
+
+   private:
+    using ReplyChannel =
+        asio::experimental::channel<void(std::error_code, Message)>;
+
+    struct PendingKey {
+        uint16_t id;
+        asio::ip::udp::endpoint server;
+        Question question;
+
+        bool operator<(const PendingKey &other) const {
+            return std::tie(id, server, question) <
+                   std::tie(other.id, other.server, other.question);
+        }
+    };
+
+    struct PooledSocket {
+        PooledSocket(asio::io_context &io, asio::ip::udp protocol);
+
+        asio::strand<asio::io_context::executor_type> strand;
+        asio::ip::udp::socket socket;
+        std::map<PendingKey, std::shared_ptr<ReplyChannel>> pending;
+        std::mt19937 rng;
+        bool reading = false;
+    };
+
+    struct PendingTcpQuery {
+        Question question;
+        std::shared_ptr<ReplyChannel> reply;
+    };
+
+    struct TcpConnection {
+        TcpConnection(asio::io_context &io, asio::ip::tcp::endpoint server);
+
+        asio::strand<asio::io_context::executor_type> strand;
+        asio::ip::tcp::socket socket;
+        asio::ip::tcp::endpoint server;
+        // Cancelled once connecting finishes, waking queries that wait on it
+        asio::steady_timer connected_signal;
+        std::map<uint16_t, PendingTcpQuery> pending;
+        // Framed queries waiting for the one write in progress
+        std::deque<std::vector<uint8_t>> outbox;
+        std::mt19937 rng;
+        bool connecting = false;
+        bool connected = false;
+        bool reading = false;
+        bool writing = false;
+        // Replies matched to a query so far
+        uint64_t replies_read = 0;
+        std::error_code connect_err;
+        // Set on the strand, read when picking a connection
+        std::atomic_bool broken = false;
+    };
+
+    asio::io_context &io_;
+    std::vector<std::shared_ptr<PooledSocket>> v4_sockets_;
+    std::vector<std::shared_ptr<PooledSocket>> v6_sockets_;
+    std::atomic_size_t next_socket_ = 0;
+    std::atomic_size_t rejected_ = 0;
+    std::mutex tcp_mutex_;
+    std::map<asio::ip::tcp::endpoint, std::shared_ptr<TcpConnection>>
+        tcp_connections_;
+    std::atomic_size_t tcp_connects_ = 0;
+
+    asio::awaitable<UpstreamReply> query_on_socket(
+        std::shared_ptr<PooledSocket> pooled, asio::ip::udp::endpoint server,
+        Message query, std::chrono::milliseconds timeout);
+    asio::awaitable<void> read_replies(std::shared_ptr<PooledSocket> pooled);
+
+    std::shared_ptr<TcpConnection> tcp_connection(
+        asio::ip::tcp::endpoint server);
+
+    // These run on the connection's strand. Sets stale when the connection
+    // was already open and broke before a reply was read on it.
+    asio::awaitable<UpstreamReply> query_on_connection(
+        std::shared_ptr<TcpConnection> connection, Message query,
+        std::chrono::milliseconds timeout, bool &stale);
+    asio::awaitable<std::error_code> connect(
+        std::shared_ptr<TcpConnection> connection,
+        asio::steady_timer &deadline);
+    asio::awaitable<void> write_queued(
+        std::shared_ptr<TcpConnection> connection);
+    asio::awaitable<void> read_tcp_replies(
+        std::shared_ptr<TcpConnection> connection);
+    // Fails every query on the connection and closes it
+    void break_connection(TcpConnection &connection, std::error_code err);
+};
+
+}  // namespace bighorn
@@ -0,0 +1,48 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "data.hpp"
+
+namespace bighorn {
+
+// Parser for RFC 1035 master files. Supports $ORIGIN, $TTL, relative names,
+// '@', parentheses, comments, quoted character strings, every record type in
+// RrType and the RFC 3597 generic "\# <length> <hex>" rdata form.
+//
+// Records are passed to the sink in file order, so the sink can feed a
+// StaticLookup or a ZoneCompiler directly:
+//
+//     parse_zone_file(path, options,
+//                     [&](Rr record) { lookup.add_record(record); });
+
+struct ZoneParseOptions {
+    Labels origin;
+    uint32_t default_ttl = 3600;
+    RrClass default_class = RrClass::In;
+    // Large inputs are split at entry boundaries and parsed on this many
+    // threads, which stay a few chunks ahead of the sink so that memory use
+    // does not grow with the input. The sink is still only called from the
+    // calling thread.
+    unsigned threads = 1;
+};
+
+struct ZoneParseResult {
+    std::error_code err;
+    size_t line = 0;  // Line of the entry that failed, if any
+    size_t record_count = 0;
+};
+
+using ZoneRecordSink = std::function<void(Rr)>;
+
+ZoneParseResult parse_zone(std::string_view text,
+                           const ZoneParseOptions &options,
+                           const ZoneRecordSink &sink);
+
+ZoneParseResult parse_zone_file(const std::string &path,
+                                const ZoneParseOptions &options,
+                                const ZoneRecordSink &sink);
+
+}  // namespace bighorn
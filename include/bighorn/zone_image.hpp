@@ -0,0 +1,91 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "data.hpp"
+#include "lookup.hpp"
+
+namespace bighorn {
+
+// Compiled zone images are immutable and position independent: every
+// reference is an offset from the start of the file, so an image can be
+// mapped anywhere and shared between processes. All integers are stored in
+// the byte order of the machine that compiled the image, which is recorded in
+// the header and checked on open.
+//
+// Layout: header, name index, RRset table, authority table, string table,
+// data blob. Names are sorted by their dotted key so lookups are a binary
+// search. Each RRset points at its records in wire format, as they would
+// appear in a response after the owner name, which is shared by the whole
+// name entry.
+
+constexpr std::array<char, 8> ZoneImageMagic{'B', 'H', 'Z', 'O',
+                                             'N', 'E', '\0', '\0'};
+constexpr uint32_t ZoneImageVersion = 1;
+constexpr uint32_t ZoneImageByteOrder = 0x01020304;
+
+struct ZoneImageHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    uint32_t name_count;
+    uint32_t rrset_count;
+    uint32_t authority_count;
+    uint32_t wildcard_count;
+    uint64_t names_offset;
+    uint64_t rrsets_offset;
+    uint64_t authorities_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+struct ZoneImageName {
+    uint64_t key_offset;  // Into the string table
+    uint32_t key_length;
+    uint32_t first_rrset;
+    uint32_t rrset_count;
+    uint32_t reserved;
+};
+
+struct ZoneImageRrset {
+    uint16_t rtype;
+    uint16_t rclass;
+    uint32_t record_count;
+    uint64_t wire_offset;  // Into the data blob
+    uint64_t wire_size;
+};
+
+struct ZoneImageAuthority {
+    uint64_t domain_offset;  // Into the string table
+    uint64_t name_offset;    // Into the string table
+    uint64_t ips_offset;     // Into the data blob, uint32_t each
+    uint32_t domain_length;
+    uint32_t name_length;
+    uint32_t ip_count;
+    uint32_t ttl;
+    uint16_t rclass;
+    uint16_t reserved[3];
+};
+
+// Offline builder for zone images. Accepts the same input as StaticLookup.
+class ZoneCompiler {
+   public:
+    void add_record(Rr record);
+    void add_authority(const DomainAuthority &authority);
+
+    [[nodiscard]] std::vector<uint8_t> compile() const;
+    [[nodiscard]] std::error_code write(const std::string &path) const;
+
+   private:
+    std::map<std::string, std::vector<Rr>> records_;
+    std::vector<DomainAuthority> authorities_;
+};
+
+}  // namespace bighorn
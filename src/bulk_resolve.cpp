@@ -0,0 +1,97 @@
+#include "bulk_resolve.hpp"
+
+#include <asio/experimental/channel.hpp>
+#include <vector>
+
+namespace bighorn {
+
+namespace {
+
+// Signals that a worker ran out of questions
+using DoneChannel = asio::experimental::channel<void(std::error_code)>;
+
+// Stops pulling questions once any worker has thrown, which only the source
+// or the handler can do, or once it is cancelled
+asio::awaitable<void> resolve_questions(Resolver& resolver,
+                                        QuestionSource& next,
+                                        BulkResultHandler& on_result,
+                                        const BulkOptions& options,
+                                        size_t& resolved,
+                                        std::exception_ptr& error) {
+    auto cancellation = co_await asio::this_coro::cancellation_state;
+    try {
+        while (!error &&
+               cancellation.cancelled() == asio::cancellation_type::none) {
+            auto question = next();
+            if (!question.has_value()) {
+                break;
+            }
+            auto resolution = co_await resolver.resolve(
+                question->labels, question->qtype, question->qclass,
+                options.recursion_desired, options.timeout);
+            ++resolved;
+            BulkResult result{.question = std::move(*question),
+                              .resolution = std::move(resolution)};
+            on_result(std::move(result));
+        }
+    } catch (...) {
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+}
+
+// Cancellation is passed on to the workers, which are waited for either
+// way since they use the state in this frame
+asio::awaitable<size_t> run_workers(Resolver& resolver, QuestionSource next,
+                                    BulkResultHandler on_result,
+                                    BulkOptions options) {
+    co_await asio::this_coro::throw_if_cancelled(false);
+    auto executor = co_await asio::this_coro::executor;
+    auto worker_count = std::max<size_t>(options.concurrency, 1);
+    auto done = std::make_shared<DoneChannel>(executor, worker_count);
+    std::vector<asio::cancellation_signal> signals(worker_count);
+    size_t resolved = 0;
+    std::exception_ptr error;
+    for (size_t i = 0; i < worker_count; ++i) {
+        asio::co_spawn(executor,
+                       resolve_questions(resolver, next, on_result, options,
+                                         resolved, error),
+                       asio::bind_cancellation_slot(
+                           signals[i].slot(),
+                           [done](const std::exception_ptr&) {
+                               done->try_send(std::error_code{});
+                           }));
+    }
+    bool cancelled = false;
+    for (size_t finished = 0; finished < worker_count;) {
+        auto [err] = co_await done->async_receive(
+            asio::as_tuple(asio::use_awaitable));
+        if (!err) {
+            ++finished;
+        } else if (!cancelled) {
+            cancelled = true;
+            for (auto& signal : signals) {
+                signal.emit(asio::cancellation_type::terminal);
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    co_return resolved;
+}
+
+}  // namespace
+
+asio::awaitable<size_t> resolve_many(Resolver& resolver, QuestionSource next,
+                                     BulkResultHandler on_result,
+                                     BulkOptions options) {
+    auto strand = asio::make_strand(co_await asio::this_coro::executor);
+    co_return co_await asio::co_spawn(
+        strand,
+        run_workers(resolver, std::move(next), std::move(on_result), options),
+        asio::use_awaitable);
+}
+
+}  // namespace bighorn
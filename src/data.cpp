@@ -1,12 +1,15 @@
 #include "data.hpp"
 
 #include <algorithm>
+#include <cctype>
 #include <sstream>
 #include <utility>
 
 namespace bighorn {
 
 const int PointerJumpLimit = 100;
+// Type of the OPT pseudo-record, which is not a type anything is stored as
+const auto OptType = static_cast<RrType>(41);
 
 std::vector<uint8_t> Header::bytes() const {
     uint16_t const meta = qr << 15 | static_cast<uint16_t>(opcode) << 11 |
@@ -145,6 +148,30 @@ Rr Rr::hinfo_record(Labels labels, std::string cpu, std::string os,
               .rdata = rdata};
 }
 
+Rr Rr::soa_record(Labels labels, Labels mname, Labels rname, uint32_t serial,
+                  uint32_t refresh, uint32_t retry, uint32_t expire,
+                  uint32_t minimum, uint32_t ttl, RrClass rclass) {
+    std::vector<uint8_t> rdata;
+    for (const auto *name : {&mname, &rname}) {
+        for (const auto &label : *name) {
+            rdata.push_back(static_cast<uint8_t>(label.length()));
+            std::copy(label.begin(), label.end(), std::back_inserter(rdata));
+        }
+        rdata.push_back(0);
+    }
+    for (auto value : {serial, refresh, retry, expire, minimum}) {
+        rdata.push_back(static_cast<uint8_t>(value >> 24 & 0xFF));
+        rdata.push_back(static_cast<uint8_t>(value >> 16 & 0xFF));
+        rdata.push_back(static_cast<uint8_t>(value >> 8 & 0xFF));
+        rdata.push_back(static_cast<uint8_t>(value & 0xFF));
+    }
+    return Rr{.labels = std::move(labels),
+              .rtype = RrType::Soa,
+              .rclass = rclass,
+              .ttl = ttl,
+              .rdata = rdata};
+}
+
 std::vector<uint8_t> Question::bytes() const {
     std::vector<uint8_t> bytes;
     size_t required_size = 0;
@@ -204,17 +231,76 @@ std::vector<uint8_t> Message::bytes() const {
     return bytes;
 }
 
+namespace {
+
+bool needs_escape(char c) { return c == '.' || c == '\\'; }
+
+}  // namespace
+
 std::string labels_to_string(std::span<std::string const> labels) {
     if (labels.empty()) {
         return "";
     }
-    std::stringstream ss;
-    for (size_t i = 0; i < labels.size() - 1; ++i) {
-        ss << labels[i];
-        ss << ".";
+    size_t size = labels.size() - 1;
+    for (const auto &label : labels) {
+        size += label.size() + std::count_if(label.begin(), label.end(),
+                                             needs_escape);
+    }
+    std::string name;
+    name.reserve(size);
+    for (size_t i = 0; i < labels.size(); ++i) {
+        if (i != 0) {
+            name += '.';
+        }
+        const auto &label = labels[i];
+        if (std::none_of(label.begin(), label.end(), needs_escape)) {
+            name += label;
+            continue;
+        }
+        for (char const c : label) {
+            if (needs_escape(c)) {
+                name += '\\';
+            }
+            name += c;
+        }
+    }
+    return name;
+}
+
+Labels string_to_labels(std::string_view name) {
+    Labels labels;
+    if (name.empty()) {
+        return labels;
+    }
+    labels.emplace_back();
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (name[i] == '\\' && i + 1 < name.size()) {
+            labels.back() += name[++i];
+        } else if (name[i] != '.') {
+            labels.back() += name[i];
+        } else if (i + 1 < name.size()) {
+            labels.emplace_back();
+        }
     }
-    ss << labels.back();
-    return ss.str();
+    return labels;
+}
+
+bool is_same_name(std::span<std::string const> a,
+                  std::span<std::string const> b) {
+    return std::equal(
+        a.begin(), a.end(), b.begin(), b.end(),
+        [](const std::string &x, const std::string &y) {
+            return std::equal(x.begin(), x.end(), y.begin(), y.end(),
+                              [](unsigned char c, unsigned char d) {
+                                  return std::tolower(c) == std::tolower(d);
+                              });
+        });
+}
+
+bool is_within(std::span<std::string const> name,
+               std::span<std::string const> zone) {
+    return zone.size() <= name.size() &&
+           is_same_name(name.last(zone.size()), zone);
 }
 
 std::error_code check_label(const std::string &label) {
@@ -291,6 +377,81 @@ std::error_code read_labels(DataBuffer &buffer,
     return {};
 }
 
+namespace {
+
+// Copies rdata whose layout is known, expanding compressed names so that the
+// rdata stands on its own outside the message it came in
+std::error_code read_name_rdata(DataBuffer &buffer, RrType rtype,
+                                std::vector<uint8_t> &rdata) {
+    auto copy_bytes = [&](int count) {
+        auto old_size = rdata.size();
+        rdata.resize(old_size + count);
+        return buffer.read_n(count, rdata.data() + old_size);
+    };
+    auto copy_name = [&]() {
+        Labels labels;
+        auto err = read_labels(buffer, labels);
+        if (err) {
+            return err;
+        }
+        for (const auto &label : labels) {
+            rdata.push_back(static_cast<uint8_t>(label.size()));
+            rdata.insert(rdata.end(), label.begin(), label.end());
+        }
+        rdata.push_back(0);
+        return std::error_code{};
+    };
+    switch (rtype) {
+        case RrType::Ns:
+        case RrType::Md:
+        case RrType::Mf:
+        case RrType::Cname:
+        case RrType::Mb:
+        case RrType::Mg:
+        case RrType::Mr:
+        case RrType::Ptr:
+            return copy_name();
+        case RrType::Mx: {
+            auto err = copy_bytes(2);
+            return err ? err : copy_name();
+        }
+        case RrType::Minfo: {
+            auto err = copy_name();
+            return err ? err : copy_name();
+        }
+        case RrType::Soa: {
+            auto err = copy_name();
+            if (!err) {
+                err = copy_name();
+            }
+            return err ? err : copy_bytes(20);
+        }
+        default:
+            return MessageError::ReadError;
+    }
+}
+
+bool has_name_rdata(RrType rtype) {
+    switch (rtype) {
+        case RrType::Ns:
+        case RrType::Md:
+        case RrType::Mf:
+        case RrType::Cname:
+        case RrType::Soa:
+        case RrType::Mb:
+        case RrType::Mg:
+        case RrType::Mr:
+        case RrType::Ptr:
+        case RrType::Minfo:
+        case RrType::Mx:
+            return true;
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
 std::error_code read_rr(DataBuffer &buffer, Rr &rr) {
     std::error_code err;
 
@@ -319,10 +480,20 @@ std::error_code read_rr(DataBuffer &buffer, Rr &rr) {
 
     uint16_t rdlength = 0;
     err = buffer.read_number(rdlength);
-    rr.rdata.resize(rdlength);
     if (err) {
         return err;
     }
+    if (has_name_rdata(rr.rtype)) {
+        auto rdata_start = buffer.pos();
+        rr.rdata.clear();
+        err = read_name_rdata(buffer, rr.rtype, rr.rdata);
+        if (!err && buffer.pos() == rdata_start + rdlength) {
+            return {};
+        }
+        // Names we can't parse are kept as they came
+        buffer.seek(rdata_start);
+    }
+    rr.rdata.resize(rdlength);
     err = buffer.read_n(rdlength, rr.rdata.data());
     return err;
 }
@@ -430,4 +601,37 @@ std::error_code read_message(DataBuffer &buffer, Message &message) {
     return {};
 }
 
+std::error_code read_request(DataBuffer &buffer, Message &request) {
+    auto err = read_header(buffer, request.header);
+    if (err) {
+        return err;
+    }
+    for (size_t i = 0; i < request.header.qdcount; ++i) {
+        Question question;
+        err = read_question(buffer, question);
+        if (err) {
+            return err;
+        }
+        request.questions.push_back(std::move(question));
+    }
+    // Records that cannot be read are ignored with everything after them
+    size_t record_count = request.header.ancount + request.header.nscount +
+                          request.header.arcount;
+    for (size_t i = 0; i < record_count; ++i) {
+        Rr record;
+        if (read_rr(buffer, record)) {
+            break;
+        }
+        if (record.rtype == OptType &&
+            i + request.header.arcount >= record_count) {
+            // The class holds the UDP size and the TTL the flags
+            request.edns = Edns{
+                .udp_size = std::max<uint16_t>(
+                    static_cast<uint16_t>(record.rclass), 512),
+                .dnssec_ok = (record.ttl & 0x8000) != 0};
+        }
+    }
+    return {};
+}
+
 }  // namespace bighorn
\ No newline at end of file
@@ -33,6 +33,10 @@ std::error_code make_error_code(bighorn::ResolutionError e) {
     return {static_cast<int>(e), resolutionErrCategory};
 }
 
+std::error_code make_error_code(bighorn::ZoneError e) {
+    return {static_cast<int>(e), zoneErrCategory};
+}
+
 const char *ResolutionErrorCategory::name() const noexcept {
     return "resolution_error";
 }
@@ -47,6 +51,16 @@ std::string ResolutionErrorCategory::message(int ev) const {
             return "remote server sent failure";
         case ResolutionError::RemoteRefused:
             return "remote server refused request";
+        case ResolutionError::NonExistentDomain:
+            return "domain name does not exist";
+        case ResolutionError::NoData:
+            return "no records of the requested type";
+        case ResolutionError::TooManyWaiters:
+            return "too many queries waiting on one resolution";
+        case ResolutionError::TooManyReferrals:
+            return "too many referrals";
+        case ResolutionError::NoReachableServers:
+            return "no reachable name servers for the zone";
         case ResolutionError::Timeout:
             return "remote server timed out";
         default:
@@ -54,4 +68,37 @@ std::string ResolutionErrorCategory::message(int ev) const {
     }
 }
 
+const char *ZoneErrorCategory::name() const noexcept { return "zone_error"; }
+
+std::string ZoneErrorCategory::message(int ev) const {
+    switch (static_cast<ZoneError>(ev)) {
+        case ZoneError::InvalidImage:
+            return "invalid zone image";
+        case ZoneError::UnsupportedVersion:
+            return "unsupported zone image version";
+        case ZoneError::SyntaxError:
+            return "zone file syntax error";
+        case ZoneError::UnbalancedParentheses:
+            return "unbalanced parentheses";
+        case ZoneError::UnknownType:
+            return "unknown record type";
+        case ZoneError::InvalidTtl:
+            return "invalid TTL";
+        case ZoneError::InvalidName:
+            return "invalid domain name";
+        case ZoneError::InvalidRdata:
+            return "invalid record data";
+        case ZoneError::MissingOwner:
+            return "record has no owner name";
+        case ZoneError::UnsupportedDirective:
+            return "unsupported directive";
+        case ZoneError::RdataTooLong:
+            return "record data exceeds 65535 bytes";
+        case ZoneError::ZoneTooLarge:
+            return "zone exceeds the record store's capacity";
+        default:
+            return "unknown zone error";
+    }
+}
+
 }  // namespace bighorn
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include "frozen_static_lookup.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace bighorn {
+
+namespace {
+
+// Pilots with this bit set name their bucket's single slot directly
+const uint32_t DirectSlot = 0x80000000;
+const uint32_t MaxPilot = 1 << 20;
+const uint32_t KeysPerBucket = 4;
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t hash_name(std::string_view key, uint64_t seed) {
+    uint64_t h = 0xCBF29CE484222325ULL ^ mix(seed);
+    size_t i = 0;
+    for (; i + 8 <= key.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, key.data() + i, 8);
+        h = mix(h ^ word);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, key.data() + i, key.size() - i);
+    return mix(h ^ tail ^ (static_cast<uint64_t>(key.size()) << 56));
+}
+
+// Maps x onto [0, n) without a division
+uint32_t reduce(uint32_t x, uint32_t n) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(x) * n) >> 32);
+}
+
+uint32_t bucket_of(uint64_t hash, size_t bucket_count) {
+    return reduce(static_cast<uint32_t>(hash >> 32),
+                  static_cast<uint32_t>(bucket_count));
+}
+
+uint32_t slot_of(uint64_t hash, uint32_t pilot, uint32_t n) {
+    if ((pilot & DirectSlot) != 0) {
+        return pilot & ~DirectSlot;
+    }
+    return reduce(
+        static_cast<uint32_t>(mix(hash + pilot * 0x9E3779B97F4A7C15ULL)), n);
+}
+
+// Hash and displace: place the largest buckets first, searching for a pilot
+// that sends every key of the bucket to a free slot. Singleton buckets take
+// the remaining free slots directly.
+bool place_keys(const std::vector<uint64_t> &hashes,
+                std::vector<uint32_t> &pilots, std::vector<uint32_t> &slots) {
+    auto n = static_cast<uint32_t>(hashes.size());
+    std::vector<std::vector<uint32_t>> buckets(pilots.size());
+    for (uint32_t i = 0; i < n; ++i) {
+        buckets[bucket_of(hashes[i], pilots.size())].push_back(i);
+    }
+    std::vector<uint32_t> order(buckets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<bool> taken(n);
+    std::vector<uint32_t> candidate;
+    uint32_t next_free = 0;
+    for (auto bucket : order) {
+        const auto &keys = buckets[bucket];
+        if (keys.empty()) {
+            break;
+        }
+        if (keys.size() == 1) {
+            while (taken[next_free]) {
+                ++next_free;
+            }
+            taken[next_free] = true;
+            slots[keys[0]] = next_free;
+            pilots[bucket] = DirectSlot | next_free;
+            continue;
+        }
+        bool placed = false;
+        for (uint32_t pilot = 0; pilot < MaxPilot && !placed; ++pilot) {
+            candidate.clear();
+            for (auto key : keys) {
+                auto slot = slot_of(hashes[key], pilot, n);
+                if (taken[slot] || std::find(candidate.begin(), candidate.end(),
+                                             slot) != candidate.end()) {
+                    break;
+                }
+                candidate.push_back(slot);
+            }
+            if (candidate.size() != keys.size()) {
+                continue;
+            }
+            for (size_t i = 0; i < keys.size(); ++i) {
+                taken[candidate[i]] = true;
+                slots[keys[i]] = candidate[i];
+            }
+            pilots[bucket] = pilot;
+            placed = true;
+        }
+        if (!placed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+FrozenStaticLookup::FrozenStaticLookup(const StaticLookup &source)
+    : authorities_(source.authorities()) {
+    const auto &store = source.records();
+    std::vector<std::pair<std::string_view, uint32_t>> names;
+    names.reserve(store.name_count());
+    store.for_each_name([&](const std::string &name, uint32_t first) {
+        names.emplace_back(name, first);
+    });
+    auto n = static_cast<uint32_t>(names.size());
+    if (n == 0) {
+        return;
+    }
+
+    std::vector<uint64_t> hashes(n);
+    std::vector<uint32_t> slots(n);
+    for (;; ++seed_) {
+        for (uint32_t i = 0; i < n; ++i) {
+            hashes[i] = hash_name(names[i].first, seed_);
+        }
+        pilots_.assign((n + KeysPerBucket - 1) / KeysPerBucket, 0);
+        if (place_keys(hashes, pilots_, slots)) {
+            break;
+        }
+    }
+
+    std::vector<uint32_t> by_slot(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        by_slot[slots[i]] = i;
+    }
+    fingerprints_.resize(n);
+    name_offsets_.reserve(n + 1);
+    first_rrsets_.reserve(n + 1);
+    ttls_.reserve(store.record_count());
+    rdata_offsets_.reserve(store.record_count() + 1);
+    for (uint32_t slot = 0; slot < n; ++slot) {
+        auto [name, first] = names[by_slot[slot]];
+        fingerprints_[slot] = hashes[by_slot[slot]];
+        name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+        names_.append(name);
+        first_rrsets_.push_back(static_cast<uint32_t>(rrset_types_.size()));
+        if (name.starts_with("*.")) {
+            ++wildcard_count_;
+        }
+
+        // The store links each RRset's records together
+        auto rrset_begin = rrset_types_.size();
+        for (auto i = first; i != RecordStore::NoEntry;
+             i = store.entry(i).next) {
+            const auto &entry = store.entry(i);
+            if (rrset_types_.size() == rrset_begin ||
+                rrset_types_.back() != entry.rtype ||
+                rrset_classes_.back() != entry.rclass) {
+                rrset_types_.push_back(entry.rtype);
+                rrset_classes_.push_back(entry.rclass);
+                first_records_.push_back(static_cast<uint32_t>(ttls_.size()));
+            }
+            auto rdata = store.rdata(entry);
+            ttls_.push_back(entry.ttl);
+            rdata_offsets_.push_back(static_cast<uint32_t>(rdata_.size()));
+            rdata_.insert(rdata_.end(), rdata.begin(), rdata.end());
+        }
+    }
+    name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+    first_rrsets_.push_back(static_cast<uint32_t>(rrset_types_.size()));
+    first_records_.push_back(static_cast<uint32_t>(ttls_.size()));
+    rdata_offsets_.push_back(static_cast<uint32_t>(rdata_.size()));
+
+    // Every name has its slot now, so the names records point to can be
+    // linked to theirs
+    target_slots_.assign(ttls_.size(), NoSlot);
+    Labels target;
+    for (size_t rrset = 0; rrset < rrset_types_.size(); ++rrset) {
+        for (auto record = first_records_[rrset];
+             record < first_records_[rrset + 1]; ++record) {
+            std::span<uint8_t const> rdata(
+                rdata_.data() + rdata_offsets_[record],
+                rdata_offsets_[record + 1] - rdata_offsets_[record]);
+            if (read_additional_target(rrset_types_[rrset], rdata, target)) {
+                target_slots_[record] = find_slot(labels_to_string(target));
+            }
+        }
+    }
+}
+
+ZoneParseResult FrozenStaticLookup::from_zone_file(
+    const std::string &path, const ZoneParseOptions &options,
+    FrozenStaticLookup &lookup) {
+    StaticLookup staging;
+    std::error_code add_err;
+    auto result = parse_zone_file(path, options, [&](Rr record) {
+        if (!add_err) {
+            add_err = staging.add_record(record);
+        }
+    });
+    if (!result.err) {
+        result.err = add_err;
+    }
+    if (!result.err) {
+        lookup = FrozenStaticLookup(staging);
+    }
+    return result;
+}
+
+asio::awaitable<FoundRecords> FrozenStaticLookup::find_records(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    bool recursive) {
+    co_return find_records_sync(labels, qtype, qclass, recursive);
+}
+
+FoundRecords FrozenStaticLookup::find_records_sync(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    bool recursive) const {
+    RecordList matching_records;
+    if (recursive) {
+        return FoundRecords{.records = std::move(matching_records), .err = {}};
+    }
+    std::vector<uint32_t> targets;
+    auto slot = find_slot(labels_to_string(labels));
+    if (slot != NoSlot) {
+        append_records(slot, qtype, qclass, true, matching_records, &targets);
+    }
+    if (labels.size() >= 2 && wildcard_count_ > 0) {
+        for (size_t i = 1; i < labels.size(); ++i) {
+            auto wildcard =
+                find_slot("*." + labels_to_string(labels.subspan(i)));
+            if (wildcard != NoSlot) {
+                append_records(wildcard, qtype, qclass, false,
+                               matching_records, &targets);
+            }
+        }
+    }
+    RecordList additional;
+    append_addresses(targets, qclass, additional);
+    return FoundRecords{.records = std::move(matching_records),
+                        .additional = std::move(additional),
+                        .err = {}};
+}
+
+std::vector<DomainAuthority> FrozenStaticLookup::find_authorities(
+    std::span<std::string const> labels, RrClass rclass) {
+    std::vector<DomainAuthority> unique_auths;
+    for (auto &authority : authorities_) {
+        if (is_authority_match(labels, authority, rclass) &&
+            std::find(unique_auths.begin(), unique_auths.end(), authority) ==
+                unique_auths.end()) {
+            unique_auths.push_back(authority);
+        }
+    }
+    return unique_auths;
+}
+
+uint32_t FrozenStaticLookup::find_slot(std::string_view key) const {
+    if (pilots_.empty()) {
+        return NoSlot;
+    }
+    auto hash = hash_name(key, seed_);
+    auto slot = slot_of(hash, pilots_[bucket_of(hash, pilots_.size())],
+                        static_cast<uint32_t>(fingerprints_.size()));
+    if (fingerprints_[slot] != hash) {
+        return NoSlot;
+    }
+    std::string_view name(names_.data() + name_offsets_[slot],
+                          name_offsets_[slot + 1] - name_offsets_[slot]);
+    return name == key ? slot : NoSlot;
+}
+
+void FrozenStaticLookup::append_records(
+    uint32_t slot, RrType qtype, RrClass qclass, bool allow_cname,
+    RecordList &matching_records, std::vector<uint32_t> *targets) const {
+    std::string_view owner(names_.data() + name_offsets_[slot],
+                           name_offsets_[slot + 1] - name_offsets_[slot]);
+    for (auto rrset = first_rrsets_[slot]; rrset < first_rrsets_[slot + 1];
+         ++rrset) {
+        auto rtype = rrset_types_[rrset];
+        bool type_match = allow_cname ? is_type_match(qtype, rtype)
+                                      : rtype == qtype || qtype == RrType::All;
+        if (!type_match || rrset_classes_[rrset] != qclass) {
+            continue;
+        }
+        for (auto record = first_records_[rrset];
+             record < first_records_[rrset + 1]; ++record) {
+            auto begin = rdata_offsets_[record];
+            auto end = rdata_offsets_[record + 1];
+            matching_records.push_back(
+                RrRef{.name = owner,
+                      .rtype = rtype,
+                      .rclass = qclass,
+                      .ttl = ttls_[record],
+                      .rdata = {rdata_.data() + begin, end - begin}});
+            auto target = target_slots_[record];
+            if (targets != nullptr && target != NoSlot &&
+                std::find(targets->begin(), targets->end(), target) ==
+                    targets->end()) {
+                targets->push_back(target);
+            }
+        }
+    }
+}
+
+void FrozenStaticLookup::append_addresses(std::span<uint32_t const> targets,
+                                          RrClass qclass,
+                                          RecordList &additional) const {
+    for (auto target : targets) {
+        append_records(target, RrType::A, qclass, false, additional);
+        append_records(target, RrType::Aaaa, qclass, false, additional);
+    }
+}
+
+}  // namespace bighorn
@@ -0,0 +1,340 @@
+#include "iterative_resolver.hpp"
+
+#include <algorithm>
+#include <array>
+#include <asio/experimental/channel.hpp>
+#include <cctype>
+#include <mutex>
+#include <utility>
+
+namespace bighorn {
+
+namespace {
+
+// Referrals followed for one name before giving up
+const int MaxReferrals = 16;
+// How deep lookups of name servers may nest inside each other
+const int MaxNameServerDepth = 4;
+// Name servers without glue that are looked up at the same time
+const size_t MaxParallelNameServers = 3;
+const int MaxCnameSwitches = 10;
+// Zone cuts kept at once. The cut that expires first makes room, so expired
+// cuts go before any others.
+const size_t MaxZoneCuts = 10000;
+
+// a to m.root-servers.net
+const std::array<Ipv4Type, 13> RootServers{
+    0xC6290004, 0xAAF7AA02, 0xC021040C, 0xC7075B0D, 0xC0CBE60A,
+    0xC00505F1, 0xC0702404, 0xC661BE35, 0xC0249411, 0xC03A801E,
+    0xC1000E81, 0xC707532A, 0xCA0C1B21};
+
+std::string zone_key(std::span<std::string const> labels) {
+    auto key = labels_to_string(labels);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return key;
+}
+
+std::optional<Labels> read_name(const Rr& record) {
+    Labels labels;
+    DataBuffer buffer(record.rdata);
+    if (read_labels(buffer, labels)) {
+        return std::nullopt;
+    }
+    return labels;
+}
+
+// The zone the reply delegates to, if it is a referral from the parent zone
+// to a zone holding the name
+std::optional<Labels> find_referral(const Message& message,
+                                    std::span<std::string const> parent,
+                                    std::span<std::string const> name) {
+    if (message.header.rcode != ResponseCode::Ok || !message.answers.empty()) {
+        return std::nullopt;
+    }
+    for (const auto& record : message.authorities) {
+        if (record.rtype == RrType::Ns &&
+            record.labels.size() > parent.size() &&
+            is_within(record.labels, parent) &&
+            is_within(name, record.labels)) {
+            return record.labels;
+        }
+    }
+    return std::nullopt;
+}
+
+// Name servers at the addresses among the records
+std::vector<DnsServer> servers_at(const std::vector<Rr>& records, int port) {
+    std::vector<DnsServer> servers;
+    for (const auto& record : records) {
+        if (record.rtype == RrType::A && record.rdata.size() == 4) {
+            Ipv4Type ip = static_cast<uint32_t>(record.rdata[0]) << 24 |
+                          static_cast<uint32_t>(record.rdata[1]) << 16 |
+                          static_cast<uint32_t>(record.rdata[2]) << 8 |
+                          static_cast<uint32_t>(record.rdata[3]);
+            servers.push_back(DnsServer{.ip = ip,
+                                        .port = port,
+                                        .conn_method = ServerConnMethod::Udp,
+                                        .recursive = false});
+        } else if (record.rtype == RrType::Aaaa && record.rdata.size() == 16) {
+            Ipv6Type ip{};
+            std::copy(record.rdata.begin(), record.rdata.end(), ip.begin());
+            servers.push_back(DnsServer{.ip = ip,
+                                        .port = port,
+                                        .conn_method = ServerConnMethod::Udp,
+                                        .recursive = false});
+        }
+    }
+    return servers;
+}
+
+}  // namespace
+
+IterativeResolver::IterativeResolver(
+    asio::io_context& io, std::vector<DnsServer> root_hints, int server_port,
+    std::shared_ptr<UpstreamTransport> transport)
+    : io_(io),
+      transport_(transport ? std::move(transport)
+                           : std::make_shared<UpstreamTransport>(io)),
+      server_port_(server_port),
+      root_{.zone = {},
+            .servers = nullptr,
+            .expiry = std::chrono::steady_clock::time_point::max()},
+      cuts_mutex_(std::make_unique<std::shared_mutex>()) {
+    if (root_hints.empty()) {
+        for (auto ip : RootServers) {
+            root_hints.push_back(DnsServer{.ip = ip,
+                                           .port = 53,
+                                           .conn_method = ServerConnMethod::Udp,
+                                           .recursive = false});
+        }
+    }
+    root_.servers = std::make_shared<DefaultResolver>(
+        io, std::move(root_hints), transport_);
+}
+
+// Recursion is what this resolver does, so recursion_desired is not needed
+asio::awaitable<Resolution> IterativeResolver::resolve(
+    Labels labels, RrType qtype, RrClass qclass, bool /*recursion_desired*/,
+    std::chrono::milliseconds timeout) {
+    co_return co_await iterate(std::move(labels), qtype, qclass, timeout, 0);
+}
+
+size_t IterativeResolver::cached_zone_count() const {
+    std::shared_lock const lock(*cuts_mutex_);
+    return cuts_.size();
+}
+
+asio::awaitable<Resolution> IterativeResolver::iterate(
+    Labels labels, RrType qtype, RrClass qclass,
+    std::chrono::milliseconds timeout, int depth) {
+    std::vector<Rr> chain;
+    for (int switches_left = MaxCnameSwitches; switches_left > 0;
+         --switches_left) {
+        auto reply = co_await descend(labels, qtype, qclass, timeout, depth);
+        if (reply.err) {
+            co_return Resolution::failed(reply.err);
+        }
+        auto& message = reply.message;
+        std::optional<Labels> next;
+        if (auto err = follow_cname_chain(message.answers, std::move(labels),
+                                          qtype, chain, next)) {
+            co_return Resolution::failed(err);
+        }
+        if (!next.has_value()) {
+            co_return Resolution{
+                .records = std::move(chain),
+                .rcode = message.header.rcode,
+                .authorities = std::move(message.authorities),
+                .additional = std::move(message.additional)};
+        }
+        labels = std::move(*next);
+    }
+    co_return Resolution::failed(ResolutionError::RecursionLimit);
+}
+
+asio::awaitable<UpstreamReply> IterativeResolver::descend(
+    const Labels& labels, RrType qtype, RrClass qclass,
+    std::chrono::milliseconds timeout, int depth) {
+    Message query{
+        .header = {.id = 1, .opcode = Opcode::Query, .rd = 0},
+        .questions = {
+            Question{.labels = labels, .qtype = qtype, .qclass = qclass}}};
+    auto cut = closest_cut(labels);
+    for (int referrals = 0; referrals <= MaxReferrals; ++referrals) {
+        auto reply = co_await cut.servers->exchange(query, timeout);
+        if (reply.err) {
+            co_return reply;
+        }
+        auto zone = find_referral(reply.message, cut.zone, labels);
+        if (!zone.has_value()) {
+            co_return reply;
+        }
+        ZoneCut next;
+        if (auto err = co_await follow_referral(
+                cut, std::move(*zone), reply.message, timeout, depth, next)) {
+            co_return UpstreamReply{.message = {}, .err = err};
+        }
+        cut = std::move(next);
+    }
+    co_return UpstreamReply{.message = {},
+                            .err = ResolutionError::TooManyReferrals};
+}
+
+asio::awaitable<std::error_code> IterativeResolver::follow_referral(
+    const ZoneCut& parent, Labels zone, const Message& referral,
+    std::chrono::milliseconds timeout, int depth, ZoneCut& cut) {
+    uint32_t ttl = UINT32_MAX;
+    std::vector<Labels> names;
+    for (const auto& record : referral.authorities) {
+        if (record.rtype != RrType::Ns || !is_same_name(record.labels, zone)) {
+            continue;
+        }
+        if (auto name = read_name(record)) {
+            names.push_back(std::move(*name));
+            ttl = std::min(ttl, record.ttl);
+        }
+    }
+
+    // Glue from outside the parent's zone could point anywhere
+    std::vector<Rr> glue;
+    for (const auto& record : referral.additional) {
+        if (is_within(record.labels, parent.zone) &&
+            std::any_of(names.begin(), names.end(), [&](const auto& name) {
+                return is_same_name(record.labels, name);
+            })) {
+            glue.push_back(record);
+        }
+    }
+    auto servers = servers_at(glue, server_port_);
+    if (servers.empty()) {
+        // Without glue, names within the zone cannot be reached
+        std::erase_if(names,
+                      [&](const auto& name) { return is_within(name, zone); });
+        if (names.size() > MaxParallelNameServers) {
+            names.resize(MaxParallelNameServers);
+        }
+        servers = co_await asio::co_spawn(
+            asio::make_strand(io_),
+            resolve_name_servers(std::move(names), timeout, depth + 1),
+            asio::use_awaitable);
+    }
+    if (servers.empty()) {
+        co_return ResolutionError::NoReachableServers;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    cut = ZoneCut{.zone = zone,
+                  .servers = std::make_shared<DefaultResolver>(
+                      io_, std::move(servers), transport_),
+                  .expiry = now + std::chrono::seconds(ttl)};
+    {
+        // A cut cached meanwhile is kept, along with its servers' health
+        std::unique_lock const lock(*cuts_mutex_);
+        auto key = zone_key(zone);
+        auto found = cuts_.find(key);
+        if (found == cuts_.end()) {
+            if (cuts_.size() >= MaxZoneCuts) {
+                auto first_expiry = cut_expiries_.begin();
+                cuts_.erase(first_expiry->second);
+                cut_expiries_.erase(first_expiry);
+            }
+            cut_expiries_.emplace(cut.expiry, key);
+            found = cuts_.emplace(std::move(key), cut).first;
+        } else if (found->second.expiry <= now) {
+            cut_expiries_.erase({found->second.expiry, found->first});
+            cut_expiries_.emplace(cut.expiry, found->first);
+            found->second = cut;
+        }
+        cut = found->second;
+    }
+    co_return std::error_code{};
+}
+
+asio::awaitable<std::vector<DnsServer>> IterativeResolver::resolve_name_servers(
+    std::vector<Labels> names, std::chrono::milliseconds timeout, int depth) {
+    using AddressChannel = asio::experimental::channel<void(
+        std::error_code, size_t, std::vector<DnsServer>)>;
+    if (depth > MaxNameServerDepth || names.empty()) {
+        co_return std::vector<DnsServer>{};
+    }
+    co_await asio::this_coro::throw_if_cancelled(false);
+    auto executor = co_await asio::this_coro::executor;
+    const std::array<RrType, 2> address_types{RrType::A, RrType::Aaaa};
+    auto lookup_count = names.size() * address_types.size();
+    auto addresses = std::make_shared<AddressChannel>(executor, lookup_count);
+    auto cancel_lookups =
+        std::make_shared<std::vector<asio::cancellation_signal>>(lookup_count);
+    // Each handler keeps the signals alive until its lookup is done
+    for (size_t i = 0; i < lookup_count; ++i) {
+        asio::co_spawn(
+            executor,
+            iterate(names[i / address_types.size()],
+                    address_types[i % address_types.size()], RrClass::In,
+                    timeout, depth),
+            asio::bind_cancellation_slot(
+                (*cancel_lookups)[i].slot(),
+                [addresses, cancel_lookups, i, port = server_port_](
+                    const std::exception_ptr& ex, Resolution result) {
+                    std::vector<DnsServer> servers;
+                    if (!ex) {
+                        servers = servers_at(result.records, port);
+                    }
+                    addresses->try_send(std::error_code{}, i,
+                                        std::move(servers));
+                }));
+    }
+    // Once a name has resolved, only its other address lookup is still
+    // needed, and none are once the caller gives up
+    std::optional<size_t> chosen;
+    bool cancelled = false;
+    auto cancel_others = [&] {
+        for (size_t i = 0; i < lookup_count; ++i) {
+            if (cancelled || i / address_types.size() != chosen) {
+                (*cancel_lookups)[i].emit(asio::cancellation_type::terminal);
+            }
+        }
+    };
+    std::vector<DnsServer> servers;
+    for (size_t finished = 0; finished < lookup_count;) {
+        auto [err, i, found] = co_await addresses->async_receive(
+            asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            if (!cancelled) {
+                cancelled = true;
+                cancel_others();
+            }
+            continue;
+        }
+        ++finished;
+        auto name = i / address_types.size();
+        if (cancelled || found.empty() || (chosen && *chosen != name)) {
+            continue;
+        }
+        if (!chosen) {
+            chosen = name;
+            cancel_others();
+        }
+        servers.insert(servers.end(), found.begin(), found.end());
+    }
+    if (cancelled) {
+        servers.clear();
+    }
+    co_return servers;
+}
+
+ZoneCut IterativeResolver::closest_cut(
+    std::span<std::string const> labels) const {
+    auto now = std::chrono::steady_clock::now();
+    std::shared_lock const lock(*cuts_mutex_);
+    for (size_t i = 0; i < labels.size(); ++i) {
+        auto found = cuts_.find(zone_key(labels.subspan(i)));
+        if (found != cuts_.end() && now < found->second.expiry) {
+            return found->second;
+        }
+    }
+    return root_;
+}
+
+}  // namespace bighorn
@@ -14,6 +14,11 @@ bool is_label_match(std::span<std::string const> labels, const Rr &candidate) {
     return true;
 }
 
+bool is_type_match(RrType qtype, RrType rtype) {
+    return qtype == rtype || qtype == RrType::All ||
+           (qtype == RrType::A && rtype == RrType::Cname);
+}
+
 bool is_authority_match(const std::span<std::string const> labels,
                         const DomainAuthority &authority,
                         const RrClass rclass) {
@@ -33,4 +38,24 @@ bool is_authority_match(const std::span<std::string const> labels,
     return true;
 }
 
+bool has_additional_target(RrType rtype) {
+    return rtype == RrType::Mx || rtype == RrType::Ns;
+}
+
+bool read_additional_target(RrType rtype, std::span<uint8_t const> rdata,
+                            Labels &target) {
+    if (!has_additional_target(rtype)) {
+        return false;
+    }
+    DataBuffer buffer(rdata);
+    if (rtype == RrType::Mx) {
+        uint16_t preference = 0;
+        if (buffer.read_number(preference)) {
+            return false;
+        }
+    }
+    target.clear();
+    return !read_labels(buffer, target);
+}
+
 }  // namespace bighorn
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <utility>
+
+namespace bighorn {
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {
+#ifdef _WIN32
+    mapping_ = std::exchange(other.mapping_, nullptr);
+#endif
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        unmap();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+#ifdef _WIN32
+        mapping_ = std::exchange(other.mapping_, nullptr);
+#endif
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() { unmap(); }
+
+#ifdef _WIN32
+
+void MappedFile::unmap() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_ != nullptr) {
+        CloseHandle(mapping_);
+    }
+    data_ = nullptr;
+    mapping_ = nullptr;
+    size_ = 0;
+}
+
+std::error_code map_file(const std::string &path, MappedFile &file) {
+    HANDLE handle =
+        CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return {static_cast<int>(GetLastError()), std::system_category()};
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(handle, &size) == 0) {
+        std::error_code err(static_cast<int>(GetLastError()),
+                            std::system_category());
+        CloseHandle(handle);
+        return err;
+    }
+    MappedFile mapped;
+    if (size.QuadPart != 0) {
+        mapped.mapping_ = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0,
+                                             0, nullptr);
+        CloseHandle(handle);
+        if (mapped.mapping_ == nullptr) {
+            return {static_cast<int>(GetLastError()), std::system_category()};
+        }
+        mapped.data_ = static_cast<const uint8_t *>(
+            MapViewOfFile(mapped.mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (mapped.data_ == nullptr) {
+            return {static_cast<int>(GetLastError()), std::system_category()};
+        }
+        mapped.size_ = static_cast<size_t>(size.QuadPart);
+    } else {
+        CloseHandle(handle);
+    }
+    file = std::move(mapped);
+    return {};
+}
+
+#else
+
+void MappedFile::unmap() {
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t *>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+std::error_code map_file(const std::string &path, MappedFile &file) {
+    int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return {errno, std::generic_category()};
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        std::error_code err(errno, std::generic_category());
+        ::close(fd);
+        return err;
+    }
+    MappedFile mapped;
+    if (st.st_size != 0) {
+        void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                          MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            std::error_code err(errno, std::generic_category());
+            ::close(fd);
+            return err;
+        }
+        mapped.data_ = static_cast<const uint8_t *>(data);
+        mapped.size_ = static_cast<size_t>(st.st_size);
+    }
+    ::close(fd);
+    file = std::move(mapped);
+    return {};
+}
+
+#endif
+
+}  // namespace bighorn
@@ -0,0 +1,222 @@
+#include "mapped_lookup.hpp"
+
+#include <algorithm>
+
+namespace bighorn {
+
+namespace {
+
+bool is_section_valid(uint64_t offset, uint64_t count, uint64_t entry_size,
+                      uint64_t file_size) {
+    if (offset % alignof(uint64_t) != 0 || offset > file_size) {
+        return false;
+    }
+    return count <= (file_size - offset) / entry_size;
+}
+
+std::string_view key_of(std::string_view strings, uint64_t offset,
+                        uint32_t length) {
+    if (offset > strings.size() || length > strings.size() - offset) {
+        return {};
+    }
+    return strings.substr(offset, length);
+}
+
+}  // namespace
+
+std::error_code MappedLookup::open(const std::string &path,
+                                   MappedLookup &lookup) {
+    auto file = std::make_shared<MappedFile>();
+    auto err = map_file(path, *file);
+    if (err) {
+        return err;
+    }
+    auto bytes = file->bytes();
+    if (bytes.size() < sizeof(ZoneImageHeader)) {
+        return ZoneError::InvalidImage;
+    }
+    // Mappings are page aligned, which satisfies every table in the image
+    auto const *header =
+        reinterpret_cast<const ZoneImageHeader *>(bytes.data());
+    if (header->magic != ZoneImageMagic ||
+        header->byte_order != ZoneImageByteOrder) {
+        return ZoneError::InvalidImage;
+    }
+    if (header->version != ZoneImageVersion) {
+        return ZoneError::UnsupportedVersion;
+    }
+    auto size = bytes.size();
+    if (header->file_size != size ||
+        !is_section_valid(header->names_offset, header->name_count,
+                          sizeof(ZoneImageName), size) ||
+        !is_section_valid(header->rrsets_offset, header->rrset_count,
+                          sizeof(ZoneImageRrset), size) ||
+        !is_section_valid(header->authorities_offset, header->authority_count,
+                          sizeof(ZoneImageAuthority), size) ||
+        !is_section_valid(header->data_offset, header->data_size, 1, size) ||
+        header->strings_offset > size ||
+        header->strings_size > size - header->strings_offset) {
+        return ZoneError::InvalidImage;
+    }
+
+    MappedLookup mapped;
+    mapped.header_ = header;
+    mapped.names_ = {reinterpret_cast<const ZoneImageName *>(
+                         bytes.data() + header->names_offset),
+                     header->name_count};
+    mapped.rrsets_ = {reinterpret_cast<const ZoneImageRrset *>(
+                          bytes.data() + header->rrsets_offset),
+                      header->rrset_count};
+    mapped.strings_ = {
+        reinterpret_cast<const char *>(bytes.data() + header->strings_offset),
+        header->strings_size};
+    mapped.data_ = bytes.subspan(header->data_offset, header->data_size);
+
+    std::span<const ZoneImageAuthority> authorities{
+        reinterpret_cast<const ZoneImageAuthority *>(
+            bytes.data() + header->authorities_offset),
+        header->authority_count};
+    for (const auto &entry : authorities) {
+        if (entry.ips_offset % alignof(uint32_t) != 0 ||
+            entry.ips_offset > mapped.data_.size() ||
+            entry.ip_count >
+                (mapped.data_.size() - entry.ips_offset) / sizeof(uint32_t)) {
+            return ZoneError::InvalidImage;
+        }
+        auto const *ips = reinterpret_cast<const uint32_t *>(
+            mapped.data_.data() + entry.ips_offset);
+        mapped.authorities_.push_back(DomainAuthority{
+            .domain = string_to_labels(key_of(
+                mapped.strings_, entry.domain_offset, entry.domain_length)),
+            .name = string_to_labels(key_of(
+                mapped.strings_, entry.name_offset, entry.name_length)),
+            .rclass = static_cast<RrClass>(entry.rclass),
+            .ips = std::vector<uint32_t>(ips, ips + entry.ip_count),
+            .ttl = entry.ttl});
+    }
+    mapped.file_ = std::move(file);
+    lookup = std::move(mapped);
+    return {};
+}
+
+asio::awaitable<FoundRecords> MappedLookup::find_records(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    bool use_recursion) {
+    co_return find_records_sync(labels, qtype, qclass, use_recursion);
+}
+
+FoundRecords MappedLookup::find_records_sync(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    bool use_recursion) const {
+    RecordList matching_records;
+    if (use_recursion || header_ == nullptr) {
+        return FoundRecords{.records = std::move(matching_records), .err = {}};
+    }
+    auto key = labels_to_string(labels);
+    if (const auto *name = find_name(key)) {
+        append_records(*name, qtype, qclass, true, matching_records);
+    }
+    if (labels.size() >= 2 && header_->wildcard_count != 0) {
+        for (size_t i = 1; i < labels.size(); ++i) {
+            auto wild_key = "*." + labels_to_string(labels.subspan(i));
+            if (const auto *name = find_name(wild_key)) {
+                append_records(*name, qtype, qclass, false, matching_records);
+            }
+        }
+    }
+    // The image has no links between names, so targets are looked up here
+    std::vector<const ZoneImageName *> targets;
+    Labels target;
+    for (const auto &record : matching_records) {
+        if (!read_additional_target(record.rtype, record.rdata, target)) {
+            continue;
+        }
+        const auto *name = find_name(labels_to_string(target));
+        if (name != nullptr &&
+            std::find(targets.begin(), targets.end(), name) == targets.end()) {
+            targets.push_back(name);
+        }
+    }
+    RecordList additional;
+    for (const auto *name : targets) {
+        append_records(*name, RrType::A, qclass, false, additional);
+        append_records(*name, RrType::Aaaa, qclass, false, additional);
+    }
+    return FoundRecords{.records = std::move(matching_records),
+                        .additional = std::move(additional),
+                        .err = {}};
+}
+
+std::vector<DomainAuthority> MappedLookup::find_authorities(
+    std::span<std::string const> labels, RrClass rclass) {
+    std::vector<DomainAuthority> unique_auths;
+    for (auto &authority : authorities_) {
+        if (is_authority_match(labels, authority, rclass) &&
+            std::find(unique_auths.begin(), unique_auths.end(), authority) ==
+                unique_auths.end()) {
+            unique_auths.push_back(authority);
+        }
+    }
+    return unique_auths;
+}
+
+const ZoneImageName *MappedLookup::find_name(std::string_view key) const {
+    auto it = std::lower_bound(
+        names_.begin(), names_.end(), key,
+        [&](const ZoneImageName &name, std::string_view k) {
+            return key_of(strings_, name.key_offset, name.key_length) < k;
+        });
+    if (it == names_.end() ||
+        key_of(strings_, it->key_offset, it->key_length) != key) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+void MappedLookup::append_records(const ZoneImageName &name, RrType qtype,
+                                  RrClass qclass, bool allow_cname,
+                                  RecordList &matching_records) const {
+    if (name.first_rrset > rrsets_.size() ||
+        name.rrset_count > rrsets_.size() - name.first_rrset) {
+        return;
+    }
+    auto owner = key_of(strings_, name.key_offset, name.key_length);
+    for (const auto &rrset : rrsets_.subspan(name.first_rrset,
+                                             name.rrset_count)) {
+        auto rtype = static_cast<RrType>(rrset.rtype);
+        bool const type_match = allow_cname ? is_type_match(qtype, rtype)
+                                            : qtype == rtype ||
+                                                  qtype == RrType::All;
+        if (!type_match || static_cast<RrClass>(rrset.rclass) != qclass) {
+            continue;
+        }
+        if (rrset.wire_offset > data_.size() ||
+            rrset.wire_size > data_.size() - rrset.wire_offset) {
+            continue;
+        }
+        auto wire = data_.subspan(rrset.wire_offset, rrset.wire_size);
+        DataBuffer buffer(wire);
+        for (uint32_t i = 0; i < rrset.record_count; ++i) {
+            uint16_t rtype_bytes = 0;
+            uint16_t rclass_bytes = 0;
+            uint32_t ttl = 0;
+            uint16_t rdlength = 0;
+            if (buffer.read_number(rtype_bytes) ||
+                buffer.read_number(rclass_bytes) ||
+                buffer.read_number(ttl) || buffer.read_number(rdlength) ||
+                rdlength > wire.size() - buffer.pos()) {
+                break;
+            }
+            // The rdata is referred to in the mapping rather than read out
+            matching_records.push_back(
+                RrRef{.name = owner,
+                      .rtype = static_cast<RrType>(rtype_bytes),
+                      .rclass = static_cast<RrClass>(rclass_bytes),
+                      .ttl = ttl,
+                      .rdata = wire.subspan(buffer.pos(), rdlength)});
+            buffer.seek(buffer.pos() + rdlength);
+        }
+    }
+}
+
+}  // namespace bighorn
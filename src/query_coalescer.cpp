@@ -0,0 +1,96 @@
+#include "query_coalescer.hpp"
+
+namespace bighorn {
+
+QueryCoalescer::QueryCoalescer(asio::io_context &io, size_t max_waiters)
+    : io_(io),
+      strand_(asio::make_strand(io)),
+      max_waiters_(std::max<size_t>(max_waiters, 1)) {}
+
+asio::awaitable<FoundRecords> QueryCoalescer::run(std::string key,
+                                                  LookupFn lookup,
+                                                  bool keep_running) {
+    co_return co_await asio::co_spawn(
+        strand_, join(std::move(key), std::move(lookup), keep_running),
+        asio::use_awaitable);
+}
+
+asio::awaitable<FoundRecords> QueryCoalescer::join(std::string key,
+                                                   LookupFn lookup,
+                                                   bool keep_running) {
+    auto [found_flight, inserted] = flights_.try_emplace(key);
+    if (inserted) {
+        found_flight->second = std::make_shared<Flight>();
+    }
+    auto flight = found_flight->second;
+    if (flight->waiters.size() >= max_waiters_) {
+        co_return FoundRecords{.records = {},
+                               .err = ResolutionError::TooManyWaiters};
+    }
+    auto result = std::make_shared<ResultChannel>(strand_, 1);
+    flight->waiters.push_back(result);
+    flight->keep_running = flight->keep_running || keep_running;
+    if (inserted) {
+        asio::co_spawn(strand_, lead(key, flight, std::move(lookup)),
+                       asio::detached);
+    } else {
+        ++coalesced_;
+    }
+
+    auto [err, exception, found] =
+        co_await result->async_receive(asio::as_tuple(asio::use_awaitable));
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+    if (err) {
+        leave(key, flight, result);
+        co_return FoundRecords{.records = {}, .err = err};
+    }
+    co_return std::move(found);
+}
+
+void QueryCoalescer::leave(const std::string &key,
+                           const std::shared_ptr<Flight> &flight,
+                           const std::shared_ptr<ResultChannel> &waiter) {
+    std::erase(flight->waiters, waiter);
+    if (!flight->waiters.empty() || flight->keep_running) {
+        return;
+    }
+    // Later callers start afresh rather than join a cancelled lookup
+    auto found_flight = flights_.find(key);
+    if (found_flight != flights_.end() && found_flight->second == flight) {
+        flights_.erase(found_flight);
+    }
+    flight->cancel.emit(asio::cancellation_type::terminal);
+}
+
+asio::awaitable<void> QueryCoalescer::lead(std::string key,
+                                           std::shared_ptr<Flight> flight,
+                                           LookupFn lookup) {
+    FoundRecords found;
+    std::exception_ptr exception;
+    try {
+        found = co_await asio::co_spawn(
+            io_, lookup(),
+            asio::bind_cancellation_slot(flight->cancel.slot(),
+                                         asio::use_awaitable));
+    } catch (...) {
+        exception = std::current_exception();
+    }
+    // Back on the strand, so no one can join between here and the sends
+    auto found_flight = flights_.find(key);
+    if (found_flight != flights_.end() && found_flight->second == flight) {
+        flights_.erase(found_flight);
+    }
+    const auto &waiters = flight->waiters;
+    for (size_t i = 0; i + 1 < waiters.size(); ++i) {
+        waiters[i]->try_send(std::error_code{}, exception, found);
+    }
+    // The last waiter takes the records rather than a copy
+    if (!waiters.empty()) {
+        waiters.back()->try_send(std::error_code{}, exception,
+                                 std::move(found));
+    }
+}
+
+}  // namespace bighorn
@@ -0,0 +1,317 @@
+#include "record_cache.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <optional>
+
+namespace bighorn {
+
+namespace {
+
+const uint8_t MaxFrequency = 3;
+// Upper bound on negative TTLs suggested by RFC 2308
+const uint32_t MaxNegativeTtl = 3 * 60 * 60;
+// TTL of stale answers suggested by RFC 8767
+const uint32_t StaleTtl = 30;
+
+// Lowercased name and a terminator, so that queries differing only in case
+// share an entry. On its own this keys an NXDOMAIN for the name.
+std::string name_key(std::span<std::string const> labels) {
+    auto key = labels_to_string(labels);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    key.push_back('\0');
+    return key;
+}
+
+// The name key followed by the type and class
+std::string cache_key(std::span<std::string const> labels, RrType qtype,
+                      RrClass qclass) {
+    auto key = name_key(labels);
+    auto type = static_cast<uint16_t>(qtype);
+    auto rclass = static_cast<uint16_t>(qclass);
+    key.push_back(static_cast<char>(type >> 8));
+    key.push_back(static_cast<char>(type & 0xFF));
+    key.push_back(static_cast<char>(rclass >> 8));
+    key.push_back(static_cast<char>(rclass & 0xFF));
+    return key;
+}
+
+// The negative TTL of RFC 2308 section 5: the SOA's TTL capped by its
+// minimum field, which is the last four bytes of the rdata
+std::optional<uint32_t> negative_ttl(const std::vector<Rr> &authorities) {
+    for (const auto &record : authorities) {
+        if (record.rtype != RrType::Soa || record.rdata.size() < 22) {
+            continue;
+        }
+        auto minimum = record.rdata.end() - 4;
+        uint32_t soa_minimum = static_cast<uint32_t>(minimum[0]) << 24 |
+                               static_cast<uint32_t>(minimum[1]) << 16 |
+                               static_cast<uint32_t>(minimum[2]) << 8 |
+                               static_cast<uint32_t>(minimum[3]);
+        return std::min({record.ttl, soa_minimum, MaxNegativeTtl});
+    }
+    return std::nullopt;
+}
+
+SharedRrs share(std::vector<Rr> records) {
+    if (records.empty()) {
+        return nullptr;
+    }
+    return std::make_shared<const std::vector<Rr>>(std::move(records));
+}
+
+}  // namespace
+
+RecordCache::RecordCache(RecordCacheOptions options) : options_(options) {
+    auto shard_count = std::max<size_t>(options.shard_count, 1);
+    auto shard_capacity = std::max<size_t>(options.capacity / shard_count, 2);
+    for (size_t i = 0; i < shard_count; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->small_capacity = std::max<size_t>(shard_capacity / 10, 1);
+        shard->main_capacity = shard_capacity - shard->small_capacity;
+        shards_.push_back(std::move(shard));
+    }
+}
+
+std::optional<CachedAnswer> RecordCache::find(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    Clock::time_point now) {
+    auto key = cache_key(labels, qtype, qclass);
+    if (auto answer = find_key(key, now, true)) {
+        return answer;
+    }
+    // An NXDOMAIN for the name or any name above it
+    for (size_t i = 0; i < labels.size(); ++i) {
+        if (auto answer = find_key(name_key(labels.subspan(i)), now, false)) {
+            return answer;
+        }
+    }
+    ++shard_for(key).misses;
+    return std::nullopt;
+}
+
+std::optional<CachedAnswer> RecordCache::find_stale(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    Clock::time_point now) {
+    if (auto answer = find_stale_key(cache_key(labels, qtype, qclass), now)) {
+        return answer;
+    }
+    return find_stale_key(name_key(labels), now);
+}
+
+void RecordCache::insert(std::span<std::string const> labels, RrType qtype,
+                         RrClass qclass, std::vector<Rr> records,
+                         Clock::time_point now) {
+    if (records.empty()) {
+        return;
+    }
+    uint32_t ttl = records[0].ttl;
+    for (const auto &record : records) {
+        ttl = std::min(ttl, record.ttl);
+    }
+    store(cache_key(labels, qtype, qclass), std::move(records), {},
+          ResponseCode::Ok, now, std::chrono::seconds(ttl));
+}
+
+void RecordCache::insert_negative(std::span<std::string const> labels,
+                                  RrType qtype, RrClass qclass,
+                                  ResponseCode rcode,
+                                  std::vector<Rr> authorities,
+                                  Clock::time_point now,
+                                  std::vector<Rr> chain) {
+    auto ttl = negative_ttl(authorities);
+    if (!ttl.has_value()) {
+        return;
+    }
+    for (const auto &record : chain) {
+        ttl = std::min(*ttl, record.ttl);
+    }
+    // The alias of a missing name exists, as do the names below it
+    auto key = rcode == ResponseCode::NameError && chain.empty()
+                   ? name_key(labels)
+                   : cache_key(labels, qtype, qclass);
+    store(std::move(key), std::move(chain), std::move(authorities), rcode,
+          now, std::chrono::seconds(*ttl));
+}
+
+std::optional<CachedAnswer> RecordCache::find_key(const std::string &key,
+                                                  Clock::time_point now,
+                                                  bool may_prefetch) {
+    auto &shard = shard_for(key);
+    std::shared_lock const lock(shard.mutex);
+    auto found = shard.entries.find(key);
+    if (found == shard.entries.end() || now >= found->second.expiry) {
+        return std::nullopt;
+    }
+    const auto &entry = found->second;
+    auto frequency = entry.frequency.load(std::memory_order_relaxed);
+    if (frequency < MaxFrequency) {
+        entry.frequency.store(frequency + 1, std::memory_order_relaxed);
+    }
+    ++shard.hits;
+    // Only negative answers keep authorities
+    if (entry.authorities != nullptr) {
+        ++shard.negative_hits;
+    }
+
+    auto left = entry.expiry - now;
+    auto hits = entry.hits.fetch_add(1, std::memory_order_relaxed) + 1;
+    bool prefetch = false;
+    if (may_prefetch && hits >= options_.prefetch_min_hits &&
+        left < std::chrono::duration_cast<Clock::duration>(
+                   entry.ttl * options_.prefetch_fraction)) {
+        // Only the first hit to get here asks for a refresh
+        prefetch = !entry.prefetching.test_and_set();
+    }
+    if (prefetch) {
+        ++shard.prefetches;
+    }
+
+    auto remaining = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(left).count());
+    return CachedAnswer{
+        .records = RecordList(entry.records, remaining),
+        .authorities = RecordList(entry.authorities, remaining),
+        .rcode = entry.rcode,
+        .prefetch = prefetch};
+}
+
+std::optional<CachedAnswer> RecordCache::find_stale_key(
+    const std::string &key, Clock::time_point now) {
+    auto &shard = shard_for(key);
+    std::shared_lock const lock(shard.mutex);
+    auto found = shard.entries.find(key);
+    if (found == shard.entries.end() ||
+        now >= found->second.expiry + options_.stale_window) {
+        return std::nullopt;
+    }
+    ++shard.stale_hits;
+    const auto &entry = found->second;
+    return CachedAnswer{.records = RecordList(entry.records, StaleTtl),
+                        .authorities = RecordList(entry.authorities, StaleTtl),
+                        .rcode = entry.rcode};
+}
+
+void RecordCache::store(std::string key, std::vector<Rr> records,
+                        std::vector<Rr> authorities, ResponseCode rcode,
+                        Clock::time_point now, Clock::duration ttl) {
+    auto &shard = shard_for(key);
+    std::unique_lock const lock(shard.mutex);
+    ++shard.insertions;
+    auto found = shard.entries.find(key);
+    if (found == shard.entries.end()) {
+        while (shard.entries.size() >=
+               shard.small_capacity + shard.main_capacity) {
+            if (shard.small.size() >= shard.small_capacity ||
+                shard.main.empty()) {
+                shard.evict_small();
+            } else {
+                shard.evict_main();
+            }
+        }
+        // A key evicted recently has proven itself and skips probation
+        bool was_ghost = shard.ghost_keys.erase(key) > 0;
+        found = shard.entries.try_emplace(std::move(key)).first;
+        if (was_ghost) {
+            shard.main.push_back(&found->first);
+        } else {
+            shard.small.push_back(&found->first);
+        }
+    }
+    auto &entry = found->second;
+    entry.records = share(std::move(records));
+    entry.authorities = share(std::move(authorities));
+    entry.rcode = rcode;
+    entry.expiry = now + ttl;
+    entry.ttl = ttl;
+    entry.hits = 0;
+    entry.prefetching.clear();
+}
+
+std::string RecordCache::key(std::span<std::string const> labels,
+                             RrType qtype, RrClass qclass) {
+    return cache_key(labels, qtype, qclass);
+}
+
+RecordCacheStats RecordCache::stats() const {
+    RecordCacheStats stats;
+    for (const auto &shard : shards_) {
+        stats.hits += shard->hits;
+        stats.negative_hits += shard->negative_hits;
+        stats.misses += shard->misses;
+        stats.insertions += shard->insertions;
+        stats.evictions += shard->evictions;
+        stats.prefetches += shard->prefetches;
+        stats.stale_hits += shard->stale_hits;
+    }
+    return stats;
+}
+
+size_t RecordCache::size() const {
+    size_t size = 0;
+    for (const auto &shard : shards_) {
+        std::shared_lock const lock(shard->mutex);
+        size += shard->entries.size();
+    }
+    return size;
+}
+
+RecordCache::Shard &RecordCache::shard_for(const std::string &key) {
+    return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+// Frees one entry. Entries hit more than once while on probation move to the
+// main queue instead of being evicted.
+void RecordCache::Shard::evict_small() {
+    while (!small.empty()) {
+        const auto *key = small.front();
+        small.pop_front();
+        auto entry = entries.find(*key);
+        if (entry->second.frequency > 1) {
+            entry->second.frequency = 0;
+            main.push_back(key);
+            if (main.size() > main_capacity) {
+                evict_main();
+                return;
+            }
+            continue;
+        }
+        remember_ghost(*key);
+        entries.erase(entry);
+        ++evictions;
+        return;
+    }
+    evict_main();
+}
+
+// Frees one entry, giving entries that were hit another lap of the queue
+void RecordCache::Shard::evict_main() {
+    while (!main.empty()) {
+        const auto *key = main.front();
+        main.pop_front();
+        auto entry = entries.find(*key);
+        auto frequency = entry->second.frequency.load();
+        if (frequency > 0) {
+            entry->second.frequency = frequency - 1;
+            main.push_back(key);
+            continue;
+        }
+        entries.erase(entry);
+        ++evictions;
+        return;
+    }
+}
+
+void RecordCache::Shard::remember_ghost(const std::string &key) {
+    ghost.push_back(key);
+    ghost_keys.insert(key);
+    if (ghost.size() > main_capacity) {
+        ghost_keys.erase(ghost.front());
+        ghost.pop_front();
+    }
+}
+
+}  // namespace bighorn
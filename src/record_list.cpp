@@ -0,0 +1,154 @@
+#include "record_list.hpp"
+
+namespace bighorn {
+
+namespace {
+
+// Calls f(c, false) for each character of the dotted name with escapes
+// removed, and f('.', true) between labels
+template <typename F>
+void for_each_name_char(std::string_view name, F &&f) {
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (name[i] == '\\' && i + 1 < name.size()) {
+            f(name[++i], false);
+        } else if (name[i] != '.') {
+            f(name[i], false);
+        } else if (i + 1 < name.size()) {
+            f('.', true);
+        }
+    }
+}
+
+size_t name_size(std::span<std::string const> labels, std::string_view name) {
+    size_t size = 1;
+    for (const auto &label : labels) {
+        size += 1 + label.size();
+    }
+    if (labels.empty() && !name.empty()) {
+        size += 1;
+        for_each_name_char(name, [&](char, bool) { ++size; });
+    }
+    return size;
+}
+
+class Writer {
+   public:
+    explicit Writer(std::vector<uint8_t> &bytes) : bytes_(bytes) {}
+
+    void name(std::span<std::string const> labels, std::string_view name) {
+        for (const auto &label : labels) {
+            bytes_.push_back(static_cast<uint8_t>(label.size()));
+            bytes_.insert(bytes_.end(), label.begin(), label.end());
+        }
+        if (labels.empty() && !name.empty()) {
+            // The length of each label is filled in once it has been read
+            auto length_at = bytes_.size();
+            bytes_.push_back(0);
+            for_each_name_char(name, [&](char c, bool ends_label) {
+                if (ends_label) {
+                    length_at = bytes_.size();
+                    bytes_.push_back(0);
+                } else {
+                    bytes_.push_back(static_cast<uint8_t>(c));
+                    ++bytes_[length_at];
+                }
+            });
+        }
+        bytes_.push_back(0);
+    }
+
+    void u16(uint16_t value) {
+        bytes_.push_back(static_cast<uint8_t>(value >> 8));
+        bytes_.push_back(static_cast<uint8_t>(value & 0xFF));
+    }
+
+    void u32(uint32_t value) {
+        u16(static_cast<uint16_t>(value >> 16));
+        u16(static_cast<uint16_t>(value & 0xFFFF));
+    }
+
+    void record(const RrRef &record) {
+        name(record.labels, record.name);
+        u16(static_cast<uint16_t>(record.rtype));
+        u16(static_cast<uint16_t>(record.rclass));
+        u32(record.ttl);
+        u16(static_cast<uint16_t>(record.rdata.size()));
+        bytes_.insert(bytes_.end(), record.rdata.begin(), record.rdata.end());
+    }
+
+   private:
+    std::vector<uint8_t> &bytes_;
+};
+
+}  // namespace
+
+size_t RrRef::wire_size() const {
+    return name_size(labels, name) + 10 + rdata.size();
+}
+
+std::vector<Rr> RecordList::to_rrs() const {
+    std::vector<Rr> records;
+    records.reserve(refs_.size());
+    for (const auto &record : refs_) {
+        records.push_back(record.to_rr());
+    }
+    return records;
+}
+
+size_t RecordList::wire_size() const {
+    size_t size = 0;
+    for (const auto &record : refs_) {
+        size += record.wire_size();
+    }
+    return size;
+}
+
+size_t response_size(std::span<Question const> questions,
+                     const RecordList &answers, const RecordList &authorities,
+                     const RecordList &additional) {
+    size_t size = 12;
+    for (const auto &question : questions) {
+        size += name_size(question.labels, {}) + 4;
+    }
+    return size + answers.wire_size() + authorities.wire_size() +
+           additional.wire_size();
+}
+
+std::vector<uint8_t> response_bytes(const Header &header,
+                                    std::span<Question const> questions,
+                                    const RecordList &answers,
+                                    const RecordList &authorities,
+                                    const RecordList &additional) {
+    Header counted = header;
+    counted.qdcount = questions.size();
+    counted.ancount = answers.size();
+    counted.nscount = authorities.size();
+    counted.arcount = additional.size();
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(
+        response_size(questions, answers, authorities, additional));
+    Writer writer(bytes);
+    uint16_t const meta =
+        counted.qr << 15 | static_cast<uint16_t>(counted.opcode) << 11 |
+        counted.aa << 10 | counted.tc << 9 | counted.rd << 8 |
+        counted.ra << 7 | counted.z << 4 |
+        static_cast<uint16_t>(counted.rcode);
+    for (uint16_t value : {counted.id, meta, counted.qdcount, counted.ancount,
+                           counted.nscount, counted.arcount}) {
+        writer.u16(value);
+    }
+    for (const auto &question : questions) {
+        writer.name(question.labels, {});
+        writer.u16(static_cast<uint16_t>(question.qtype));
+        writer.u16(static_cast<uint16_t>(question.qclass));
+    }
+    for (const auto *section : {&answers, &authorities, &additional}) {
+        for (const auto &record : *section) {
+            writer.record(record);
+        }
+    }
+    return bytes;
+}
+
+}  // namespace bighorn
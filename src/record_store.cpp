@@ -0,0 +1,137 @@
+#include "record_store.hpp"
+
+#include <cstring>
+
+namespace bighorn {
+
+static_assert(sizeof(RecordStore::Entry) == 24);
+
+std::error_code RecordStore::add(const Rr &record) {
+    if (record.rdata.size() > UINT16_MAX) {
+        return ZoneError::RdataTooLong;
+    }
+    uint32_t rdata = 0;
+    if (auto err = store_rdata(record.rdata, rdata)) {
+        return err;
+    }
+    auto [name, inserted] = names_.try_emplace(
+        labels_to_string(record.labels), static_cast<uint32_t>(owners_.size()));
+    if (inserted) {
+        owners_.push_back(
+            Owner{.key = &name->first, .first = NoEntry, .last = NoEntry});
+        if (record.labels.size() >= 2 && record.labels[0] == "*") {
+            ++wildcard_count_;
+        }
+    }
+    if (rrset_tails_.empty() && !entries_.empty()) {
+        index_rrsets();
+    }
+
+    auto index = static_cast<uint32_t>(entries_.size());
+    entries_.push_back(Entry{
+        .owner = name->second,
+        .next = NoEntry,
+        .rdata = rdata,
+        .ttl = record.ttl,
+        .rdlength = static_cast<uint16_t>(record.rdata.size()),
+        .rtype = record.rtype,
+        .rclass = record.rclass,
+    });
+
+    auto &owner = owners_[name->second];
+    auto [tail, new_rrset] = rrset_tails_.try_emplace(
+        RrsetKey{.owner = name->second,
+                 .rtype = record.rtype,
+                 .rclass = record.rclass},
+        index);
+    if (owner.first == NoEntry) {
+        owner.first = owner.last = index;
+        return {};
+    }
+    // Link after the last member of the same RRset to keep RRsets together
+    auto after = new_rrset ? owner.last : tail->second;
+    tail->second = index;
+    if (after == owner.last) {
+        entries_[owner.last].next = index;
+        owner.last = index;
+    } else {
+        entries_[index].next = entries_[after].next;
+        entries_[after].next = index;
+    }
+    return {};
+}
+
+void RecordStore::compact() {
+    std::vector<Entry> compacted;
+    compacted.reserve(entries_.size());
+    for (auto &owner : owners_) {
+        auto first = static_cast<uint32_t>(compacted.size());
+        for (auto i = owner.first; i != NoEntry; i = entries_[i].next) {
+            compacted.push_back(entries_[i]);
+            compacted.back().next = static_cast<uint32_t>(compacted.size());
+        }
+        compacted.back().next = NoEntry;
+        owner.first = first;
+        owner.last = static_cast<uint32_t>(compacted.size() - 1);
+    }
+    entries_ = std::move(compacted);
+    rrset_tails_ = {};
+}
+
+// Only needed after compaction, which leaves every RRset in one run in list
+// order, so the last entry of each run is its tail
+void RecordStore::index_rrsets() {
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        const auto &entry = entries_[i];
+        rrset_tails_[RrsetKey{.owner = entry.owner,
+                              .rtype = entry.rtype,
+                              .rclass = entry.rclass}] = i;
+    }
+}
+
+uint32_t RecordStore::find(const std::string &owner) const {
+    auto found = names_.find(owner);
+    if (found == names_.end()) {
+        return NoEntry;
+    }
+    return owners_[found->second].first;
+}
+
+std::span<uint8_t const> RecordStore::rdata(const Entry &entry) const {
+    if (entry.rdlength == 0) {
+        return {};
+    }
+    return {arena_[entry.rdata / ArenaChunkSize].get() +
+                entry.rdata % ArenaChunkSize,
+            entry.rdlength};
+}
+
+RrRef RecordStore::ref(const Entry &entry) const {
+    return RrRef{.name = *owners_[entry.owner].key,
+                 .rtype = entry.rtype,
+                 .rclass = entry.rclass,
+                 .ttl = entry.ttl,
+                 .rdata = rdata(entry)};
+}
+
+std::error_code RecordStore::store_rdata(std::span<uint8_t const> rdata,
+                                         uint32_t &offset) {
+    if (rdata.empty()) {
+        offset = 0;
+        return {};
+    }
+    if (ArenaChunkSize - arena_used_ < rdata.size()) {
+        if (arena_.size() >= (1ULL << 32) / ArenaChunkSize) {
+            return ZoneError::ZoneTooLarge;
+        }
+        arena_.push_back(std::make_unique<uint8_t[]>(ArenaChunkSize));
+        arena_used_ = 0;
+    }
+    offset = static_cast<uint32_t>((arena_.size() - 1) * ArenaChunkSize +
+                                   arena_used_);
+    std::memcpy(arena_.back().get() + arena_used_, rdata.data(), rdata.size());
+    arena_used_ += rdata.size();
+    return {};
+}
+
+}  // namespace bighorn
@@ -1,9 +1,8 @@
 #include "resolver.hpp"
 
-#include <atomic>
-#include <format>
-#include <mutex>
-#include <optional>
+#include <algorithm>
+#include <cstdlib>
+#include <asio/experimental/channel.hpp>
 #include <utility>
 
 namespace bighorn {
@@ -11,80 +10,381 @@ namespace bighorn {
 using asio::ip::udp;
 
 const int MaxSendCount = 3;
+const int MaxCnameSwitches = 10;
+const auto InitialHedgeDelay = 100ms;
+const auto MinHedgeDelay = 20ms;
+// Consecutive failures before a server is put in backoff
+const uint32_t FailureThreshold = 3;
+const auto InitialBackoff = 1s;
+const auto MaxBackoff = 5min;
 
-template <class CompletionToken>
-auto DefaultResolver::async_query_server(const DnsServer& server, Message query,
-                                         std::chrono::milliseconds timeout,
-                                         CompletionToken&& token) {
-    auto init = [&](asio::completion_handler_for<void(
-                        Message, std::error_code)> auto completion_handler,
-                    const DnsServer& server, Message query) {
-        query.header.rd = server.recursive;
-
-        udp::socket socket(io_);
-        udp::endpoint endpoint;
-        if (std::holds_alternative<Ipv4Type>(server.ip)) {
-            endpoint = udp::endpoint(
-                asio::ip::address_v4(std::get<Ipv4Type>(server.ip)),
-                server.port);
-            socket.open(udp::v4());
-        } else if (std::holds_alternative<Ipv6Type>(server.ip)) {
-            endpoint = udp::endpoint(
-                asio::ip::address_v6(std::get<Ipv6Type>(server.ip)),
-                server.port);
-            socket.open(udp::v6());
-        } else {
-            throw std::runtime_error("Unknown IP type");
-        }
-
-        Message empty_message;
-        auto send_future = socket.async_send_to(asio::buffer(query.bytes()),
-                                                endpoint, asio::use_future);
-        if (send_future.wait_for(timeout) != std::future_status::ready) {
-            completion_handler(empty_message, ResolutionError::Timeout);
-            return;
-        }
-        std::array<uint8_t, 512> response{};
-        auto read_future = socket.async_receive_from(
-            asio::buffer(response), endpoint, asio::use_future);
-        if (read_future.wait_for(timeout) != std::future_status::ready) {
-            completion_handler(empty_message, ResolutionError::Timeout);
-            return;
-        }
-        auto received_bytes = read_future.get();
-
-        DataBuffer data_buf(response, received_bytes);
-        Message message;
-        auto err = read_message(data_buf, message);
-        if (err) {
-            completion_handler(empty_message, err);
-            return;
+std::error_code follow_cname_chain(std::vector<Rr>& answers, Labels name,
+                                   RrType qtype, std::vector<Rr>& chain,
+                                   std::optional<Labels>& next) {
+    next.reset();
+    // Each hop adds a record, so a loop in the answers ends here too
+    for (size_t hops = 0; hops <= answers.size(); ++hops) {
+        bool answered = false;
+        for (auto& record : answers) {
+            if (is_same_name(record.labels, name) &&
+                (record.rtype == qtype ||
+                 (qtype == RrType::All && record.rtype != RrType::Cname))) {
+                chain.push_back(std::move(record));
+                answered = true;
+            }
+        }
+        if (answered) {
+            return {};
+        }
+        auto cname = std::find_if(
+            answers.begin(), answers.end(), [&](const auto& record) {
+                return record.rtype == RrType::Cname &&
+                       is_same_name(record.labels, name);
+            });
+        if (cname == answers.end()) {
+            // Nothing more for this name, such as a negative answer
+            if (hops > 0) {
+                next = std::move(name);
+            }
+            return {};
+        }
+        Labels target;
+        DataBuffer buffer(cname->rdata);
+        if (read_labels(buffer, target)) {
+            return ResolutionError::InvalidResponse;
+        }
+        chain.push_back(std::move(*cname));
+        name = std::move(target);
+    }
+    next = std::move(name);
+    return {};
+}
+
+void UpstreamHealth::record_success(std::chrono::microseconds rtt) {
+    auto sample = rtt.count();
+    auto srtt = srtt_us_.load(std::memory_order_relaxed);
+    if (srtt < 0) {
+        srtt_us_.store(sample, std::memory_order_relaxed);
+        rttvar_us_.store(sample / 2, std::memory_order_relaxed);
+    } else {
+        // RFC 6298 with alpha = 1/8 and beta = 1/4
+        auto rttvar = rttvar_us_.load(std::memory_order_relaxed);
+        rttvar_us_.store((3 * rttvar + std::abs(srtt - sample)) / 4,
+                         std::memory_order_relaxed);
+        srtt_us_.store((7 * srtt + sample) / 8, std::memory_order_relaxed);
+    }
+    failures_.store(0, std::memory_order_relaxed);
+    retry_at_.store(0, std::memory_order_release);
+}
+
+void UpstreamHealth::record_timeout(std::chrono::microseconds timeout,
+                                    Clock::time_point now) {
+    auto sample = timeout.count();
+    auto srtt = srtt_us_.load(std::memory_order_relaxed);
+    srtt_us_.store(srtt < 0 ? sample : (7 * srtt + sample) / 8,
+                   std::memory_order_relaxed);
+    record_failure(now);
+}
+
+void UpstreamHealth::record_failure(Clock::time_point now) {
+    auto failures = failures_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (failures >= FailureThreshold) {
+        retry_at_.store((now + backoff()).time_since_epoch().count(),
+                        std::memory_order_release);
+    }
+}
+
+std::chrono::microseconds UpstreamHealth::expected_rtt(
+    std::chrono::microseconds fallback) const {
+    auto srtt = srtt_us_.load(std::memory_order_relaxed);
+    if (srtt < 0) {
+        return fallback;
+    }
+    return std::chrono::microseconds(
+        srtt + 4 * rttvar_us_.load(std::memory_order_relaxed));
+}
+
+bool UpstreamHealth::backing_off(Clock::time_point now) const {
+    auto retry_at = retry_at_.load(std::memory_order_acquire);
+    return retry_at != 0 && now.time_since_epoch().count() < retry_at;
+}
+
+bool UpstreamHealth::claim_probe(Clock::time_point now) {
+    auto retry_at = retry_at_.load(std::memory_order_acquire);
+    if (retry_at == 0 || now.time_since_epoch().count() < retry_at) {
+        return false;
+    }
+    // Keeps everyone else off the server until the probe is answered
+    auto probe_deadline = (now + backoff()).time_since_epoch().count();
+    return retry_at_.compare_exchange_strong(retry_at, probe_deadline);
+}
+
+UpstreamHealth::Clock::duration UpstreamHealth::backoff() const {
+    auto failures = failures_.load(std::memory_order_relaxed);
+    auto doublings = std::min<uint32_t>(
+        failures > FailureThreshold ? failures - FailureThreshold : 0, 16);
+    return std::min<Clock::duration>(InitialBackoff * (1 << doublings),
+                                     MaxBackoff);
+}
+
+RateLimiter::RateLimiter(uint32_t per_second) {
+    if (per_second > 0) {
+        interval_ = std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::seconds(1)) /
+                    per_second;
+        burst_ = interval_ * (std::max<uint32_t>(per_second / 10, 1) - 1);
+    }
+}
+
+RateLimiter::Clock::duration RateLimiter::reserve(Clock::time_point now) {
+    if (interval_ == Clock::duration::zero()) {
+        return Clock::duration::zero();
+    }
+    auto now_ticks = now.time_since_epoch().count();
+    auto next_free = next_free_.load(std::memory_order_relaxed);
+    Clock::rep slot = 0;
+    do {
+        // A slot may be taken up to a burst ahead of the schedule
+        slot = std::max(next_free - burst_.count(), now_ticks);
+    } while (!next_free_.compare_exchange_weak(
+        next_free, std::max(next_free, slot) + interval_.count(),
+        std::memory_order_relaxed));
+    return Clock::duration(slot - now_ticks);
+}
+
+DefaultResolver::DefaultResolver(asio::io_context& io,
+                                 std::vector<DnsServer> servers,
+                                 std::shared_ptr<UpstreamTransport> transport)
+    : io_(io),
+      transport_(transport ? std::move(transport)
+                           : std::make_shared<UpstreamTransport>(io)),
+      upstreams_(std::make_unique<
+                 std::atomic<std::shared_ptr<const UpstreamList>>>(
+          std::make_shared<const UpstreamList>())) {
+    set_servers(servers);
+}
+
+void DefaultResolver::set_servers(const std::vector<DnsServer>& servers) {
+    auto current = upstreams_->load();
+    UpstreamList updated;
+    for (const auto& server : servers) {
+        auto existing = std::find_if(
+            current->begin(), current->end(),
+            [&](const auto& upstream) { return upstream->server == server; });
+        updated.push_back(existing != current->end()
+                              ? *existing
+                              : std::make_shared<Upstream>(server));
+    }
+    upstreams_->store(std::make_shared<const UpstreamList>(std::move(updated)));
+}
+
+namespace {
+
+// Replies from child queries and hedge timer ticks, in completion order
+using ReplyChannel = asio::experimental::channel<void(
+    std::error_code, size_t, UpstreamReply)>;
+
+const size_t HedgeTick = SIZE_MAX;
+
+// Sends one query through the transport and checks the reply, switching to
+// TCP for a truncated one. The query waits first for its slot under the
+// server's rate cap. Queries that lose a fan-out run on after it returns,
+// and perhaps after the resolver is gone, so they hold their own transport.
+asio::awaitable<UpstreamReply> query_server(
+    std::shared_ptr<UpstreamTransport> transport, DnsServer server,
+    Message query, std::chrono::milliseconds timeout,
+    std::chrono::steady_clock::duration wait) {
+    if (wait > std::chrono::steady_clock::duration::zero()) {
+        asio::steady_timer pace(co_await asio::this_coro::executor, wait);
+        co_await pace.async_wait(asio::use_awaitable);
+    }
+    query.header.rd = server.recursive;
+
+    asio::ip::address address;
+    if (std::holds_alternative<Ipv4Type>(server.ip)) {
+        address = asio::ip::address_v4(std::get<Ipv4Type>(server.ip));
+    } else {
+        address = asio::ip::address_v6(std::get<Ipv6Type>(server.ip));
+    }
+    UpstreamReply reply;
+    if (server.conn_method == ServerConnMethod::Udp) {
+        reply = co_await transport->query(udp::endpoint(address, server.port),
+                                          query, timeout);
+    }
+    if (server.conn_method == ServerConnMethod::Tcp ||
+        (!reply.err && reply.message.header.tc)) {
+        reply = co_await transport->query_tcp(
+            asio::ip::tcp::endpoint(address, server.port), std::move(query),
+            timeout);
+    }
+    if (reply.err) {
+        co_return reply;
+    }
+    auto& message = reply.message;
+    if (!message.header.qr) {
+        co_return UpstreamReply{.message = {},
+                                .err = ResolutionError::InvalidResponse};
+    }
+    if (message.header.rcode == ResponseCode::ServerFailure) {
+        co_return UpstreamReply{.message = {},
+                                .err = ResolutionError::RemoteFailure};
+    }
+    co_return reply;
+}
+
+struct FanOutState {
+    FanOutState(const asio::any_io_executor& executor, size_t server_count)
+        : replies(executor, 2 * server_count),
+          hedge_timer(executor),
+          signals(server_count) {}
+
+    ReplyChannel replies;
+    asio::steady_timer hedge_timer;
+    std::vector<asio::cancellation_signal> signals;
+};
+
+}  // namespace
+
+asio::awaitable<UpstreamReply> DefaultResolver::fan_out(
+    Message query, std::chrono::milliseconds timeout) {
+    auto now = UpstreamHealth::Clock::now();
+    auto all_upstreams = upstreams_->load();
+    UpstreamList probes;
+    UpstreamList upstreams;
+    for (const auto& upstream : *all_upstreams) {
+        if (!upstream->health.backing_off(now)) {
+            upstreams.push_back(upstream);
+        } else if (upstream->health.claim_probe(now)) {
+            probes.push_back(upstream);
         }
-        if (!message.header.qr) {
-            completion_handler(empty_message, ResolutionError::InvalidResponse);
-            return;
+    }
+    if (upstreams.empty() && probes.empty()) {
+        // Every server is backing off; trying them beats failing outright
+        upstreams = *all_upstreams;
+    }
+    std::stable_sort(upstreams.begin(), upstreams.end(),
+                     [](const auto& a, const auto& b) {
+                         return a->health.expected_rtt(InitialHedgeDelay) <
+                                b->health.expected_rtt(InitialHedgeDelay);
+                     });
+    // Probes go out with the first query, so they add no latency
+    size_t first_wave = probes.size() + 1;
+    upstreams.insert(upstreams.begin(), probes.begin(), probes.end());
+
+    auto executor = co_await asio::this_coro::executor;
+    auto state = std::make_shared<FanOutState>(executor, upstreams.size());
+    std::vector<std::chrono::steady_clock::time_point> started_at;
+
+    auto start_next = [&] {
+        auto i = started_at.size();
+        const auto& upstream = upstreams[i];
+        auto now = std::chrono::steady_clock::now();
+        auto wait = upstream->limiter.reserve(now);
+        started_at.push_back(now + wait);
+        asio::co_spawn(
+            executor,
+            query_server(transport_, upstream->server, query, timeout, wait),
+            asio::bind_cancellation_slot(
+                state->signals[i].slot(),
+                [state, i](const std::exception_ptr& ex, UpstreamReply reply) {
+                    if (ex) {
+                        reply.err =
+                            std::make_error_code(std::errc::operation_canceled);
+                    }
+                    state->replies.try_send(std::error_code{}, i,
+                                            std::move(reply));
+                }));
+        if (started_at.size() < upstreams.size()) {
+            auto delay = std::min<std::chrono::microseconds>(
+                std::max<std::chrono::microseconds>(
+                    upstream->health.expected_rtt(InitialHedgeDelay),
+                    MinHedgeDelay),
+                timeout);
+            // A query held back by the rate cap is hedged once it is late
+            // counting from when it goes out
+            state->hedge_timer.expires_after(wait + delay);
+            state->hedge_timer.async_wait([state](std::error_code err) {
+                if (!err) {
+                    state->replies.try_send(std::error_code{}, HedgeTick,
+                                            UpstreamReply{});
+                }
+            });
         }
-        if (message.header.rcode == ResponseCode::ServerFailure) {
-            const std::unique_lock slist_lock(*slist_mutex_);
-            auto i = std::find(slist_.begin(), slist_.end(), server);
-            slist_.erase(i);
+    };
 
-            completion_handler(empty_message, ResolutionError::RemoteFailure);
-            return;
+    auto cancel_others = [&](size_t winner) {
+        state->hedge_timer.cancel();
+        for (size_t j = 0; j < started_at.size(); ++j) {
+            if (j != winner) {
+                state->signals[j].emit(asio::cancellation_type::terminal);
+            }
         }
-        completion_handler(message, std::error_code{});
     };
-    return asio::async_initiate<CompletionToken,
-                                void(Message, std::error_code)>(init, token,
-                                                                server, query);
+
+    std::error_code last_err = ResolutionError::Timeout;
+    size_t finished = 0;
+    while (started_at.size() < std::min(first_wave, upstreams.size())) {
+        start_next();
+    }
+    while (finished < started_at.size()) {
+        auto [err, i, reply] = co_await state->replies.async_receive(
+            asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            // Cancelled from above, so the queries in flight are abandoned
+            cancel_others(HedgeTick);
+            last_err = std::make_error_code(std::errc::operation_canceled);
+            break;
+        }
+        if (i == HedgeTick) {
+            // A tick can arrive after a failure already started the next one
+            if (started_at.size() < upstreams.size()) {
+                start_next();
+            }
+            continue;
+        }
+        ++finished;
+        auto& health = upstreams[i]->health;
+        if (!reply.err) {
+            health.record_success(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - started_at[i]));
+            cancel_others(i);
+            co_return reply;
+        }
+        last_err = reply.err;
+        if (reply.err == ResolutionError::Timeout) {
+            health.record_timeout(timeout, UpstreamHealth::Clock::now());
+        } else if (reply.err != std::errc::operation_canceled) {
+            health.record_failure(UpstreamHealth::Clock::now());
+        }
+        // Don't wait out the hedge delay after a failure
+        if (started_at.size() < upstreams.size()) {
+            start_next();
+        }
+    }
+    state->hedge_timer.cancel();
+    co_return UpstreamReply{.message = {}, .err = last_err};
+}
+
+asio::awaitable<UpstreamReply> DefaultResolver::exchange(
+    Message query, std::chrono::milliseconds timeout) {
+    auto cancellation = co_await asio::this_coro::cancellation_state;
+    UpstreamReply reply;
+    for (int send_count = 0; send_count < MaxSendCount; ++send_count) {
+        reply = co_await asio::co_spawn(asio::make_strand(io_),
+                                        fan_out(query, timeout),
+                                        asio::use_awaitable);
+        if (!reply.err ||
+            cancellation.cancelled() != asio::cancellation_type::none) {
+            break;
+        }
+    }
+    co_return reply;
 }
 
 asio::awaitable<Resolution> DefaultResolver::resolve(
     std::vector<std::string> labels, RrType qtype, RrClass qclass,
     bool request_recursion, std::chrono::milliseconds timeout) {
-    std::vector<Rr> records;
-
-    Question question{.labels = labels, .qtype = qtype, .qclass = qclass};
     Message query{
         .header = Header{.id = 1,
                          .qr = 0,
@@ -94,80 +394,34 @@ asio::awaitable<Resolution> DefaultResolver::resolve(
                          .rd = request_recursion ? static_cast<uint8_t>(1)
                                                  : static_cast<uint8_t>(0),
                          .ra = 0},
-        .questions = {question}};
-
-    Message current_query = query;
-    DnsServer answering_server;
-    int switches_left = 10;
-new_cname:
-    if (switches_left == 0) {
-        throw std::runtime_error("Recursion limit hit");
-    }
+        .questions = {
+            Question{.labels = labels, .qtype = qtype, .qclass = qclass}}};
 
-    std::optional<Message> result;
-    std::mutex result_mutex;
-
-    for (int send_count = 0; send_count < MaxSendCount; ++send_count) {
-        asio::cancellation_signal found_signal;
-        int start_count = 0;
-        std::atomic_int finish_count = 0;
-        std::atomic_int success_count = 0;
-        {
-            std::shared_lock const slist_lock(*slist_mutex_);
-            for (auto& server : slist_) {
-                ++start_count;
-                async_query_server(
-                    server, current_query, timeout,
-                    asio::bind_cancellation_slot(
-                        found_signal.slot(),
-                        [&](const Message& message, std::error_code err) {
-                            ++finish_count;
-                            if (err) {
-                                return;
-                            }
-                            std::unique_lock const result_lock(result_mutex);
-                            if (result.has_value()) {
-                                return;
-                            }
-                            found_signal.emit(
-                                asio::cancellation_type::terminal);
-                            result = message;
-                            ++success_count;
-                        }));
-            }
+    // Only the part of a CNAME chain missing from an answer is asked for
+    std::vector<Rr> chain;
+    for (int switches_left = MaxCnameSwitches; switches_left > 0;
+         --switches_left) {
+        auto reply = co_await exchange(query, timeout);
+        if (reply.err) {
+            co_return Resolution::failed(reply.err);
         }
-        while (start_count != finish_count && success_count == 0) {
-            if (success_count > 0) {
-                goto finished;
-            }
-            asio::steady_timer timer(io_);
-            timer.expires_from_now(10ms);
-            co_await timer.async_wait(asio::use_awaitable);
-        }
-    }
-finished:
-    if (!result.has_value()) {
-        throw std::runtime_error("Resolution failed");
-    }
-    auto message = result.value();
-    for (auto& answer : message.answers) {
-        if (answer.rtype == RrType::Cname) {
-            Labels cname;
-            DataBuffer buffer(answer.rdata);
-            auto err = read_labels(buffer, cname);
-            if (err) {
-                throw std::runtime_error("Server returned invalid labels");
-            }
-            if (current_query.questions.at(0).labels != cname) {
-                current_query.questions.at(0).labels = std::move(cname);
-            }
-            --switches_left;
-            goto new_cname;
+        auto& message = reply.message;
+        std::optional<Labels> next;
+        if (auto err = follow_cname_chain(
+                message.answers, std::move(query.questions[0].labels), qtype,
+                chain, next)) {
+            co_return Resolution::failed(err);
+        }
+        if (!next.has_value()) {
+            co_return Resolution{
+                .records = std::move(chain),
+                .rcode = message.header.rcode,
+                .authorities = std::move(message.authorities),
+                .additional = std::move(message.additional)};
         }
+        query.questions[0].labels = std::move(*next);
     }
-    std::copy(message.answers.begin(), message.answers.end(),
-              std::back_inserter(records));
-    co_return Resolution{.records = records, .rcode = message.header.rcode};
+    co_return Resolution::failed(ResolutionError::RecursionLimit);
 }
 
 }  // namespace bighorn
\ No newline at end of file
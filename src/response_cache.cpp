@@ -0,0 +1,203 @@
+#include "response_cache.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+#include "record_cache.hpp"
+
+namespace bighorn {
+
+namespace {
+
+const size_t HeaderSize = 12;
+
+uint16_t read_u16(const std::vector<uint8_t> &bytes, size_t pos) {
+    return static_cast<uint16_t>(bytes[pos] << 8 | bytes[pos + 1]);
+}
+
+// Questions that differ only in case share a key. Queries with anything
+// other than one standard question are not cached.
+std::optional<std::string> response_key(const Message &query,
+                                        size_t max_size) {
+    if (query.questions.size() != 1 || query.header.opcode != Opcode::Query) {
+        return std::nullopt;
+    }
+    const auto &question = query.questions[0];
+    auto key =
+        RecordCache::key(question.labels, question.qtype, question.qclass);
+    // CD is the lowest of the three bits after RA. DO comes with EDNS.
+    bool const dnssec_ok = query.edns && query.edns->dnssec_ok;
+    key.push_back(static_cast<char>(dnssec_ok << 2 | query.header.rd << 1 |
+                                    (query.header.z & 1)));
+    // Advertised UDP sizes in the same 512-byte step share entries; zero
+    // stands for a query without EDNS
+    key.push_back(static_cast<char>(
+        query.edns ? 1 + query.edns->udp_size / 512 : 0));
+    key.append(std::to_string(max_size));
+    return key;
+}
+
+// Moves pos past the name, which may end in a compression pointer
+bool skip_name(const std::vector<uint8_t> &bytes, size_t &pos) {
+    while (pos < bytes.size()) {
+        auto length = bytes[pos];
+        if ((length & 0xC0) == 0xC0) {
+            pos += 2;
+            return pos <= bytes.size();
+        }
+        pos += 1 + length;
+        if (length == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Finds where each record's TTL is, and the smallest of them. Returns false
+// if the response does not parse.
+bool find_ttls(const std::vector<uint8_t> &bytes,
+               std::vector<uint16_t> &offsets, uint32_t &min_ttl) {
+    if (bytes.size() < HeaderSize || bytes.size() > UINT16_MAX) {
+        return false;
+    }
+    size_t pos = HeaderSize;
+    for (auto i = read_u16(bytes, 4); i > 0; --i) {
+        if (!skip_name(bytes, pos)) {
+            return false;
+        }
+        pos += 4;
+    }
+    size_t record_count =
+        read_u16(bytes, 6) + read_u16(bytes, 8) + read_u16(bytes, 10);
+    for (size_t i = 0; i < record_count; ++i) {
+        if (!skip_name(bytes, pos) || pos + 10 > bytes.size()) {
+            return false;
+        }
+        auto ttl_offset = pos + 4;
+        uint32_t ttl = static_cast<uint32_t>(read_u16(bytes, ttl_offset))
+                           << 16 |
+                       read_u16(bytes, ttl_offset + 2);
+        min_ttl = std::min(min_ttl, ttl);
+        offsets.push_back(static_cast<uint16_t>(ttl_offset));
+        pos += 10 + read_u16(bytes, pos + 8);
+    }
+    return pos == bytes.size();
+}
+
+// Writes the query's spelling of the name over the cached one. Returns false
+// if the labels are laid out differently.
+bool patch_question(const Question &question, std::vector<uint8_t> &bytes) {
+    size_t pos = HeaderSize;
+    for (const auto &label : question.labels) {
+        if (pos + 1 + label.size() > bytes.size() ||
+            bytes[pos] != label.size()) {
+            return false;
+        }
+        std::copy(label.begin(), label.end(), bytes.begin() + pos + 1);
+        pos += 1 + label.size();
+    }
+    return true;
+}
+
+}  // namespace
+
+ResponseCache::ResponseCache(ResponseCacheOptions options)
+    : options_(options) {}
+
+std::optional<std::vector<uint8_t>> ResponseCache::find(const Message &query,
+                                                        size_t max_size,
+                                                        uint64_t generation,
+                                                        Clock::time_point now) {
+    auto key = response_key(query, max_size);
+    if (!key) {
+        return std::nullopt;
+    }
+    std::vector<uint8_t> bytes;
+    std::vector<uint16_t> ttl_offsets;
+    uint32_t elapsed = 0;
+    {
+        std::shared_lock const lock(mutex_);
+        auto found = entries_.find(*key);
+        if (found == entries_.end() || found->second.generation != generation ||
+            found->second.expiry <= now) {
+            ++misses_;
+            return std::nullopt;
+        }
+        const auto &entry = found->second;
+        bytes = entry.bytes;
+        ttl_offsets = entry.ttl_offsets;
+        elapsed = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::seconds>(now -
+                                                             entry.stored)
+                .count());
+    }
+    if (!patch_question(query.questions[0], bytes)) {
+        ++misses_;
+        return std::nullopt;
+    }
+    ++hits_;
+    bytes[0] = static_cast<uint8_t>(query.header.id >> 8);
+    bytes[1] = static_cast<uint8_t>(query.header.id & 0xFF);
+    for (auto offset : ttl_offsets) {
+        uint32_t ttl = static_cast<uint32_t>(read_u16(bytes, offset)) << 16 |
+                       read_u16(bytes, offset + 2);
+        ttl -= elapsed;
+        bytes[offset] = static_cast<uint8_t>(ttl >> 24);
+        bytes[offset + 1] = static_cast<uint8_t>(ttl >> 16);
+        bytes[offset + 2] = static_cast<uint8_t>(ttl >> 8);
+        bytes[offset + 3] = static_cast<uint8_t>(ttl);
+    }
+    return bytes;
+}
+
+void ResponseCache::insert(const Message &query, size_t max_size,
+                           uint64_t generation, std::vector<uint8_t> response,
+                           Clock::time_point now) {
+    auto key = response_key(query, max_size);
+    if (!key || options_.capacity == 0 || response.size() < HeaderSize) {
+        return;
+    }
+    auto rcode = static_cast<ResponseCode>(response[3] & 0x0F);
+    if (rcode != ResponseCode::Ok && rcode != ResponseCode::NameError) {
+        return;
+    }
+    std::vector<uint16_t> ttl_offsets;
+    uint32_t min_ttl = UINT32_MAX;
+    if (!find_ttls(response, ttl_offsets, min_ttl) || ttl_offsets.empty() ||
+        min_ttl == 0) {
+        return;
+    }
+
+    std::unique_lock const lock(mutex_);
+    ++insertions_;
+    auto found = entries_.find(*key);
+    if (found == entries_.end()) {
+        while (entries_.size() >= options_.capacity) {
+            entries_.erase(order_.front());
+            order_.pop_front();
+            ++evictions_;
+        }
+        order_.push_back(*key);
+        found = entries_.try_emplace(std::move(*key)).first;
+    }
+    auto &entry = found->second;
+    entry.bytes = std::move(response);
+    entry.ttl_offsets = std::move(ttl_offsets);
+    entry.generation = generation;
+    entry.stored = now;
+    entry.expiry = now + std::chrono::seconds(min_ttl);
+}
+
+ResponseCacheStats ResponseCache::stats() const {
+    return ResponseCacheStats{.hits = hits_,
+                              .misses = misses_,
+                              .insertions = insertions_,
+                              .evictions = evictions_};
+}
+
+size_t ResponseCache::size() const {
+    std::shared_lock const lock(mutex_);
+    return entries_.size();
+}
+
+}  // namespace bighorn
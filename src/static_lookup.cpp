@@ -5,52 +5,102 @@ namespace bighorn {
 asio::awaitable<FoundRecords> StaticLookup::find_records(
     std::span<std::string const> labels, RrType qtype, RrClass qclass,
     bool use_recursion) {
-    std::vector<Rr> matching_records;
+    co_return find_records_sync(labels, qtype, qclass, use_recursion);
+}
+
+FoundRecords StaticLookup::find_records_sync(
+    std::span<std::string const> labels, RrType qtype, RrClass qclass,
+    bool use_recursion) const {
+    RecordList matching_records;
     if (use_recursion) {
-        co_return matching_records;
+        return FoundRecords{.records = std::move(matching_records), .err = {}};
     }
-    for (auto &candidate : records_[labels_to_string(labels)]) {
-        if (qtype != candidate.rtype && qtype != RrType::All) {
-            if (qtype != RrType::A || candidate.rtype != RrType::Cname) {
-                continue;
-            }
+    std::vector<uint32_t> targets;
+    auto key = labels_to_string(labels);
+    for (auto i = records_.find(key); i != RecordStore::NoEntry;
+         i = records_.entry(i).next) {
+        const auto &candidate = records_.entry(i);
+        if (!is_type_match(qtype, candidate.rtype)) {
+            continue;
         }
         if (qclass != candidate.rclass) {
             continue;
         }
-        if (!is_label_match(labels, candidate)) {
-            continue;
+        matching_records.push_back(records_.ref(candidate));
+        add_target(i, targets);
+    }
+    if (labels.size() >= 2 && records_.wildcard_count() > 0) {
+        match_wildcards(labels, qtype, qclass, matching_records, targets);
+    }
+    RecordList additional;
+    for (auto first : targets) {
+        append_addresses(first, qclass, additional);
+    }
+    return FoundRecords{.records = std::move(matching_records),
+                        .additional = std::move(additional),
+                        .err = {}};
+}
+
+void StaticLookup::compact() {
+    records_.compact();
+    additional_links_.clear();
+    Labels target;
+    for (uint32_t i = 0; i < records_.record_count(); ++i) {
+        const auto &entry = records_.entry(i);
+        if (read_additional_target(entry.rtype, records_.rdata(entry),
+                                   target)) {
+            additional_links_[i] = records_.find(labels_to_string(target));
         }
-        matching_records.push_back(candidate);
     }
-    if (labels.size() >= 2 && !wildcard_records_.empty()) {
-        match_wildcards(labels, qtype, qclass, matching_records);
+}
+
+void StaticLookup::add_target(uint32_t index,
+                              std::vector<uint32_t> &targets) const {
+    const auto &entry = records_.entry(index);
+    if (!has_additional_target(entry.rtype)) {
+        return;
+    }
+    auto first = RecordStore::NoEntry;
+    if (auto link = additional_links_.find(index);
+        link != additional_links_.end()) {
+        first = link->second;
+    } else if (Labels target; read_additional_target(
+                   entry.rtype, records_.rdata(entry), target)) {
+        first = records_.find(labels_to_string(target));
+    }
+    if (first != RecordStore::NoEntry &&
+        std::find(targets.begin(), targets.end(), first) == targets.end()) {
+        targets.push_back(first);
+    }
+}
+
+void StaticLookup::append_addresses(uint32_t first, RrClass qclass,
+                                    RecordList &additional) const {
+    for (auto i = first; i != RecordStore::NoEntry;
+         i = records_.entry(i).next) {
+        const auto &entry = records_.entry(i);
+        if ((entry.rtype == RrType::A || entry.rtype == RrType::Aaaa) &&
+            entry.rclass == qclass) {
+            additional.push_back(records_.ref(entry));
+        }
     }
-    co_return FoundRecords{.records = matching_records, .err = {}};
 }
 
 void StaticLookup::match_wildcards(std::span<std::string const> labels,
                                    RrType qtype, RrClass qclass,
-                                   std::vector<Rr> &matching_records) {
+                                   RecordList &matching_records,
+                                   std::vector<uint32_t> &targets) const {
     for (size_t i = 1; i < labels.size(); ++i) {
-        std::stringstream wild_label;
-        wild_label << "*.";
-        for (size_t j = i; j < labels.size() - 1; ++j) {
-            wild_label << labels[j];
-            wild_label << '.';
-        }
-        wild_label << labels.back();
-        auto possible_records = wildcard_records_.find(wild_label.str());
-        if (possible_records == wildcard_records_.end()) {
-            continue;
+        auto key = "*." + labels_to_string(labels.subspan(i));
+        for (auto j = records_.find(key); j != RecordStore::NoEntry;
+             j = records_.entry(j).next) {
+            const auto &record = records_.entry(j);
+            if ((record.rtype == qtype || qtype == RrType::All) &&
+                record.rclass == qclass) {
+                matching_records.push_back(records_.ref(record));
+                add_target(j, targets);
+            }
         }
-        auto record_vec = (*possible_records).second;
-        std::copy_if(
-            record_vec.begin(), record_vec.end(),
-            std::back_inserter(matching_records), [&](auto record) {
-                return (record.rtype == qtype || qtype == RrType::All) &&
-                       record.rclass == qclass;
-            });
     }
 }
 
@@ -0,0 +1,345 @@
+#include "upstream_transport.hpp"
+
+#include <asio/experimental/awaitable_operators.hpp>
+
+namespace bighorn {
+
+using asio::ip::tcp;
+using asio::ip::udp;
+
+UpstreamTransport::PooledSocket::PooledSocket(asio::io_context &io,
+                                              udp protocol)
+    : strand(asio::make_strand(io)),
+      socket(strand, udp::endpoint(protocol, 0)),
+      rng(std::random_device{}()) {}
+
+UpstreamTransport::TcpConnection::TcpConnection(asio::io_context &io,
+                                                tcp::endpoint server)
+    : strand(asio::make_strand(io)),
+      socket(strand),
+      server(server),
+      connected_signal(strand, std::chrono::steady_clock::time_point::max()),
+      rng(std::random_device{}()) {}
+
+UpstreamTransport::UpstreamTransport(asio::io_context &io, size_t socket_count)
+    : io_(io) {
+    for (size_t i = 0; i < std::max<size_t>(socket_count, 1); ++i) {
+        v4_sockets_.push_back(std::make_shared<PooledSocket>(io, udp::v4()));
+        try {
+            v6_sockets_.push_back(
+                std::make_shared<PooledSocket>(io, udp::v6()));
+        } catch (const std::system_error &) {
+            // No IPv6 on this host; IPv6 servers fail with the error below
+        }
+    }
+}
+
+asio::awaitable<UpstreamReply> UpstreamTransport::query(
+    udp::endpoint server, Message query, std::chrono::milliseconds timeout) {
+    const auto &sockets =
+        server.address().is_v4() ? v4_sockets_ : v6_sockets_;
+    if (sockets.empty()) {
+        co_return UpstreamReply{
+            .message = {},
+            .err = std::make_error_code(
+                std::errc::address_family_not_supported)};
+    }
+    auto pooled = sockets[next_socket_++ % sockets.size()];
+    co_return co_await asio::co_spawn(
+        pooled->strand,
+        query_on_socket(pooled, server, std::move(query), timeout),
+        asio::use_awaitable);
+}
+
+asio::awaitable<UpstreamReply> UpstreamTransport::query_on_socket(
+    std::shared_ptr<PooledSocket> pooled, udp::endpoint server, Message query,
+    std::chrono::milliseconds timeout) {
+    using namespace asio::experimental::awaitable_operators;
+    if (query.questions.empty()) {
+        co_return UpstreamReply{.message = {},
+                                .err = ResolutionError::InvalidResponse};
+    }
+
+    PendingKey key{.id = 0, .server = server, .question = query.questions[0]};
+    std::uniform_int_distribution<uint16_t> random_id;
+    do {
+        key.id = random_id(pooled->rng);
+    } while (pooled->pending.contains(key));
+    query.header.id = key.id;
+    auto reply =
+        std::make_shared<ReplyChannel>(pooled->strand, static_cast<size_t>(1));
+    pooled->pending.emplace(key, reply);
+    if (!pooled->reading) {
+        pooled->reading = true;
+        asio::co_spawn(pooled->strand, read_replies(pooled), asio::detached);
+    }
+
+    asio::steady_timer deadline(pooled->strand, timeout);
+    auto query_bytes = query.bytes();
+    auto [send_err, _] = co_await pooled->socket.async_send_to(
+        asio::buffer(query_bytes), server, asio::as_tuple(asio::use_awaitable));
+    UpstreamReply result{.message = {}, .err = send_err};
+    if (!send_err) {
+        auto received = co_await (
+            reply->async_receive(asio::as_tuple(asio::use_awaitable)) ||
+            deadline.async_wait(asio::as_tuple(asio::use_awaitable)));
+        if (received.index() == 0) {
+            auto [receive_err, message] = std::get<0>(std::move(received));
+            result = UpstreamReply{.message = std::move(message),
+                                   .err = receive_err};
+        } else {
+            result.err = ResolutionError::Timeout;
+        }
+    }
+
+    pooled->pending.erase(key);
+    if (pooled->pending.empty()) {
+        // Wakes the reader so that it can stop
+        pooled->socket.cancel();
+    }
+    co_return result;
+}
+
+asio::awaitable<void> UpstreamTransport::read_replies(
+    std::shared_ptr<PooledSocket> pooled) {
+    std::array<uint8_t, 512> data{};
+    udp::endpoint sender;
+    while (!pooled->pending.empty()) {
+        auto [err, size] = co_await pooled->socket.async_receive_from(
+            asio::buffer(data), sender, asio::as_tuple(asio::use_awaitable));
+        if (err == asio::error::operation_aborted) {
+            continue;
+        }
+        if (err) {
+            break;
+        }
+        DataBuffer buffer(data, size);
+        Message message;
+        if (read_message(buffer, message) || message.questions.empty()) {
+            ++rejected_;
+            continue;
+        }
+        auto pending = pooled->pending.find(PendingKey{
+            .id = message.header.id,
+            .server = sender,
+            .question = message.questions[0],
+        });
+        if (pending == pooled->pending.end()) {
+            ++rejected_;
+            continue;
+        }
+        pending->second->try_send(std::error_code{}, std::move(message));
+    }
+    pooled->reading = false;
+}
+
+asio::awaitable<UpstreamReply> UpstreamTransport::query_tcp(
+    tcp::endpoint server, Message query, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto left = timeout;
+    for (int attempt = 0;; ++attempt) {
+        auto connection = tcp_connection(server);
+        bool stale = false;
+        auto reply = co_await asio::co_spawn(
+            connection->strand,
+            query_on_connection(connection, query, left, stale),
+            asio::use_awaitable);
+        left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        // A server closing an idle connection says nothing about its
+        // health, so the query goes out once more on a new one
+        if (!stale || attempt > 0 ||
+            left <= std::chrono::milliseconds::zero()) {
+            co_return reply;
+        }
+    }
+}
+
+std::shared_ptr<UpstreamTransport::TcpConnection>
+UpstreamTransport::tcp_connection(tcp::endpoint server) {
+    std::lock_guard const lock(tcp_mutex_);
+    auto &pooled = tcp_connections_[server];
+    if (!pooled || pooled->broken) {
+        pooled = std::make_shared<TcpConnection>(io_, server);
+    }
+    return pooled;
+}
+
+asio::awaitable<UpstreamReply> UpstreamTransport::query_on_connection(
+    std::shared_ptr<TcpConnection> connection, Message query,
+    std::chrono::milliseconds timeout, bool &stale) {
+    using namespace asio::experimental::awaitable_operators;
+    if (query.questions.empty()) {
+        co_return UpstreamReply{.message = {},
+                                .err = ResolutionError::InvalidResponse};
+    }
+    if (connection->broken) {
+        // Failed after this query picked it
+        stale = true;
+        co_return UpstreamReply{
+            .message = {},
+            .err = std::make_error_code(std::errc::connection_aborted)};
+    }
+    asio::steady_timer deadline(connection->strand, timeout);
+    bool const reused = connection->connected;
+    if (!connection->connected) {
+        auto err = co_await connect(connection, deadline);
+        if (err) {
+            co_return UpstreamReply{.message = {}, .err = err};
+        }
+    }
+
+    std::uniform_int_distribution<uint16_t> random_id;
+    uint16_t id = 0;
+    do {
+        id = random_id(connection->rng);
+    } while (connection->pending.contains(id));
+    query.header.id = id;
+    auto reply = std::make_shared<ReplyChannel>(connection->strand,
+                                                static_cast<size_t>(1));
+    connection->pending.emplace(
+        id, PendingTcpQuery{.question = query.questions[0], .reply = reply});
+    auto replies_before = connection->replies_read;
+
+    auto query_bytes = query.bytes();
+    std::vector<uint8_t> framed{
+        static_cast<uint8_t>(query_bytes.size() >> 8),
+        static_cast<uint8_t>(query_bytes.size() & 0xFF)};
+    framed.insert(framed.end(), query_bytes.begin(), query_bytes.end());
+    connection->outbox.push_back(std::move(framed));
+    if (!connection->writing) {
+        connection->writing = true;
+        asio::co_spawn(connection->strand, write_queued(connection),
+                       asio::detached);
+    }
+    if (!connection->reading) {
+        connection->reading = true;
+        asio::co_spawn(connection->strand, read_tcp_replies(connection),
+                       asio::detached);
+    }
+
+    UpstreamReply result{.message = {}, .err = ResolutionError::Timeout};
+    auto received = co_await (
+        reply->async_receive(asio::as_tuple(asio::use_awaitable)) ||
+        deadline.async_wait(asio::as_tuple(asio::use_awaitable)));
+    if (received.index() == 0) {
+        auto [receive_err, message] = std::get<0>(std::move(received));
+        result = UpstreamReply{.message = std::move(message),
+                               .err = receive_err};
+        stale = receive_err && reused &&
+                connection->replies_read == replies_before;
+    }
+
+    connection->pending.erase(id);
+    if (connection->pending.empty() && connection->reading) {
+        // Wakes the reader so that it can stop; the connection stays open
+        connection->socket.cancel();
+    }
+    co_return result;
+}
+
+// Only the first query opens the connection; the others wait until it is
+// open or their deadline passes
+asio::awaitable<std::error_code> UpstreamTransport::connect(
+    std::shared_ptr<TcpConnection> connection, asio::steady_timer &deadline) {
+    using namespace asio::experimental::awaitable_operators;
+    if (connection->connecting) {
+        auto waited = co_await (
+            connection->connected_signal.async_wait(
+                asio::as_tuple(asio::use_awaitable)) ||
+            deadline.async_wait(asio::as_tuple(asio::use_awaitable)));
+        if (waited.index() == 1) {
+            co_return ResolutionError::Timeout;
+        }
+    } else {
+        connection->connecting = true;
+        ++tcp_connects_;
+        auto connected = co_await (
+            connection->socket.async_connect(
+                connection->server, asio::as_tuple(asio::use_awaitable)) ||
+            deadline.async_wait(asio::as_tuple(asio::use_awaitable)));
+        connection->connect_err =
+            connected.index() == 0
+                ? std::get<0>(std::get<0>(connected))
+                : std::error_code(ResolutionError::Timeout);
+        connection->connecting = false;
+        connection->connected = !connection->connect_err;
+        if (connection->connect_err) {
+            connection->broken = true;
+        }
+        connection->connected_signal.cancel();
+    }
+    co_return connection->connect_err;
+}
+
+asio::awaitable<void> UpstreamTransport::write_queued(
+    std::shared_ptr<TcpConnection> connection) {
+    while (!connection->outbox.empty()) {
+        auto bytes = std::move(connection->outbox.front());
+        connection->outbox.pop_front();
+        auto [err, _] =
+            co_await asio::async_write(connection->socket, asio::buffer(bytes),
+                                       asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            // Part of a message may have been written
+            break_connection(*connection, err);
+            break;
+        }
+    }
+    connection->writing = false;
+}
+
+asio::awaitable<void> UpstreamTransport::read_tcp_replies(
+    std::shared_ptr<TcpConnection> connection) {
+    std::vector<uint8_t> data;
+    while (!connection->pending.empty() && !connection->broken) {
+        std::array<uint8_t, 2> length{};
+        auto [err, read] = co_await asio::async_read(
+            connection->socket, asio::buffer(length),
+            asio::as_tuple(asio::use_awaitable));
+        if (err == asio::error::operation_aborted && read == 0) {
+            // Stopped between messages, so the stream is still in step
+            continue;
+        }
+        if (err) {
+            break_connection(*connection, err);
+            break;
+        }
+        data.resize(length[0] << 8 | length[1]);
+        auto [body_err, _] = co_await asio::async_read(
+            connection->socket, asio::buffer(data),
+            asio::as_tuple(asio::use_awaitable));
+        if (body_err) {
+            break_connection(*connection, body_err);
+            break;
+        }
+        DataBuffer buffer(data);
+        Message message;
+        if (read_message(buffer, message) || message.questions.empty()) {
+            ++rejected_;
+            continue;
+        }
+        auto pending = connection->pending.find(message.header.id);
+        if (pending == connection->pending.end() ||
+            pending->second.question != message.questions[0]) {
+            ++rejected_;
+            continue;
+        }
+        ++connection->replies_read;
+        pending->second.reply->try_send(std::error_code{}, std::move(message));
+    }
+    connection->reading = false;
+}
+
+void UpstreamTransport::break_connection(TcpConnection &connection,
+                                         std::error_code err) {
+    connection.broken = true;
+    connection.outbox.clear();
+    for (auto &[id, pending] : connection.pending) {
+        pending.reply->try_send(err, Message{});
+    }
+    std::error_code ignore_err;
+    connection.socket.close(ignore_err);
+}
+
+}  // namespace bighorn
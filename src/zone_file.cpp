@@ -0,0 +1,857 @@
+#include "zone_file.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <condition_variable>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+namespace bighorn {
+
+namespace {
+
+// Threaded parsing splits the input into chunks of about this size
+const size_t ChunkSize = 1 << 20;
+// How many chunks each thread may have parsed and waiting for the sink
+const size_t MaxChunksAheadPerThread = 2;
+const size_t MaxLabelLength = 63;
+const size_t MaxNameLength = 255;
+const uint32_t MaxTtl = 0x7FFFFFFF;
+
+struct Token {
+    std::string_view text;
+    bool quoted;
+};
+
+struct ParserState {
+    Labels origin;
+    uint32_t default_ttl;
+    RrClass rclass;
+    Labels owner;
+    bool has_owner = false;
+};
+
+// Splits the input into entries without copying: tokens are views into the
+// input, and lines inside parentheses are joined into a single entry.
+class Tokenizer {
+   public:
+    Tokenizer(std::string_view text, size_t first_line)
+        : text_(text), line_(first_line), entry_line_(first_line) {}
+
+    bool next(std::vector<Token> &tokens, bool &owner_omitted,
+              std::error_code &err) {
+        tokens.clear();
+        owner_omitted = false;
+        int depth = 0;
+        bool line_start = true;
+        while (pos_ < text_.size()) {
+            char const c = text_[pos_];
+            if (line_start && depth == 0 && tokens.empty()) {
+                owner_omitted = c == ' ' || c == '\t';
+                entry_line_ = line_;
+            }
+            line_start = false;
+            switch (c) {
+                case '\n':
+                    ++line_;
+                    ++pos_;
+                    line_start = true;
+                    if (depth == 0 && !tokens.empty()) {
+                        return true;
+                    }
+                    break;
+                case ' ':
+                case '\t':
+                case '\r':
+                    ++pos_;
+                    break;
+                case ';': {
+                    auto end = text_.find('\n', pos_);
+                    pos_ = end == std::string_view::npos ? text_.size() : end;
+                    break;
+                }
+                case '(':
+                    ++depth;
+                    ++pos_;
+                    break;
+                case ')':
+                    if (depth == 0) {
+                        err = ZoneError::UnbalancedParentheses;
+                        return false;
+                    }
+                    --depth;
+                    ++pos_;
+                    break;
+                case '"': {
+                    size_t const start = pos_ + 1;
+                    size_t i = start;
+                    while (i < text_.size() && text_[i] != '"') {
+                        if (text_[i] == '\\') {
+                            ++i;
+                        } else if (text_[i] == '\n') {
+                            ++line_;
+                        }
+                        ++i;
+                    }
+                    if (i >= text_.size()) {
+                        err = ZoneError::SyntaxError;
+                        return false;
+                    }
+                    tokens.push_back({text_.substr(start, i - start), true});
+                    pos_ = i + 1;
+                    break;
+                }
+                default: {
+                    size_t i = pos_;
+                    while (i < text_.size() && !is_delimiter(text_[i])) {
+                        if (text_[i] == '\\') {
+                            ++i;
+                        }
+                        ++i;
+                    }
+                    i = std::min(i, text_.size());
+                    tokens.push_back({text_.substr(pos_, i - pos_), false});
+                    pos_ = i;
+                }
+            }
+        }
+        if (depth != 0) {
+            err = ZoneError::UnbalancedParentheses;
+            return false;
+        }
+        return !tokens.empty();
+    }
+
+    [[nodiscard]] size_t entry_line() const { return entry_line_; }
+
+   private:
+    std::string_view text_;
+    size_t pos_ = 0;
+    size_t line_;
+    size_t entry_line_;
+
+    static bool is_delimiter(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ';' ||
+               c == '(' || c == ')' || c == '"';
+    }
+};
+
+bool iequals(std::string_view a, std::string_view b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                      [](char x, char y) {
+                          return std::toupper(static_cast<unsigned char>(x)) ==
+                                 std::toupper(static_cast<unsigned char>(y));
+                      });
+}
+
+template <typename T>
+bool parse_number(std::string_view text, T &out) {
+    auto const *end = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(text.data(), end, out);
+    return ec == std::errc{} && ptr == end;
+}
+
+// Decodes a \X or \DDD escape starting at text[i], leaving i on its last char
+bool read_escape(std::string_view text, size_t &i, char &out) {
+    auto is_digit = [&](size_t j) {
+        return std::isdigit(static_cast<unsigned char>(text[j])) != 0;
+    };
+    if (i + 3 < text.size() && is_digit(i + 1) && is_digit(i + 2) &&
+        is_digit(i + 3)) {
+        int value = 0;
+        if (!parse_number(text.substr(i + 1, 3), value) || value > 255) {
+            return false;
+        }
+        out = static_cast<char>(value);
+        i += 3;
+        return true;
+    }
+    if (i + 1 >= text.size()) {
+        return false;
+    }
+    out = text[i + 1];
+    i += 1;
+    return true;
+}
+
+std::error_code parse_name(std::string_view text, const Labels &origin,
+                           Labels &out) {
+    if (text == "@") {
+        out = origin;
+        return {};
+    }
+    out.clear();
+    std::string label;
+    bool absolute = false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '.') {
+            if (i == text.size() - 1) {
+                absolute = true;
+            }
+            if (label.empty()) {
+                if (text.size() == 1) {
+                    break;
+                }
+                return ZoneError::InvalidName;
+            }
+            out.push_back(std::move(label));
+            label.clear();
+            continue;
+        }
+        if (c == '\\' && !read_escape(text, i, c)) {
+            return ZoneError::InvalidName;
+        }
+        label.push_back(c);
+    }
+    if (!label.empty()) {
+        out.push_back(std::move(label));
+    }
+    if (!absolute) {
+        out.insert(out.end(), origin.begin(), origin.end());
+    }
+    size_t total = 1;
+    for (const auto &l : out) {
+        if (l.size() > MaxLabelLength) {
+            return ZoneError::InvalidName;
+        }
+        total += l.size() + 1;
+    }
+    if (total > MaxNameLength) {
+        return ZoneError::InvalidName;
+    }
+    return {};
+}
+
+// Plain seconds or BIND style units, e.g. "3600" or "1h30m"
+bool parse_ttl(std::string_view text, uint32_t &out) {
+    uint64_t total = 0;
+    size_t i = 0;
+    if (text.empty()) {
+        return false;
+    }
+    while (i < text.size()) {
+        size_t start = i;
+        while (i < text.size() &&
+               std::isdigit(static_cast<unsigned char>(text[i])) != 0) {
+            ++i;
+        }
+        uint64_t value = 0;
+        if (start == i || !parse_number(text.substr(start, i - start), value)) {
+            return false;
+        }
+        uint64_t multiplier = 1;
+        if (i < text.size()) {
+            switch (std::tolower(static_cast<unsigned char>(text[i]))) {
+                case 's':
+                    break;
+                case 'm':
+                    multiplier = 60;
+                    break;
+                case 'h':
+                    multiplier = 3600;
+                    break;
+                case 'd':
+                    multiplier = 86400;
+                    break;
+                case 'w':
+                    multiplier = 604800;
+                    break;
+                default:
+                    return false;
+            }
+            ++i;
+        }
+        total += value * multiplier;
+        if (total > MaxTtl) {
+            return false;
+        }
+    }
+    out = static_cast<uint32_t>(total);
+    return true;
+}
+
+bool parse_class(std::string_view text, RrClass &out) {
+    if (iequals(text, "IN")) {
+        out = RrClass::In;
+    } else if (iequals(text, "CS")) {
+        out = RrClass::Cs;
+    } else if (iequals(text, "CH")) {
+        out = RrClass::Ch;
+    } else if (iequals(text, "HS")) {
+        out = RrClass::Hs;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_type(std::string_view text, RrType &out) {
+    static const std::pair<std::string_view, RrType> types[] = {
+        {"A", RrType::A},         {"NS", RrType::Ns},
+        {"MD", RrType::Md},       {"MF", RrType::Mf},
+        {"CNAME", RrType::Cname}, {"SOA", RrType::Soa},
+        {"MB", RrType::Mb},       {"MG", RrType::Mg},
+        {"MR", RrType::Mr},       {"NULL", RrType::Null},
+        {"WKS", RrType::Wks},     {"PTR", RrType::Ptr},
+        {"HINFO", RrType::Hinfo}, {"MINFO", RrType::Minfo},
+        {"MX", RrType::Mx},       {"TXT", RrType::Txt},
+        {"AAAA", RrType::Aaaa}};
+    for (const auto &[name, rtype] : types) {
+        if (iequals(text, name)) {
+            out = rtype;
+            return true;
+        }
+    }
+    uint16_t number = 0;
+    if (text.size() > 4 && iequals(text.substr(0, 4), "TYPE") &&
+        parse_number(text.substr(4), number)) {
+        out = static_cast<RrType>(number);
+        return true;
+    }
+    return false;
+}
+
+void append_u16(std::vector<uint8_t> &rdata, uint16_t value) {
+    rdata.push_back(value >> 8);
+    rdata.push_back(value & 0xFF);
+}
+
+void append_u32(std::vector<uint8_t> &rdata, uint32_t value) {
+    append_u16(rdata, value >> 16);
+    append_u16(rdata, value & 0xFFFF);
+}
+
+void append_name(std::vector<uint8_t> &rdata, const Labels &labels) {
+    for (const auto &label : labels) {
+        rdata.push_back(static_cast<uint8_t>(label.size()));
+        rdata.insert(rdata.end(), label.begin(), label.end());
+    }
+    rdata.push_back(0);
+}
+
+std::error_code append_name(std::vector<uint8_t> &rdata, Token token,
+                            const Labels &origin) {
+    Labels labels;
+    auto err = parse_name(token.text, origin, labels);
+    if (err) {
+        return err;
+    }
+    append_name(rdata, labels);
+    return {};
+}
+
+std::error_code append_character_string(std::vector<uint8_t> &rdata,
+                                        Token token) {
+    size_t const length_i = rdata.size();
+    rdata.push_back(0);
+    for (size_t i = 0; i < token.text.size(); ++i) {
+        char c = token.text[i];
+        if (c == '\\' && !read_escape(token.text, i, c)) {
+            return ZoneError::InvalidRdata;
+        }
+        rdata.push_back(static_cast<uint8_t>(c));
+    }
+    size_t const length = rdata.size() - length_i - 1;
+    if (length > 255) {
+        return ZoneError::InvalidRdata;
+    }
+    rdata[length_i] = static_cast<uint8_t>(length);
+    return {};
+}
+
+bool parse_ipv4(std::string_view text, uint32_t &out) {
+    uint32_t ip = 0;
+    for (int i = 0; i < 4; ++i) {
+        auto dot = i < 3 ? text.find('.') : text.size();
+        if (dot == std::string_view::npos) {
+            return false;
+        }
+        uint8_t octet = 0;
+        if (!parse_number(text.substr(0, dot), octet)) {
+            return false;
+        }
+        ip = ip << 8 | octet;
+        text.remove_prefix(std::min(dot + 1, text.size()));
+    }
+    out = ip;
+    return text.empty();
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// RFC 3597: \# <length> <hex words...>
+std::error_code parse_generic_rdata(std::span<Token const> tokens,
+                                    std::vector<uint8_t> &rdata) {
+    uint16_t length = 0;
+    if (tokens.size() < 2 || !parse_number(tokens[1].text, length)) {
+        return ZoneError::InvalidRdata;
+    }
+    for (const auto &token : tokens.subspan(2)) {
+        if (token.text.size() % 2 != 0) {
+            return ZoneError::InvalidRdata;
+        }
+        for (size_t i = 0; i < token.text.size(); i += 2) {
+            int const high = hex_value(token.text[i]);
+            int const low = hex_value(token.text[i + 1]);
+            if (high < 0 || low < 0) {
+                return ZoneError::InvalidRdata;
+            }
+            rdata.push_back(static_cast<uint8_t>(high << 4 | low));
+        }
+    }
+    if (rdata.size() != length) {
+        return ZoneError::InvalidRdata;
+    }
+    return {};
+}
+
+std::error_code parse_rdata(RrType rtype, std::span<Token const> tokens,
+                            const Labels &origin,
+                            std::vector<uint8_t> &rdata) {
+    if (!tokens.empty() && !tokens[0].quoted && tokens[0].text == "\\#") {
+        return parse_generic_rdata(tokens, rdata);
+    }
+    auto expect = [&](size_t count) { return tokens.size() == count; };
+    switch (rtype) {
+        case RrType::A: {
+            uint32_t ip = 0;
+            if (!expect(1) || !parse_ipv4(tokens[0].text, ip)) {
+                return ZoneError::InvalidRdata;
+            }
+            append_u32(rdata, ip);
+            return {};
+        }
+        case RrType::Aaaa: {
+            std::array<char, INET6_ADDRSTRLEN + 1> text{};
+            Ipv6Type ip{};
+            if (!expect(1) || tokens[0].text.size() >= text.size()) {
+                return ZoneError::InvalidRdata;
+            }
+            std::copy(tokens[0].text.begin(), tokens[0].text.end(),
+                      text.begin());
+            if (inet_pton(AF_INET6, text.data(), ip.data()) != 1) {
+                return ZoneError::InvalidRdata;
+            }
+            rdata.insert(rdata.end(), ip.begin(), ip.end());
+            return {};
+        }
+        case RrType::Ns:
+        case RrType::Md:
+        case RrType::Mf:
+        case RrType::Cname:
+        case RrType::Mb:
+        case RrType::Mg:
+        case RrType::Mr:
+        case RrType::Ptr:
+            if (!expect(1)) {
+                return ZoneError::InvalidRdata;
+            }
+            return append_name(rdata, tokens[0], origin);
+        case RrType::Minfo: {
+            if (!expect(2)) {
+                return ZoneError::InvalidRdata;
+            }
+            auto err = append_name(rdata, tokens[0], origin);
+            return err ? err : append_name(rdata, tokens[1], origin);
+        }
+        case RrType::Mx: {
+            uint16_t preference = 0;
+            if (!expect(2) || !parse_number(tokens[0].text, preference)) {
+                return ZoneError::InvalidRdata;
+            }
+            append_u16(rdata, preference);
+            return append_name(rdata, tokens[1], origin);
+        }
+        case RrType::Soa: {
+            if (!expect(7)) {
+                return ZoneError::InvalidRdata;
+            }
+            auto err = append_name(rdata, tokens[0], origin);
+            if (!err) {
+                err = append_name(rdata, tokens[1], origin);
+            }
+            if (err) {
+                return err;
+            }
+            uint32_t serial = 0;
+            if (!parse_number(tokens[2].text, serial)) {
+                return ZoneError::InvalidRdata;
+            }
+            append_u32(rdata, serial);
+            for (size_t i = 3; i < 7; ++i) {
+                uint32_t value = 0;
+                if (!parse_ttl(tokens[i].text, value)) {
+                    return ZoneError::InvalidRdata;
+                }
+                append_u32(rdata, value);
+            }
+            return {};
+        }
+        case RrType::Hinfo: {
+            if (!expect(2)) {
+                return ZoneError::InvalidRdata;
+            }
+            auto err = append_character_string(rdata, tokens[0]);
+            return err ? err : append_character_string(rdata, tokens[1]);
+        }
+        case RrType::Txt: {
+            if (tokens.empty()) {
+                return ZoneError::InvalidRdata;
+            }
+            for (const auto &token : tokens) {
+                auto err = append_character_string(rdata, token);
+                if (err) {
+                    return err;
+                }
+            }
+            return {};
+        }
+        case RrType::Wks: {
+            uint32_t ip = 0;
+            uint8_t protocol = 0;
+            if (tokens.size() < 2 || !parse_ipv4(tokens[0].text, ip)) {
+                return ZoneError::InvalidRdata;
+            }
+            if (iequals(tokens[1].text, "TCP")) {
+                protocol = 6;
+            } else if (iequals(tokens[1].text, "UDP")) {
+                protocol = 17;
+            } else if (!parse_number(tokens[1].text, protocol)) {
+                return ZoneError::InvalidRdata;
+            }
+            append_u32(rdata, ip);
+            rdata.push_back(protocol);
+            size_t const bitmap_start = rdata.size();
+            for (const auto &token : tokens.subspan(2)) {
+                uint16_t port = 0;
+                if (!parse_number(token.text, port)) {
+                    return ZoneError::InvalidRdata;
+                }
+                size_t const byte = bitmap_start + port / 8;
+                if (rdata.size() <= byte) {
+                    rdata.resize(byte + 1, 0);
+                }
+                rdata[byte] |= static_cast<uint8_t>(0x80 >> (port % 8));
+            }
+            return {};
+        }
+        default:
+            // NULL and unknown types only have the generic form
+            return ZoneError::InvalidRdata;
+    }
+}
+
+std::error_code parse_directive(std::span<Token const> tokens,
+                                ParserState &state) {
+    auto name = tokens[0].text;
+    if (iequals(name, "$ORIGIN")) {
+        if (tokens.size() != 2) {
+            return ZoneError::SyntaxError;
+        }
+        Labels origin;
+        auto err = parse_name(tokens[1].text, state.origin, origin);
+        if (err) {
+            return err;
+        }
+        state.origin = std::move(origin);
+        return {};
+    }
+    if (iequals(name, "$TTL")) {
+        if (tokens.size() != 2 ||
+            !parse_ttl(tokens[1].text, state.default_ttl)) {
+            return ZoneError::InvalidTtl;
+        }
+        return {};
+    }
+    return ZoneError::UnsupportedDirective;
+}
+
+// Parses one entry; is_record is false for directives
+std::error_code parse_entry(std::span<Token const> tokens, bool owner_omitted,
+                            ParserState &state, Rr &record, bool &is_record) {
+    is_record = false;
+    size_t i = 0;
+    if (!owner_omitted) {
+        if (!tokens[0].quoted && tokens[0].text.starts_with('$')) {
+            return parse_directive(tokens, state);
+        }
+        auto err = parse_name(tokens[0].text, state.origin, state.owner);
+        if (err) {
+            return err;
+        }
+        state.has_owner = true;
+        i = 1;
+    } else if (!state.has_owner) {
+        return ZoneError::MissingOwner;
+    }
+
+    uint32_t ttl = state.default_ttl;
+    RrClass rclass = state.rclass;
+    for (int field = 0; field < 2 && i < tokens.size(); ++field) {
+        auto text = tokens[i].text;
+        if (tokens[i].quoted || text.empty()) {
+            break;
+        }
+        if (std::isdigit(static_cast<unsigned char>(text.front())) != 0) {
+            if (!parse_ttl(text, ttl)) {
+                return ZoneError::InvalidTtl;
+            }
+            ++i;
+        } else if (parse_class(text, rclass)) {
+            ++i;
+        }
+    }
+    RrType rtype{};
+    if (i >= tokens.size()) {
+        return ZoneError::SyntaxError;
+    }
+    if (!parse_type(tokens[i].text, rtype)) {
+        return ZoneError::UnknownType;
+    }
+    record.labels = state.owner;
+    record.rtype = rtype;
+    record.rclass = rclass;
+    record.ttl = ttl;
+    record.rdata.clear();
+    auto err =
+        parse_rdata(rtype, tokens.subspan(i + 1), state.origin, record.rdata);
+    if (err) {
+        return err;
+    }
+    is_record = true;
+    return {};
+}
+
+template <typename Emit>
+ZoneParseResult parse_range(std::string_view text, size_t first_line,
+                            ParserState state, Emit &&emit) {
+    ZoneParseResult result;
+    Tokenizer tokenizer(text, first_line);
+    std::vector<Token> tokens;
+    bool owner_omitted = false;
+    std::error_code err;
+    while (tokenizer.next(tokens, owner_omitted, err)) {
+        Rr record;
+        bool is_record = false;
+        err = parse_entry(tokens, owner_omitted, state, record, is_record);
+        if (err) {
+            break;
+        }
+        if (is_record) {
+            emit(std::move(record));
+            ++result.record_count;
+        }
+    }
+    if (err) {
+        result.err = err;
+        result.line = tokenizer.entry_line();
+    }
+    return result;
+}
+
+struct Chunk {
+    size_t begin;
+    size_t end;
+    size_t first_line;
+    ParserState state;
+};
+
+// Finds entry boundaries to split the input at. A chunk always starts on a
+// line with an explicit owner outside parentheses, and carries the $ORIGIN
+// and $TTL in effect at that point, so chunks parse independently.
+std::vector<Chunk> split_chunks(std::string_view text,
+                                const ParserState &initial_state,
+                                unsigned threads) {
+    std::vector<Chunk> chunks{
+        Chunk{.begin = 0, .end = text.size(), .first_line = 1,
+              .state = initial_state}};
+    if (threads <= 1 || text.size() < 2 * ChunkSize) {
+        return chunks;
+    }
+    size_t next_split = ChunkSize;
+    ParserState state = initial_state;
+    size_t line = 1;
+    int depth = 0;
+    bool in_quote = false;
+    // Applies a directive starting the line, or splits before the entry
+    auto start_line = [&](size_t start) {
+        char const next = text[start];
+        if (next == '$') {
+            // Errors are reported by the chunk parser itself
+            Tokenizer tokenizer(text.substr(start), line);
+            std::vector<Token> tokens;
+            bool owner_omitted = false;
+            std::error_code err;
+            if (tokenizer.next(tokens, owner_omitted, err)) {
+                (void)parse_directive(tokens, state);
+            }
+        } else if (start >= next_split && next != ' ' && next != '\t' &&
+                   next != '\r' && next != '\n' && next != ';') {
+            chunks.back().end = start;
+            chunks.push_back(Chunk{.begin = start,
+                                   .end = text.size(),
+                                   .first_line = line,
+                                   .state = state});
+            next_split = start + ChunkSize;
+        }
+    };
+    start_line(0);
+    for (size_t i = 0; i < text.size(); ++i) {
+        char const c = text[i];
+        if (in_quote) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                in_quote = false;
+            } else if (c == '\n') {
+                ++line;
+            }
+            continue;
+        }
+        switch (c) {
+            case '\\':
+                ++i;
+                break;
+            case '"':
+                in_quote = true;
+                break;
+            case ';': {
+                auto end = text.find('\n', i);
+                i = (end == std::string_view::npos ? text.size() : end) - 1;
+                break;
+            }
+            case '(':
+                ++depth;
+                break;
+            case ')':
+                depth = std::max(0, depth - 1);
+                break;
+            case '\n': {
+                ++line;
+                size_t const start = i + 1;
+                if (depth != 0 || start >= text.size()) {
+                    break;
+                }
+                start_line(start);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return chunks;
+}
+
+}  // namespace
+
+ZoneParseResult parse_zone(std::string_view text,
+                           const ZoneParseOptions &options,
+                           const ZoneRecordSink &sink) {
+    ParserState const initial_state{.origin = options.origin,
+                                    .default_ttl = options.default_ttl,
+                                    .rclass = options.default_class,
+                                    .owner = {},
+                                    .has_owner = false};
+    auto chunks = split_chunks(text, initial_state, options.threads);
+    auto chunk_text = [&](const Chunk &chunk) {
+        return text.substr(chunk.begin, chunk.end - chunk.begin);
+    };
+    if (chunks.size() == 1) {
+        return parse_range(text, 1, initial_state, sink);
+    }
+
+    // Workers take chunks in order, staying at most MaxChunksAhead chunks
+    // ahead of the sink, so that only that many chunks' records are held
+    std::mutex mutex;
+    std::condition_variable_any chunk_done;
+    size_t next_chunk = 0;
+    size_t emitted = 0;
+    std::vector<std::vector<Rr>> outputs(chunks.size());
+    std::vector<ZoneParseResult> results(chunks.size());
+    std::vector<bool> parsed(chunks.size());
+    size_t const max_ahead = MaxChunksAheadPerThread * options.threads;
+    auto work = [&](const std::stop_token &stop) {
+        while (true) {
+            size_t k = 0;
+            {
+                std::unique_lock lock(mutex);
+                if (!chunk_done.wait(lock, stop, [&] {
+                        return next_chunk == chunks.size() ||
+                               next_chunk < emitted + max_ahead;
+                    }) ||
+                    next_chunk == chunks.size()) {
+                    return;
+                }
+                k = next_chunk++;
+            }
+            std::vector<Rr> output;
+            const auto &chunk = chunks[k];
+            auto result = parse_range(
+                chunk_text(chunk), chunk.first_line, chunk.state,
+                [&](Rr record) { output.push_back(std::move(record)); });
+            std::lock_guard lock(mutex);
+            outputs[k] = std::move(output);
+            results[k] = result;
+            parsed[k] = true;
+            chunk_done.notify_all();
+        }
+    };
+    // Destroyed first, which stops the workers once the sink has had enough
+    std::vector<std::jthread> workers;
+    workers.reserve(options.threads);
+    for (unsigned i = 0; i < options.threads; ++i) {
+        workers.emplace_back(work);
+    }
+
+    ZoneParseResult total;
+    for (size_t k = 0; k < chunks.size() && !total.err; ++k) {
+        std::vector<Rr> output;
+        {
+            std::unique_lock lock(mutex);
+            chunk_done.wait(lock, [&] { return parsed[k]; });
+            output = std::move(outputs[k]);
+        }
+        for (auto &record : output) {
+            sink(std::move(record));
+        }
+        total.record_count += results[k].record_count;
+        total.err = results[k].err;
+        total.line = results[k].line;
+        std::lock_guard lock(mutex);
+        emitted = k + 1;
+        chunk_done.notify_all();
+    }
+    return total;
+}
+
+ZoneParseResult parse_zone_file(const std::string &path,
+                                const ZoneParseOptions &options,
+                                const ZoneRecordSink &sink) {
+    MappedFile file;
+    auto err = map_file(path, file);
+    if (err) {
+        return ZoneParseResult{.err = err};
+    }
+    auto bytes = file.bytes();
+    std::string_view text(reinterpret_cast<const char *>(bytes.data()),
+                          bytes.size());
+    return parse_zone(text, options, sink);
+}
+
+}  // namespace bighorn
@@ -0,0 +1,256 @@
+#include "zone_image.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace bighorn {
+
+static_assert(sizeof(ZoneImageHeader) == 96);
+static_assert(sizeof(ZoneImageName) == 24);
+static_assert(sizeof(ZoneImageRrset) == 24);
+static_assert(sizeof(ZoneImageAuthority) == 48);
+
+namespace {
+
+const size_t SectionAlignment = 8;
+
+template <typename T>
+void append_pod(std::vector<uint8_t> &out, const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    auto const *bytes = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void align_to(std::vector<uint8_t> &out, size_t alignment) {
+    out.resize((out.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+// Everything after the owner name: TYPE, CLASS, TTL, RDLENGTH and RDATA
+void append_record_wire(std::vector<uint8_t> &out, const Rr &record) {
+    size_t owner_size = 1;
+    for (const auto &label : record.labels) {
+        owner_size += 1 + label.size();
+    }
+    auto wire = record.bytes();
+    out.insert(out.end(), wire.begin() + static_cast<ptrdiff_t>(owner_size),
+               wire.end());
+}
+
+// Creates a file with a unique name beside the path and writes the bytes
+#ifdef _WIN32
+
+std::error_code write_temp_file(const std::string &path,
+                                std::span<uint8_t const> bytes,
+                                std::string &temp_path) {
+    auto dir = std::filesystem::path(path).parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    char name[MAX_PATH];
+    if (GetTempFileNameA(dir.string().c_str(), "bhz", 0, name) == 0) {
+        return {static_cast<int>(GetLastError()), std::system_category()};
+    }
+    temp_path = name;
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(bytes.data()),
+              static_cast<std::streamsize>(bytes.size()));
+    out.close();
+    if (!out) {
+        std::error_code ignore_err;
+        std::filesystem::remove(temp_path, ignore_err);
+        return std::make_error_code(std::errc::io_error);
+    }
+    return {};
+}
+
+#else
+
+std::error_code write_temp_file(const std::string &path,
+                                std::span<uint8_t const> bytes,
+                                std::string &temp_path) {
+    temp_path = path + ".XXXXXX";
+    int fd = ::mkstemp(temp_path.data());
+    if (fd < 0) {
+        return {errno, std::generic_category()};
+    }
+    std::error_code err;
+    size_t written = 0;
+    while (!err && written < bytes.size()) {
+        auto count =
+            ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (count >= 0) {
+            written += static_cast<size_t>(count);
+        } else if (errno != EINTR) {
+            err = {errno, std::generic_category()};
+        }
+    }
+    // mkstemp makes the file private to its owner, but the image is for
+    // any process that serves it. It must be on disk before it replaces the
+    // old one.
+    if (!err && (::fchmod(fd, 0644) != 0 || ::fsync(fd) != 0)) {
+        err = {errno, std::generic_category()};
+    }
+    if (::close(fd) != 0 && !err) {
+        err = {errno, std::generic_category()};
+    }
+    if (err) {
+        ::unlink(temp_path.c_str());
+    }
+    return err;
+}
+
+#endif
+
+}  // namespace
+
+void ZoneCompiler::add_record(Rr record) {
+    auto key = labels_to_string(record.labels);
+    records_[std::move(key)].push_back(std::move(record));
+}
+
+void ZoneCompiler::add_authority(const DomainAuthority &authority) {
+    authorities_.push_back(authority);
+}
+
+std::vector<uint8_t> ZoneCompiler::compile() const {
+    std::vector<ZoneImageName> names;
+    std::vector<ZoneImageRrset> rrsets;
+    std::vector<ZoneImageAuthority> authorities;
+    std::string strings;
+    std::vector<uint8_t> data;
+    uint32_t wildcard_count = 0;
+
+    names.reserve(records_.size());
+    for (const auto &[key, records] : records_) {
+        ZoneImageName name{.key_offset = strings.size(),
+                           .key_length = static_cast<uint32_t>(key.size()),
+                           .first_rrset = static_cast<uint32_t>(rrsets.size()),
+                           .rrset_count = 0,
+                           .reserved = 0};
+        strings += key;
+        if (key.starts_with("*.")) {
+            ++wildcard_count;
+        }
+
+        // Group by (type, class), keeping the order types were first added
+        std::vector<bool> written(records.size(), false);
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (written[i]) {
+                continue;
+            }
+            ZoneImageRrset rrset{
+                .rtype = static_cast<uint16_t>(records[i].rtype),
+                .rclass = static_cast<uint16_t>(records[i].rclass),
+                .record_count = 0,
+                .wire_offset = data.size(),
+                .wire_size = 0};
+            for (size_t j = i; j < records.size(); ++j) {
+                if (records[j].rtype != records[i].rtype ||
+                    records[j].rclass != records[i].rclass) {
+                    continue;
+                }
+                append_record_wire(data, records[j]);
+                ++rrset.record_count;
+                written[j] = true;
+            }
+            rrset.wire_size = data.size() - rrset.wire_offset;
+            rrsets.push_back(rrset);
+            ++name.rrset_count;
+        }
+        names.push_back(name);
+    }
+
+    align_to(data, alignof(uint32_t));
+    for (const auto &authority : authorities_) {
+        auto domain = labels_to_string(authority.domain);
+        auto ns_name = labels_to_string(authority.name);
+        ZoneImageAuthority entry{
+            .domain_offset = strings.size(),
+            .name_offset = strings.size() + domain.size(),
+            .ips_offset = data.size(),
+            .domain_length = static_cast<uint32_t>(domain.size()),
+            .name_length = static_cast<uint32_t>(ns_name.size()),
+            .ip_count = static_cast<uint32_t>(authority.ips.size()),
+            .ttl = authority.ttl,
+            .rclass = static_cast<uint16_t>(authority.rclass),
+            .reserved = {}};
+        strings += domain;
+        strings += ns_name;
+        for (auto ip : authority.ips) {
+            append_pod(data, ip);
+        }
+        authorities.push_back(entry);
+    }
+
+    ZoneImageHeader header{
+        .magic = ZoneImageMagic,
+        .version = ZoneImageVersion,
+        .byte_order = ZoneImageByteOrder,
+        .file_size = 0,
+        .name_count = static_cast<uint32_t>(names.size()),
+        .rrset_count = static_cast<uint32_t>(rrsets.size()),
+        .authority_count = static_cast<uint32_t>(authorities.size()),
+        .wildcard_count = wildcard_count,
+        .names_offset = 0,
+        .rrsets_offset = 0,
+        .authorities_offset = 0,
+        .strings_offset = 0,
+        .strings_size = strings.size(),
+        .data_offset = 0,
+        .data_size = data.size()};
+
+    std::vector<uint8_t> image(sizeof(ZoneImageHeader));
+    header.names_offset = image.size();
+    for (const auto &name : names) {
+        append_pod(image, name);
+    }
+    header.rrsets_offset = image.size();
+    for (const auto &rrset : rrsets) {
+        append_pod(image, rrset);
+    }
+    header.authorities_offset = image.size();
+    for (const auto &authority : authorities) {
+        append_pod(image, authority);
+    }
+    header.strings_offset = image.size();
+    image.insert(image.end(), strings.begin(), strings.end());
+    align_to(image, SectionAlignment);
+    header.data_offset = image.size();
+    image.insert(image.end(), data.begin(), data.end());
+    header.file_size = image.size();
+    std::memcpy(image.data(), &header, sizeof(header));
+    return image;
+}
+
+std::error_code ZoneCompiler::write(const std::string &path) const {
+    auto image = compile();
+    // Replace the file atomically so processes still mapping the previous
+    // image are not affected. The new image is written under a name of its
+    // own, so that writers of the same path never share a temporary file.
+    std::string temp_path;
+    auto err = write_temp_file(path, image, temp_path);
+    if (err) {
+        return err;
+    }
+    std::filesystem::rename(temp_path, path, err);
+    if (err) {
+        std::error_code ignore_err;
+        std::filesystem::remove(temp_path, ignore_err);
+    }
+    return err;
+}
+
+}  // namespace bighorn
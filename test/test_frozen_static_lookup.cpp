@@ -0,0 +1,83 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <bighorn/frozen_static_lookup.hpp>
+#include <filesystem>
+#include <fstream>
+
+using namespace bighorn;
+
+TEST(FrozenStaticLookupTest, MatchesStaticLookup) {
+    StaticLookup source;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        Labels name{"host" + std::to_string(i), "example", "com"};
+        source.add_record(Rr::a_record(name, i, 300));
+        if (i % 7 == 0) {
+            source.add_record(
+                Rr::mx_record(name, 10, {"mail", "example", "com"}, 300));
+        }
+    }
+    source.add_record(Rr::cname_record({"alias", "example", "com"},
+                                       {"host1", "example", "com"}, 60));
+    source.add_record(Rr::a_record({"*", "wild", "example", "com"}, 7, 60));
+    source.add_record(Rr::a_record({"mail", "example", "com"}, 8, 300));
+    source.add_record(
+        Rr::aaaa_record({"mail", "example", "com"}, {0x20, 0x01}, 300));
+    FrozenStaticLookup frozen(source);
+    EXPECT_EQ(frozen.name_count(), source.name_count());
+
+    std::vector<Labels> queries{
+        {"host0", "example", "com"},  {"host19999", "example", "com"},
+        {"host20000", "example", "com"}, {"alias", "example", "com"},
+        {"a", "b", "wild", "example", "com"}, {"wild", "example", "com"},
+        {"example", "com"},           {}};
+    for (const auto &labels : queries) {
+        for (auto qtype : {RrType::A, RrType::Mx, RrType::All}) {
+            auto found =
+                frozen.find_records_sync(labels, qtype, RrClass::In, false);
+            auto expected =
+                source.find_records_sync(labels, qtype, RrClass::In, false);
+            EXPECT_EQ(found.records, expected.records)
+                << labels_to_string(labels);
+            EXPECT_EQ(found.additional, expected.additional)
+                << labels_to_string(labels);
+        }
+    }
+    for (uint32_t i = 0; i < 20000; ++i) {
+        Labels name{"host" + std::to_string(i), "example", "com"};
+        auto found = frozen.find_records_sync(name, RrType::A, RrClass::In,
+                                              false);
+        ASSERT_THAT(found.records,
+                    testing::ElementsAre(Rr::a_record(name, i, 300)));
+    }
+}
+
+TEST(FrozenStaticLookupTest, EmptyLookup) {
+    FrozenStaticLookup frozen{StaticLookup{}};
+    Labels name{"example", "com"};
+    EXPECT_THAT(
+        frozen.find_records_sync(name, RrType::A, RrClass::In, false).records,
+        testing::IsEmpty());
+}
+
+TEST(FrozenStaticLookupTest, FromZoneFile) {
+    auto path = std::filesystem::temp_directory_path() / "bighorn_frozen.zone";
+    {
+        std::ofstream out(path);
+        out << "$ORIGIN example.\nwww 60 A 10.0.0.1\n    A 10.0.0.2\n";
+    }
+    FrozenStaticLookup frozen;
+    auto result = FrozenStaticLookup::from_zone_file(path.string(), {}, frozen);
+    std::filesystem::remove(path);
+    ASSERT_FALSE(result.err);
+
+    Labels labels{"www", "example"};
+    asio::io_context io;
+    auto future = asio::co_spawn(
+        io, frozen.find_records(labels, RrType::A, RrClass::In, false),
+        asio::use_future);
+    io.run();
+    EXPECT_THAT(future.get().records,
+                testing::ElementsAre(Rr::a_record(labels, 0x0A000001, 60),
+                                     Rr::a_record(labels, 0x0A000002, 3600)));
+}
@@ -132,3 +132,27 @@ TEST(InputTest, LabelMustEndInAlnum) {
     auto err = bighorn::read_labels(buffer, labels);
     ASSERT_EQ(err, bighorn::MessageError::InvalidLabelChar);
 }
+
+TEST(InputTest, RequestWithOptRecord) {
+    std::vector<uint8_t> request = {
+        0, 1, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 1,  // One question, one OPT
+        1, 'a', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1,    // a.com IN A
+        0, 0, 41, 0x10, 0x00,                       // OPT, UDP size 4096
+        0, 0, 0x80, 0, 0, 0};                       // DO set, no options
+    bighorn::DataBuffer buffer(request);
+
+    bighorn::Message message;
+    ASSERT_FALSE(bighorn::read_request(buffer, message));
+    ASSERT_EQ(message.questions.size(), 1);
+    ASSERT_TRUE(message.edns.has_value());
+    EXPECT_EQ(message.edns->udp_size, 4096);
+    EXPECT_TRUE(message.edns->dnssec_ok);
+
+    // Without the OPT record there is no EDNS
+    request[11] = 0;
+    request.resize(23);
+    bighorn::DataBuffer plain_buffer(request);
+    bighorn::Message plain;
+    ASSERT_FALSE(bighorn::read_request(plain_buffer, plain));
+    EXPECT_FALSE(plain.edns.has_value());
+}
@@ -0,0 +1,164 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <bighorn/mapped_lookup.hpp>
+#include <bighorn/responder.hpp>
+#include <bighorn/zone_image.hpp>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using namespace bighorn;
+
+std::string image_path(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+MappedLookup compile_and_open(const ZoneCompiler& compiler,
+                              const std::string& name) {
+    auto path = image_path(name);
+    auto err = compiler.write(path);
+    EXPECT_FALSE(err);
+    MappedLookup lookup;
+    err = MappedLookup::open(path, lookup);
+    EXPECT_FALSE(err) << err.message();
+    std::filesystem::remove(path);
+    return lookup;
+}
+
+FoundRecords find(MappedLookup& lookup, const Labels& labels, RrType qtype) {
+    asio::io_context io;
+    auto future = asio::co_spawn(
+        io, lookup.find_records(labels, qtype, RrClass::In, false),
+        asio::use_future);
+    io.run();
+    return future.get();
+}
+
+TEST(MappedLookupTest, ExactMatch) {
+    auto a_record = Rr::a_record({"sri-nic", "arpa"}, 0x1a000049, 86400);
+    auto a_record_2 = Rr::a_record({"sri-nic", "arpa"}, 0x0a000033, 86400);
+    auto mx_record =
+        Rr::mx_record({"sri-nic", "arpa"}, 0, {"sri-nic", "arpa"}, 86400);
+    ZoneCompiler compiler;
+    compiler.add_record(a_record);
+    compiler.add_record(mx_record);
+    compiler.add_record(a_record_2);
+    compiler.add_record(Rr::a_record({"other", "arpa"}, 0x01020304, 60));
+    auto lookup = compile_and_open(compiler, "bighorn_exact.zimg");
+
+    EXPECT_THAT(find(lookup, {"sri-nic", "arpa"}, RrType::A).records,
+                testing::ElementsAre(a_record, a_record_2));
+    EXPECT_THAT(find(lookup, {"sri-nic", "arpa"}, RrType::All).records,
+                testing::UnorderedElementsAre(a_record, a_record_2, mx_record));
+    EXPECT_THAT(find(lookup, {"sir-nic", "arpa"}, RrType::A).records,
+                testing::IsEmpty());
+    // The exchange's addresses come with the MX answer
+    EXPECT_THAT(find(lookup, {"sri-nic", "arpa"}, RrType::Mx).additional,
+                testing::ElementsAre(a_record, a_record_2));
+}
+
+TEST(MappedLookupTest, CnameAnswersA) {
+    auto cname = Rr::cname_record({"alias", "com"}, {"example", "com"}, 300);
+    ZoneCompiler compiler;
+    compiler.add_record(cname);
+    auto lookup = compile_and_open(compiler, "bighorn_cname.zimg");
+
+    EXPECT_THAT(find(lookup, {"alias", "com"}, RrType::A).records,
+                testing::ElementsAre(cname));
+    EXPECT_THAT(find(lookup, {"alias", "com"}, RrType::Mx).records,
+                testing::IsEmpty());
+}
+
+TEST(MappedLookupTest, Wildcard) {
+    auto wildcard = Rr::a_record({"*", "example", "com"}, 0x7F000001, 86400);
+    ZoneCompiler compiler;
+    compiler.add_record(wildcard);
+    auto lookup = compile_and_open(compiler, "bighorn_wildcard.zimg");
+
+    EXPECT_THAT(find(lookup, {"a", "b", "example", "com"}, RrType::A).records,
+                testing::ElementsAre(wildcard));
+    EXPECT_THAT(find(lookup, {"a", "example", "com"}, RrType::Mx).records,
+                testing::IsEmpty());
+}
+
+TEST(MappedLookupTest, Authorities) {
+    DomainAuthority authority{.domain = {"mil"},
+                              .name = {"sri-nic", "arpa"},
+                              .ips = {0x1A000049, 0x0A000033},
+                              .ttl = 86400};
+    ZoneCompiler compiler;
+    compiler.add_authority(authority);
+    auto lookup = compile_and_open(compiler, "bighorn_authority.zimg");
+
+    EXPECT_THAT(lookup.find_authorities(Labels{"brl", "mil"}, RrClass::In),
+                testing::ElementsAre(authority));
+    EXPECT_THAT(lookup.find_authorities(Labels{"brl", "com"}, RrClass::In),
+                testing::IsEmpty());
+}
+
+TEST(MappedLookupTest, ServesResponder) {
+    auto a_record = Rr::a_record({"abcd", "com"}, 0x01020304, 86400);
+    ZoneCompiler compiler;
+    compiler.add_record(a_record);
+    Responder responder(compile_and_open(compiler, "bighorn_responder.zimg"));
+
+    Message query{.header = {.id = 1, .opcode = Opcode::Query, .rd = 0},
+                  .questions = {Question{.labels = {"abcd", "com"},
+                                         .qtype = RrType::A,
+                                         .qclass = RrClass::In}}};
+    asio::io_context io;
+    auto future =
+        asio::co_spawn(io, responder.respond(query), asio::use_future);
+    io.run();
+    auto result = future.get();
+    EXPECT_EQ(result.header.rcode, ResponseCode::Ok);
+    EXPECT_THAT(result.answers, testing::ElementsAre(a_record));
+}
+
+TEST(MappedLookupTest, RejectsInvalidImage) {
+    auto path = image_path("bighorn_invalid.zimg");
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "not a zone image";
+    }
+    MappedLookup lookup;
+    EXPECT_EQ(MappedLookup::open(path, lookup), ZoneError::InvalidImage);
+    std::filesystem::remove(path);
+
+    EXPECT_TRUE(MappedLookup::open(image_path("bighorn_missing.zimg"), lookup));
+}
+
+TEST(MappedLookupTest, ConcurrentWritesEachReplaceTheImage) {
+    auto dir = std::filesystem::temp_directory_path() / "bighorn_writes";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    auto path = (dir / "zone.zimg").string();
+
+    const int writer_count = 8;
+    std::vector<std::error_code> errors(writer_count);
+    {
+        std::vector<std::jthread> writers;
+        for (int i = 0; i < writer_count; ++i) {
+            writers.emplace_back([&, i] {
+                ZoneCompiler compiler;
+                for (uint32_t j = 0; j < 1000; ++j) {
+                    compiler.add_record(Rr::a_record(
+                        {"host" + std::to_string(j), "arpa"}, i, 300));
+                }
+                errors[i] = compiler.write(path);
+            });
+        }
+    }
+    EXPECT_THAT(errors, testing::Each(std::error_code{}));
+
+    // One writer's image, whole, and nothing left behind
+    MappedLookup lookup;
+    ASSERT_FALSE(MappedLookup::open(path, lookup));
+    auto found = find(lookup, {"host999", "arpa"}, RrType::A);
+    ASSERT_EQ(found.records.size(), 1);
+    EXPECT_EQ(std::distance(std::filesystem::directory_iterator(dir),
+                            std::filesystem::directory_iterator()),
+              1);
+    std::filesystem::remove_all(dir);
+}
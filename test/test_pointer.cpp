@@ -34,4 +34,21 @@ TEST(PointerTest, InfinitePointerLoop) {
     bighorn::DataBuffer buffer(bytes);
     auto err = bighorn::read_labels(buffer, labels);
     EXPECT_EQ(err, bighorn::MessageError::JumpLimit);
-}
\ No newline at end of file
+}
+TEST(PointerTest, ExpandsCompressedNamesInRdata) {
+    std::vector<uint8_t> bytes{7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3,
+                               'c', 'o', 'm', 0};
+    // NS record for a name at offset 0, pointing at "ns" + offset 0
+    auto record_start = bytes.size();
+    std::vector<uint8_t> record{0b11000000, 0, 0, 2, 0, 1, 0, 0, 0x0E, 0x10,
+                                0,          5, 2, 'n', 's', 0b11000000, 0};
+    bytes.insert(bytes.end(), record.begin(), record.end());
+
+    bighorn::DataBuffer buffer(bytes);
+    buffer.seek(record_start);
+    bighorn::Rr rr;
+    EXPECT_FALSE(bighorn::read_rr(buffer, rr));
+    EXPECT_EQ(rr, bighorn::Rr::ns_record({"example", "com"},
+                                         {"ns", "example", "com"}, 3600));
+    EXPECT_EQ(buffer.pos(), bytes.size());
+}
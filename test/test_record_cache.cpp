@@ -0,0 +1,173 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <bighorn/record_cache.hpp>
+
+using namespace bighorn;
+using namespace std::chrono_literals;
+
+TEST(RecordCacheTest, RewritesTtlAndExpires) {
+    RecordCache cache;
+    auto now = RecordCache::Clock::now();
+    Labels name{"www", "example", "com"};
+    cache.insert(name, RrType::A, RrClass::In,
+                 {Rr::a_record(name, 1, 300), Rr::a_record(name, 2, 60)}, now);
+
+    auto found = cache.find(name, RrType::A, RrClass::In, now + 20s);
+    ASSERT_TRUE(found.has_value());
+    EXPECT_THAT(found->records,
+                testing::ElementsAre(Rr::a_record(name, 1, 40),
+                                     Rr::a_record(name, 2, 40)));
+    Labels upper{"WWW", "Example", "com"};
+    EXPECT_TRUE(cache.find(upper, RrType::A, RrClass::In, now).has_value());
+    EXPECT_FALSE(cache.find(name, RrType::Aaaa, RrClass::In, now).has_value());
+    EXPECT_FALSE(cache.find(name, RrType::A, RrClass::In, now + 60s));
+
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.insertions, 1);
+}
+
+TEST(RecordCacheTest, CachesNegativeAnswersForSoaMinimum) {
+    RecordCache cache;
+    auto now = RecordCache::Clock::now();
+    auto soa = Rr::soa_record({"example", "com"}, {"ns", "example", "com"},
+                              {"admin", "example", "com"}, 1, 7200, 900,
+                              86400, 60, 300);
+    Labels missing{"missing", "example", "com"};
+    cache.insert_negative(missing, RrType::A, RrClass::In,
+                          ResponseCode::NameError, {soa}, now);
+    Labels www{"www", "example", "com"};
+    cache.insert_negative(www, RrType::Aaaa, RrClass::In, ResponseCode::Ok,
+                          {soa}, now);
+
+    // NXDOMAIN covers every type and every name below
+    Labels below{"a", "b", "missing", "example", "com"};
+    for (const auto &labels : {missing, below}) {
+        auto found = cache.find(labels, RrType::Mx, RrClass::In, now + 10s);
+        ASSERT_TRUE(found.has_value());
+        EXPECT_EQ(found->rcode, ResponseCode::NameError);
+        EXPECT_TRUE(found->records.empty());
+        ASSERT_EQ(found->authorities.size(), 1);
+        EXPECT_EQ(found->authorities[0].ttl, 50);
+    }
+    Labels parent{"example", "com"};
+    EXPECT_FALSE(cache.find(parent, RrType::A, RrClass::In, now));
+
+    // NODATA covers only its own type
+    auto nodata = cache.find(www, RrType::Aaaa, RrClass::In, now);
+    ASSERT_TRUE(nodata.has_value());
+    EXPECT_EQ(nodata->rcode, ResponseCode::Ok);
+    EXPECT_TRUE(nodata->records.empty());
+    EXPECT_FALSE(cache.find(www, RrType::A, RrClass::In, now));
+
+    // Expires after the SOA minimum rather than the SOA's own TTL
+    EXPECT_FALSE(cache.find(missing, RrType::A, RrClass::In, now + 60s));
+    EXPECT_EQ(cache.stats().negative_hits, 3);
+}
+
+TEST(RecordCacheTest, NegativeAnswerWithoutSoaIsNotCached) {
+    RecordCache cache;
+    auto now = RecordCache::Clock::now();
+    Labels missing{"missing", "example", "com"};
+    cache.insert_negative(missing, RrType::A, RrClass::In,
+                          ResponseCode::NameError, {}, now);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(RecordCacheTest, NegativeAnswerThroughChainIsCachedUnderTheAlias) {
+    RecordCache cache;
+    auto now = RecordCache::Clock::now();
+    auto soa = Rr::soa_record({"example", "com"}, {"ns", "example", "com"},
+                              {"admin", "example", "com"}, 1, 7200, 900,
+                              86400, 60, 300);
+    Labels alias{"alias", "example", "com"};
+    auto cname = Rr::cname_record(alias, {"missing", "example", "com"}, 20);
+    cache.insert_negative(alias, RrType::A, RrClass::In,
+                          ResponseCode::NameError, {soa}, now, {cname});
+
+    auto found = cache.find(alias, RrType::A, RrClass::In, now + 5s);
+    ASSERT_TRUE(found.has_value());
+    EXPECT_EQ(found->rcode, ResponseCode::NameError);
+    ASSERT_EQ(found->records.size(), 1);
+    EXPECT_EQ(found->records[0].to_rr().rdata, cname.rdata);
+    EXPECT_EQ(found->records[0].ttl, 15);
+
+    // The alias itself exists, so other types and names below are unknown
+    EXPECT_FALSE(cache.find(alias, RrType::Cname, RrClass::In, now));
+    Labels below{"www", "alias", "example", "com"};
+    EXPECT_FALSE(cache.find(below, RrType::A, RrClass::In, now));
+    // Expires with the CNAME rather than the SOA minimum
+    EXPECT_FALSE(cache.find(alias, RrType::A, RrClass::In, now + 20s));
+}
+
+TEST(RecordCacheTest, AsksForPrefetchOfHotEntriesNearExpiry) {
+    RecordCache cache({.prefetch_fraction = 0.1, .prefetch_min_hits = 3});
+    auto now = RecordCache::Clock::now();
+    Labels hot{"hot", "example", "com"};
+    Labels cold{"cold", "example", "com"};
+    for (const auto &name : {hot, cold}) {
+        cache.insert(name, RrType::A, RrClass::In, {Rr::a_record(name, 1, 100)},
+                     now);
+    }
+    for (int i = 0; i < 2; ++i) {
+        auto found = cache.find(hot, RrType::A, RrClass::In, now);
+        EXPECT_FALSE(found->prefetch);
+    }
+
+    // Only the first hit in the last tenth of the TTL asks
+    EXPECT_TRUE(cache.find(hot, RrType::A, RrClass::In, now + 95s)->prefetch);
+    EXPECT_FALSE(cache.find(hot, RrType::A, RrClass::In, now + 96s)->prefetch);
+    EXPECT_FALSE(
+        cache.find(cold, RrType::A, RrClass::In, now + 95s)->prefetch);
+    EXPECT_EQ(cache.stats().prefetches, 1);
+
+    // A refreshed entry starts counting again
+    cache.insert(hot, RrType::A, RrClass::In, {Rr::a_record(hot, 1, 100)},
+                 now + 96s);
+    EXPECT_FALSE(
+        cache.find(hot, RrType::A, RrClass::In, now + 191s)->prefetch);
+}
+
+TEST(RecordCacheTest, ServesStaleWithinWindow) {
+    RecordCache cache({.stale_window = 3600s});
+    auto now = RecordCache::Clock::now();
+    Labels name{"www", "example", "com"};
+    cache.insert(name, RrType::A, RrClass::In, {Rr::a_record(name, 1, 300)},
+                 now);
+
+    EXPECT_FALSE(cache.find(name, RrType::A, RrClass::In, now + 400s));
+    auto stale = cache.find_stale(name, RrType::A, RrClass::In, now + 400s);
+    ASSERT_TRUE(stale.has_value());
+    EXPECT_THAT(stale->records,
+                testing::ElementsAre(Rr::a_record(name, 1, 30)));
+    EXPECT_FALSE(cache.find_stale(name, RrType::A, RrClass::In, now + 3900s));
+    EXPECT_EQ(cache.stats().stale_hits, 1);
+}
+
+TEST(RecordCacheTest, ScanDoesNotEvictPopularEntries) {
+    RecordCache cache({.capacity = 100, .shard_count = 1});
+    auto now = RecordCache::Clock::now();
+    auto name = [](const std::string &prefix, int i) {
+        return Labels{prefix + std::to_string(i), "com"};
+    };
+    for (int i = 0; i < 50; ++i) {
+        cache.insert(name("hot", i), RrType::A, RrClass::In,
+                     {Rr::a_record(name("hot", i), i, 300)}, now);
+        for (int hit = 0; hit < 2; ++hit) {
+            ASSERT_TRUE(
+                cache.find(name("hot", i), RrType::A, RrClass::In, now));
+        }
+    }
+    for (int i = 0; i < 10000; ++i) {
+        cache.insert(name("scan", i), RrType::A, RrClass::In,
+                     {Rr::a_record(name("scan", i), i, 300)}, now);
+    }
+    EXPECT_LE(cache.size(), 100);
+    for (int i = 0; i < 50; ++i) {
+        EXPECT_TRUE(cache.find(name("hot", i), RrType::A, RrClass::In, now))
+            << i;
+    }
+    EXPECT_GT(cache.stats().evictions, 9000);
+}
@@ -2,9 +2,12 @@
 #include <gtest/gtest.h>
 
 #include <asio.hpp>
+#include <bighorn/bulk_resolve.hpp>
+#include <bighorn/iterative_resolver.hpp>
 #include <bighorn/recursive_lookup.hpp>
 #include <bighorn/resolver.hpp>
 #include <bighorn/static_lookup.hpp>
+#include <bighorn/tcp.hpp>
 #include <bighorn/udp.hpp>
 #include <functional>
 #include <memory>
@@ -137,7 +140,10 @@ TEST(ResolutionTest, NoInfiniteRecursion) {
     asio::co_spawn(io,
                    test_resolver.resolve(example, bighorn::RrType::All,
                                          bighorn::RrClass::In, false, 5s),
-                   [&](std::exception_ptr, auto) {
+                   [&](std::exception_ptr ex, auto resolution) {
+                       // Reported as an error, not thrown
+                       EXPECT_FALSE(ex);
+                       EXPECT_TRUE(resolution.err);
                        cancel_server.emit(asio::cancellation_type::terminal);
                    });
     io.run();
@@ -181,4 +187,1078 @@ TEST(ResolutionTest, ResponderWithRecursiveLookup) {
     io.run();
 }
 
-// TODO Test only one server selected
\ No newline at end of file
+TEST(ResolutionTest, SlowUpstreamDoesNotBlockOthers) {
+    asio::io_context io;
+    auto fast_record =
+        bighorn::Rr::a_record({"fast", "com"}, 0x01020304, 86400);
+    auto fast_server = make_dns_server(io, {fast_record});
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, fast_server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    // Accepts queries but never answers
+    asio::ip::udp::socket silent_server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    auto server_ref = [](int port) {
+        return bighorn::DnsServer{
+            .ip = asio::ip::address_v4::loopback().to_uint(),
+            .port = port,
+            .conn_method = bighorn::ServerConnMethod::Udp,
+            .recursive = false};
+    };
+    bighorn::DefaultResolver slow_resolver(
+        io, {server_ref(silent_server.local_endpoint().port())});
+    bighorn::DefaultResolver fast_resolver(io,
+                                           {server_ref(fast_server.port())});
+
+    // Everything runs on this thread, so a blocking upstream query would
+    // hold up every other resolution
+    const int fast_count = 20;
+    int fast_answers = 0;
+    bool slow_done = false;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration fast_elapsed{};
+    asio::co_spawn(io,
+                   slow_resolver.resolve({"slow", "com"}, bighorn::RrType::A,
+                                         bighorn::RrClass::In, false, 200ms),
+                   [&](std::exception_ptr, auto) {
+                       slow_done = true;
+                       if (fast_answers == fast_count) {
+                           cancel_server.emit(
+                               asio::cancellation_type::terminal);
+                       }
+                   });
+    for (int i = 0; i < fast_count; ++i) {
+        asio::co_spawn(
+            io,
+            fast_resolver.resolve({"fast", "com"}, bighorn::RrType::A,
+                                  bighorn::RrClass::In, false, 5s),
+            [&](std::exception_ptr, auto resolution) {
+                EXPECT_FALSE(slow_done);
+                EXPECT_THAT(resolution.records,
+                            testing::ElementsAre(fast_record));
+                if (++fast_answers == fast_count) {
+                    fast_elapsed = std::chrono::steady_clock::now() - start;
+                    if (slow_done) {
+                        cancel_server.emit(asio::cancellation_type::terminal);
+                    }
+                }
+            });
+    }
+    io.run();
+    EXPECT_EQ(fast_answers, fast_count);
+    EXPECT_TRUE(slow_done);
+    EXPECT_LT(fast_elapsed, 200ms);
+}
+
+asio::awaitable<void> count_datagrams(asio::ip::udp::socket& socket,
+                                      int& count) {
+    std::array<uint8_t, 512> data{};
+    asio::ip::udp::endpoint sender;
+    while (true) {
+        auto [err, _] = co_await socket.async_receive_from(
+            asio::buffer(data), sender, asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            co_return;
+        }
+        ++count;
+    }
+}
+
+TEST(ResolutionTest, HedgesToNextServerAndLearnsBest) {
+    asio::io_context io;
+    auto record = bighorn::Rr::a_record({"hedge", "com"}, 0x01020304, 86400);
+    auto fast_server = make_dns_server(io, {record});
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, fast_server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    asio::ip::udp::socket silent_server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    int silent_queries = 0;
+    asio::co_spawn(io, count_datagrams(silent_server, silent_queries),
+                   asio::detached);
+
+    auto server_ref = [](int port) {
+        return bighorn::DnsServer{
+            .ip = asio::ip::address_v4::loopback().to_uint(),
+            .port = port,
+            .conn_method = bighorn::ServerConnMethod::Udp,
+            .recursive = false};
+    };
+    // The silent server is listed first, so the first query goes there
+    bighorn::DefaultResolver resolver(
+        io, {server_ref(silent_server.local_endpoint().port()),
+             server_ref(fast_server.port())});
+
+    std::vector<std::chrono::steady_clock::duration> elapsed;
+    auto resolve_twice = [&]() -> asio::awaitable<void> {
+        for (int i = 0; i < 2; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            auto resolution = co_await resolver.resolve(
+                {"hedge", "com"}, bighorn::RrType::A, bighorn::RrClass::In,
+                false, 5s);
+            elapsed.push_back(std::chrono::steady_clock::now() - start);
+            EXPECT_THAT(resolution.records, testing::ElementsAre(record));
+        }
+        cancel_server.emit(asio::cancellation_type::terminal);
+        silent_server.close();
+    };
+    asio::co_spawn(io, resolve_twice(), asio::detached);
+    io.run();
+
+    ASSERT_EQ(elapsed.size(), 2);
+    // Hedged after the initial delay instead of waiting out the timeout
+    EXPECT_LT(elapsed[0], 1s);
+    // The fast server is now known to be best and answers alone
+    EXPECT_LT(elapsed[1], 100ms);
+    EXPECT_EQ(silent_queries, 1);
+}
+
+// Answers the first queries with SERVFAIL and the rest with an A record
+asio::awaitable<void> recovering_server(asio::ip::udp::socket& socket,
+                                        int failures) {
+    std::array<uint8_t, 512> data{};
+    asio::ip::udp::endpoint client;
+    while (true) {
+        auto [err, size] = co_await socket.async_receive_from(
+            asio::buffer(data), client, asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            co_return;
+        }
+        bighorn::DataBuffer buffer(data, size);
+        bighorn::Message reply;
+        EXPECT_FALSE(bighorn::read_message(buffer, reply));
+        reply.header.qr = 1;
+        if (failures-- > 0) {
+            reply.header.rcode = bighorn::ResponseCode::ServerFailure;
+        } else {
+            reply.answers = {bighorn::Rr::a_record(
+                reply.questions.at(0).labels, 0x01020304, 300)};
+            reply.header.ancount = 1;
+        }
+        co_await socket.async_send_to(asio::buffer(reply.bytes()), client,
+                                      asio::use_awaitable);
+    }
+}
+
+TEST(ResolutionTest, FailingServerIsNotDroppedForGood) {
+    asio::io_context io;
+    asio::ip::udp::socket server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    asio::co_spawn(io, recovering_server(server, 3), asio::detached);
+    bighorn::DefaultResolver resolver(
+        io, {bighorn::DnsServer{
+                .ip = asio::ip::address_v4::loopback().to_uint(),
+                .port = server.local_endpoint().port(),
+                .conn_method = bighorn::ServerConnMethod::Udp,
+                .recursive = false}});
+
+    bool first_failed = false;
+    std::vector<bighorn::Rr> second_records;
+    auto resolve_twice = [&]() -> asio::awaitable<void> {
+        auto first =
+            co_await resolver.resolve({"flaky", "com"}, bighorn::RrType::A,
+                                      bighorn::RrClass::In, false, 1s);
+        first_failed = first.err == bighorn::ResolutionError::RemoteFailure &&
+                       first.rcode == bighorn::ResponseCode::ServerFailure;
+        auto resolution =
+            co_await resolver.resolve({"flaky", "com"}, bighorn::RrType::A,
+                                      bighorn::RrClass::In, false, 1s);
+        second_records = resolution.records;
+        server.close();
+    };
+    asio::co_spawn(io, resolve_twice(), asio::detached);
+    io.run();
+
+    // Backing off after three failures, but as the only server it is still
+    // tried and answers again
+    EXPECT_TRUE(first_failed);
+    EXPECT_THAT(second_records, testing::ElementsAre(bighorn::Rr::a_record(
+                                    {"flaky", "com"}, 0x01020304, 300)));
+}
+
+TEST(UpstreamHealthTest, BacksOffAndProbes) {
+    bighorn::UpstreamHealth health;
+    auto now = bighorn::UpstreamHealth::Clock::now();
+    EXPECT_EQ(health.expected_rtt(100ms), 100ms);
+    health.record_success(10ms);
+    EXPECT_EQ(health.expected_rtt(100ms), 30ms);
+
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_FALSE(health.backing_off(now));
+        health.record_failure(now);
+    }
+    EXPECT_TRUE(health.backing_off(now));
+    EXPECT_FALSE(health.claim_probe(now));
+
+    // One probe once the backoff ends, and a failed probe doubles it
+    EXPECT_TRUE(health.claim_probe(now + 1s));
+    EXPECT_FALSE(health.claim_probe(now + 1s));
+    EXPECT_TRUE(health.backing_off(now + 1s));
+    health.record_failure(now + 1s);
+    EXPECT_TRUE(health.backing_off(now + 2s));
+    EXPECT_FALSE(health.backing_off(now + 3s));
+
+    // A success readmits the server
+    EXPECT_TRUE(health.claim_probe(now + 3s));
+    health.record_success(10ms);
+    EXPECT_FALSE(health.backing_off(now + 3s));
+}
+
+TEST(RateLimiterTest, SpacesQueriesAfterBurst) {
+    auto now = bighorn::RateLimiter::Clock::now();
+    bighorn::RateLimiter limiter(100);
+    // A tenth of a second's worth goes out at once
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(limiter.reserve(now), 0ms);
+    }
+    EXPECT_EQ(limiter.reserve(now), 10ms);
+    EXPECT_EQ(limiter.reserve(now), 20ms);
+    // The burst allowance is regained as time passes
+    EXPECT_EQ(limiter.reserve(now + 1s), 0ms);
+
+    bighorn::RateLimiter unlimited(0);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(unlimited.reserve(now), 0ms);
+    }
+}
+
+// Answers every query with the same reply and counts the queries
+class CountingResolver : public bighorn::Resolver {
+   public:
+    explicit CountingResolver(
+        std::vector<bighorn::Rr> records,
+        bighorn::ResponseCode rcode = bighorn::ResponseCode::Ok,
+        std::vector<bighorn::Rr> authorities = {},
+        std::chrono::milliseconds delay = 0ms)
+        : reply_{.records = std::move(records),
+                 .rcode = rcode,
+                 .authorities = std::move(authorities)},
+          delay_(delay) {}
+
+    asio::awaitable<bighorn::Resolution> resolve(
+        bighorn::Labels, bighorn::RrType, bighorn::RrClass, bool,
+        std::chrono::milliseconds) override {
+        ++*count_;
+        if (delay_ > 0ms) {
+            asio::steady_timer timer(co_await asio::this_coro::executor,
+                                     delay_);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+        co_return reply_;
+    }
+
+    [[nodiscard]] int count() const { return *count_; }
+
+   private:
+    bighorn::Resolution reply_;
+    std::chrono::milliseconds delay_;
+    std::shared_ptr<int> count_ = std::make_shared<int>(0);
+};
+
+TEST(ResolutionTest, RecursiveLookupCachesAnswers) {
+    asio::io_context io;
+    auto record = bighorn::Rr::a_record({"cached", "com"}, 0x01020304, 300);
+    CountingResolver resolver({record});
+    bighorn::RecursiveLookup<CountingResolver> lookup(io, resolver);
+
+    auto lookup_twice = [&]() -> asio::awaitable<void> {
+        bighorn::Labels name{"cached", "com"};
+        for (int i = 0; i < 2; ++i) {
+            auto found = co_await lookup.find_records(
+                name, bighorn::RrType::A, bighorn::RrClass::In, true);
+            EXPECT_FALSE(found.err);
+            EXPECT_THAT(found.records.to_rrs(),
+                        testing::ElementsAre(testing::Field(
+                            &bighorn::Rr::rdata, record.rdata)));
+        }
+    };
+    asio::co_spawn(io, lookup_twice(), asio::detached);
+    io.run();
+    EXPECT_EQ(resolver.count(), 1);
+    EXPECT_EQ(lookup.cache().stats().hits, 1);
+    EXPECT_EQ(lookup.cache().stats().misses, 1);
+}
+
+// Answers MX queries at once and address queries only after a second
+class SlowGlueResolver : public bighorn::Resolver {
+   public:
+    asio::awaitable<bighorn::Resolution> resolve(
+        bighorn::Labels labels, bighorn::RrType qtype, bighorn::RrClass,
+        bool, std::chrono::milliseconds) override {
+        if (qtype == bighorn::RrType::Mx) {
+            co_return bighorn::Resolution{
+                .records = {bighorn::Rr::mx_record(
+                    std::move(labels), 10, {"mail", "slow", "com"}, 300)},
+                .rcode = bighorn::ResponseCode::Ok};
+        }
+        asio::steady_timer timer(co_await asio::this_coro::executor, 1s);
+        co_await timer.async_wait(asio::use_awaitable);
+        co_return bighorn::Resolution{
+            .records = {bighorn::Rr::a_record(std::move(labels), 0x01020304,
+                                              300)},
+            .rcode = bighorn::ResponseCode::Ok};
+    }
+};
+
+TEST(ResolutionTest, SlowAdditionalAddressesDoNotHoldUpTheAnswer) {
+    asio::io_context io;
+    bighorn::RecursiveLookup<SlowGlueResolver> lookup(
+        io, SlowGlueResolver{}, 5s, nullptr, {.additional_budget = 100ms});
+
+    bighorn::FoundRecords found;
+    auto start = std::chrono::steady_clock::now();
+    asio::co_spawn(io,
+                   lookup.find_records(bighorn::Labels{"slow", "com"},
+                                       bighorn::RrType::Mx,
+                                       bighorn::RrClass::In, true),
+                   [&](std::exception_ptr ex, bighorn::FoundRecords result) {
+                       EXPECT_FALSE(ex);
+                       found = std::move(result);
+                       io.stop();
+                   });
+    io.run();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 500ms);
+    EXPECT_FALSE(found.err);
+    EXPECT_EQ(found.records.size(), 1);
+    EXPECT_TRUE(found.additional.empty());
+}
+
+// Answers MX queries with two exchanges, offering the addresses of both,
+// and counts the address queries
+class OfferingResolver : public bighorn::Resolver {
+   public:
+    asio::awaitable<bighorn::Resolution> resolve(
+        bighorn::Labels labels, bighorn::RrType qtype, bighorn::RrClass,
+        bool, std::chrono::milliseconds) override {
+        if (qtype == bighorn::RrType::Mx) {
+            co_return bighorn::Resolution{
+                .records = {bighorn::Rr::mx_record(
+                                labels, 10, {"mail", "example", "com"}, 300),
+                            bighorn::Rr::mx_record(
+                                labels, 20, {"mx", "other", "net"}, 300)},
+                .rcode = bighorn::ResponseCode::Ok,
+                .additional = {bighorn::Rr::a_record(
+                                   {"mail", "example", "com"}, 1, 300),
+                               bighorn::Rr::a_record({"mx", "other", "net"},
+                                                     2, 300)}};
+        }
+        if (qtype == bighorn::RrType::A) {
+            ++*address_queries_;
+            co_return bighorn::Resolution{
+                .records = {bighorn::Rr::a_record(std::move(labels), 3, 300)},
+                .rcode = bighorn::ResponseCode::Ok};
+        }
+        co_return bighorn::Resolution{.records = {},
+                                      .rcode = bighorn::ResponseCode::Ok};
+    }
+
+    [[nodiscard]] int address_queries() const { return *address_queries_; }
+
+   private:
+    std::shared_ptr<int> address_queries_ = std::make_shared<int>(0);
+};
+
+TEST(ResolutionTest, OfferedAddressesWithinTheZoneAreCached) {
+    asio::io_context io;
+    OfferingResolver resolver;
+    bighorn::RecursiveLookup<OfferingResolver> lookup(io, resolver);
+
+    auto run = [&]() -> asio::awaitable<void> {
+        auto found = co_await lookup.find_records(
+            bighorn::Labels{"example", "com"}, bighorn::RrType::Mx,
+            bighorn::RrClass::In, true);
+        EXPECT_FALSE(found.err);
+        EXPECT_EQ(found.additional.size(), 2);
+
+        // Only the exchange within example.com's parent zone was cached
+        found = co_await lookup.find_records(
+            bighorn::Labels{"mail", "example", "com"}, bighorn::RrType::A,
+            bighorn::RrClass::In, true);
+        auto offered =
+            bighorn::Rr::a_record({"mail", "example", "com"}, 1, 300);
+        EXPECT_THAT(found.records.to_rrs(),
+                    testing::ElementsAre(testing::Field(&bighorn::Rr::rdata,
+                                                        offered.rdata)));
+        EXPECT_EQ(resolver.address_queries(), 0);
+        found = co_await lookup.find_records(
+            bighorn::Labels{"mx", "other", "net"}, bighorn::RrType::A,
+            bighorn::RrClass::In, true);
+        EXPECT_EQ(resolver.address_queries(), 1);
+    };
+    asio::co_spawn(io, run(), asio::detached);
+    io.run();
+    // Neither offered address was refreshed in the background
+    EXPECT_EQ(lookup.prefetch_stats().started, 0);
+}
+
+TEST(ResolutionTest, NegativeAnswersAreCachedBelowTheName) {
+    asio::io_context io;
+    auto soa = bighorn::Rr::soa_record(
+        {"example", "com"}, {"ns", "example", "com"},
+        {"admin", "example", "com"}, 1, 7200, 900, 86400, 60, 300);
+    CountingResolver resolver({}, bighorn::ResponseCode::NameError, {soa});
+    bighorn::RecursiveLookup<CountingResolver> lookup(io, resolver);
+    bighorn::Responder<decltype(lookup)> responder(std::move(lookup));
+
+    std::vector<bighorn::Message> responses;
+    auto ask = [&]() -> asio::awaitable<void> {
+        for (const auto& labels :
+             {bighorn::Labels{"typo", "example", "com"},
+              bighorn::Labels{"www", "typo", "example", "com"}}) {
+            bighorn::Message query{
+                .header = {.id = 1, .opcode = bighorn::Opcode::Query, .rd = 1},
+                .questions = {bighorn::Question{
+                    .labels = labels,
+                    .qtype = bighorn::RrType::A,
+                    .qclass = bighorn::RrClass::In}}};
+            responses.push_back(co_await responder.respond(query));
+        }
+    };
+    asio::co_spawn(io, ask(), asio::detached);
+    io.run();
+
+    // One upstream query answers both, with no follow-up lookup
+    EXPECT_EQ(resolver.count(), 1);
+    ASSERT_EQ(responses.size(), 2);
+    for (const auto& response : responses) {
+        EXPECT_EQ(response.header.rcode, bighorn::ResponseCode::NameError);
+        EXPECT_THAT(response.authorities,
+                    testing::ElementsAre(testing::Field(&bighorn::Rr::rdata,
+                                                        soa.rdata)));
+    }
+}
+
+TEST(ResolutionTest, NegativeAnswersAreCachedUnderTheAlias) {
+    asio::io_context io;
+    auto soa = bighorn::Rr::soa_record(
+        {"example", "com"}, {"ns", "example", "com"},
+        {"admin", "example", "com"}, 1, 7200, 900, 86400, 60, 300);
+    bighorn::Labels alias{"alias", "example", "com"};
+    bighorn::Labels target{"target", "example", "com"};
+    auto cname = bighorn::Rr::cname_record(alias, target, 30);
+    CountingResolver resolver({cname}, bighorn::ResponseCode::Ok, {soa});
+    bighorn::RecursiveLookup<CountingResolver> lookup(io, resolver);
+
+    auto ask = [&]() -> asio::awaitable<void> {
+        for (const auto& labels : {alias, target, alias}) {
+            auto found = co_await lookup.find_records(
+                labels, bighorn::RrType::Aaaa, bighorn::RrClass::In, true);
+            if (labels == target) {
+                EXPECT_EQ(found.err, bighorn::ResolutionError::NoData);
+                EXPECT_TRUE(found.records.empty());
+            } else {
+                EXPECT_FALSE(found.err);
+                EXPECT_THAT(found.records.to_rrs(),
+                            testing::ElementsAre(testing::Field(
+                                &bighorn::Rr::rdata, cname.rdata)));
+            }
+            EXPECT_EQ(found.authorities.size(), 1);
+        }
+    };
+    asio::co_spawn(io, ask(), asio::detached);
+    io.run();
+
+    // The target's NODATA and the alias's chain both come from one query
+    EXPECT_EQ(resolver.count(), 1);
+    EXPECT_EQ(lookup.cache().stats().negative_hits, 2);
+}
+
+TEST(ResolutionTest, ConcurrentIdenticalQueriesShareOneResolution) {
+    asio::io_context io;
+    auto record = bighorn::Rr::a_record({"herd", "com"}, 0x01020304, 300);
+    CountingResolver resolver({record}, bighorn::ResponseCode::Ok, {}, 50ms);
+    const size_t max_waiters = 40;
+    bighorn::RecursiveLookup<CountingResolver> lookup(
+        io, resolver, 5s, nullptr, {.max_waiters = max_waiters});
+
+    const size_t query_count = 50;
+    size_t answered = 0;
+    size_t turned_away = 0;
+    for (size_t i = 0; i < query_count; ++i) {
+        asio::co_spawn(
+            io,
+            [&]() -> asio::awaitable<void> {
+                bighorn::Labels name{"herd", "com"};
+                auto found = co_await lookup.find_records(
+                    name, bighorn::RrType::A, bighorn::RrClass::In, true);
+                if (found.err == bighorn::ResolutionError::TooManyWaiters) {
+                    ++turned_away;
+                    co_return;
+                }
+                EXPECT_FALSE(found.err);
+                EXPECT_THAT(found.records, testing::ElementsAre(record));
+                ++answered;
+            },
+            asio::detached);
+    }
+    io.run();
+    EXPECT_EQ(resolver.count(), 1);
+    EXPECT_EQ(answered, max_waiters);
+    EXPECT_EQ(turned_away, query_count - max_waiters);
+    EXPECT_EQ(lookup.coalescer().coalesced_count(), max_waiters - 1);
+}
+
+TEST(ResolutionTest, HotEntriesAreRefreshedBeforeExpiry) {
+    asio::io_context io;
+    auto record = bighorn::Rr::a_record({"hot", "com"}, 0x01020304, 300);
+    CountingResolver resolver({record});
+    // Every hit counts as close to expiry
+    auto cache = std::make_shared<bighorn::RecordCache>(
+        bighorn::RecordCacheOptions{.prefetch_fraction = 1.1,
+                                    .prefetch_min_hits = 1});
+    bighorn::RecursiveLookup<CountingResolver> lookup(io, resolver, 5s, cache);
+
+    auto lookup_twice = [&]() -> asio::awaitable<void> {
+        bighorn::Labels name{"hot", "com"};
+        for (int i = 0; i < 2; ++i) {
+            auto found = co_await lookup.find_records(
+                name, bighorn::RrType::A, bighorn::RrClass::In, true);
+            EXPECT_FALSE(found.err);
+        }
+    };
+    asio::co_spawn(io, lookup_twice(), asio::detached);
+    io.run();
+
+    // The hit was answered from the cache and refreshed in the background
+    EXPECT_EQ(resolver.count(), 2);
+    EXPECT_EQ(cache->stats().hits, 1);
+    auto prefetches = lookup.prefetch_stats();
+    EXPECT_EQ(prefetches.started, 1);
+    EXPECT_EQ(prefetches.failed, 0);
+}
+
+TEST(ResolutionTest, SlowRefreshIsAnsweredFromStaleData) {
+    asio::io_context io;
+    bighorn::Labels name{"stale", "com"};
+    auto old_record = bighorn::Rr::a_record(name, 0x01020304, 10);
+    auto new_record = bighorn::Rr::a_record(name, 0x05060708, 300);
+    auto cache = std::make_shared<bighorn::RecordCache>();
+    cache->insert(name, bighorn::RrType::A, bighorn::RrClass::In, {old_record},
+                  bighorn::RecordCache::Clock::now() - 20s);
+    CountingResolver resolver({new_record}, bighorn::ResponseCode::Ok, {},
+                              200ms);
+    bighorn::RecursiveLookup<CountingResolver> lookup(
+        io, resolver, 5s, cache, {.stale_answer_budget = 50ms});
+
+    std::chrono::steady_clock::duration elapsed{};
+    auto ask = [&]() -> asio::awaitable<void> {
+        auto start = std::chrono::steady_clock::now();
+        auto found = co_await lookup.find_records(name, bighorn::RrType::A,
+                                                  bighorn::RrClass::In, true);
+        elapsed = std::chrono::steady_clock::now() - start;
+        EXPECT_FALSE(found.err);
+        EXPECT_THAT(found.records,
+                    testing::ElementsAre(bighorn::Rr::a_record(
+                        name, 0x01020304, 30)));
+    };
+    asio::co_spawn(io, ask(), asio::detached);
+    io.run();
+
+    EXPECT_LT(elapsed, 150ms);
+    // The refresh finished in the background
+    EXPECT_EQ(resolver.count(), 1);
+    auto refreshed = cache->find(name, bighorn::RrType::A,
+                                 bighorn::RrClass::In,
+                                 bighorn::RecordCache::Clock::now());
+    ASSERT_TRUE(refreshed.has_value());
+    EXPECT_THAT(refreshed->records.to_rrs(),
+                testing::ElementsAre(testing::Field(&bighorn::Rr::rdata,
+                                                    new_record.rdata)));
+}
+
+// The root, a TLD server and an authoritative server listen on their own
+// loopback addresses, sharing one port as name servers share port 53
+TEST(ResolutionTest, IteratesFromRootHints) {
+    asio::io_context io;
+    bighorn::StaticLookup root_zone;
+    for (const auto* tld : {"com", "net"}) {
+        root_zone.add_authority({.domain = {tld},
+                                 .name = {"ns", "nic", "com"},
+                                 .ips = {0x7F000002},
+                                 .ttl = 86400});
+    }
+    // The example.com server is only known by name
+    bighorn::StaticLookup tld_zone;
+    tld_zone.add_authority({.domain = {"example", "com"},
+                            .name = {"ns", "example", "net"},
+                            .ips = {},
+                            .ttl = 86400});
+    tld_zone.add_record(
+        bighorn::Rr::a_record({"ns", "example", "net"}, 0x7F000003, 86400));
+    auto alias_record = bighorn::Rr::cname_record(
+        {"alias", "example", "com"}, {"www", "example", "com"}, 300);
+    auto www_record =
+        bighorn::Rr::a_record({"www", "example", "com"}, 0x01020304, 300);
+    bighorn::StaticLookup example_zone;
+    example_zone.add_record(alias_record);
+    example_zone.add_record(www_record);
+
+    auto loopback = [](const char* ip, int port) {
+        return asio::ip::udp::endpoint(asio::ip::make_address_v4(ip), port);
+    };
+    ServerType root(io, loopback("127.0.0.1", 0),
+                    bighorn::Responder(std::move(root_zone)));
+    auto port = root.port();
+    ServerType tld(io, loopback("127.0.0.2", port),
+                   bighorn::Responder(std::move(tld_zone)));
+    ServerType example(io, loopback("127.0.0.3", port),
+                       bighorn::Responder(std::move(example_zone)));
+    std::array<asio::cancellation_signal, 3> cancel_servers;
+    std::jthread thread([&] {
+        std::array servers{&root, &tld, &example};
+        for (size_t i = 0; i < servers.size(); ++i) {
+            asio::co_spawn(
+                io, servers[i]->start(),
+                asio::bind_cancellation_slot(cancel_servers[i].slot(),
+                                             asio::detached));
+        }
+        io.run();
+    });
+
+    auto root_hint =
+        bighorn::DnsServer{.ip = 0x7F000001,
+                           .port = port,
+                           .conn_method = bighorn::ServerConnMethod::Udp,
+                           .recursive = false};
+    bighorn::IterativeResolver resolver(io, {root_hint}, port);
+    std::vector<bighorn::Rr> records;
+    asio::co_spawn(io,
+                   resolver.resolve({"alias", "example", "com"},
+                                    bighorn::RrType::A, bighorn::RrClass::In,
+                                    true, 5s),
+                   [&](std::exception_ptr ex, auto resolution) {
+                       EXPECT_FALSE(ex);
+                       records = resolution.records;
+                       for (auto& cancel : cancel_servers) {
+                           cancel.emit(asio::cancellation_type::terminal);
+                       }
+                   });
+    io.run();
+    EXPECT_THAT(records, testing::ElementsAre(alias_record, www_record));
+    // com, net and example.com
+    EXPECT_EQ(resolver.cached_zone_count(), 3U);
+}
+
+// As above, with the example.com server only reachable over IPv6
+TEST(ResolutionTest, GluelessNameServerIsFoundOverIpv6) {
+    asio::io_context io;
+    bighorn::StaticLookup root_zone;
+    for (const auto* tld : {"com", "net"}) {
+        root_zone.add_authority({.domain = {tld},
+                                 .name = {"ns", "nic", "com"},
+                                 .ips = {0x7F000002},
+                                 .ttl = 86400});
+    }
+    bighorn::StaticLookup tld_zone;
+    tld_zone.add_authority({.domain = {"example", "com"},
+                            .name = {"ns", "example", "net"},
+                            .ips = {},
+                            .ttl = 86400});
+    tld_zone.add_record(bighorn::Rr::aaaa_record(
+        {"ns", "example", "net"},
+        asio::ip::address_v6::loopback().to_bytes(), 86400));
+    auto www_record =
+        bighorn::Rr::a_record({"www", "example", "com"}, 0x01020304, 300);
+    bighorn::StaticLookup example_zone;
+    example_zone.add_record(www_record);
+
+    auto loopback = [](const char* ip, int port) {
+        return asio::ip::udp::endpoint(asio::ip::make_address(ip), port);
+    };
+    ServerType root(io, loopback("127.0.0.1", 0),
+                    bighorn::Responder(std::move(root_zone)));
+    auto port = root.port();
+    ServerType tld(io, loopback("127.0.0.2", port),
+                   bighorn::Responder(std::move(tld_zone)));
+    std::optional<ServerType> example;
+    try {
+        example.emplace(io, loopback("::1", port),
+                        bighorn::Responder(std::move(example_zone)));
+    } catch (const std::system_error&) {
+        GTEST_SKIP() << "No IPv6 loopback";
+    }
+    std::array<asio::cancellation_signal, 3> cancel_servers;
+    std::jthread thread([&] {
+        std::array servers{&root, &tld, &*example};
+        for (size_t i = 0; i < servers.size(); ++i) {
+            asio::co_spawn(
+                io, servers[i]->start(),
+                asio::bind_cancellation_slot(cancel_servers[i].slot(),
+                                             asio::detached));
+        }
+        io.run();
+    });
+
+    auto root_hint =
+        bighorn::DnsServer{.ip = 0x7F000001,
+                           .port = port,
+                           .conn_method = bighorn::ServerConnMethod::Udp,
+                           .recursive = false};
+    bighorn::IterativeResolver resolver(io, {root_hint}, port);
+    std::vector<bighorn::Rr> records;
+    asio::co_spawn(io,
+                   resolver.resolve({"www", "example", "com"},
+                                    bighorn::RrType::A, bighorn::RrClass::In,
+                                    true, 5s),
+                   [&](std::exception_ptr ex, auto resolution) {
+                       EXPECT_FALSE(ex);
+                       records = resolution.records;
+                       for (auto& cancel : cancel_servers) {
+                           cancel.emit(asio::cancellation_type::terminal);
+                       }
+                   });
+    io.run();
+    EXPECT_THAT(records, testing::ElementsAre(www_record));
+}
+
+TEST(ResolutionTest, TruncatedAnswerIsRetriedOverTcp) {
+    asio::io_context io;
+    std::vector<bighorn::Rr> records;
+    // Far more than fits in 512 bytes
+    for (uint32_t i = 0; i < 40; ++i) {
+        records.push_back(bighorn::Rr::a_record({"big", "com"}, i, 300));
+    }
+    auto make_responder = [&] {
+        bighorn::StaticLookup lookup;
+        for (const auto& record : records) {
+            lookup.add_record(record);
+        }
+        return bighorn::Responder(std::move(lookup));
+    };
+    auto loopback = asio::ip::address_v4::loopback();
+    ServerType udp_server(io, asio::ip::udp::endpoint(loopback, 0),
+                          make_responder());
+    bighorn::TcpNameServer tcp_server(
+        io, asio::ip::tcp::endpoint(loopback, udp_server.port()),
+        make_responder());
+    std::array<asio::cancellation_signal, 2> cancel_servers;
+    asio::co_spawn(io, udp_server.start(),
+                   asio::bind_cancellation_slot(cancel_servers[0].slot(),
+                                                asio::detached));
+    asio::co_spawn(io, tcp_server.start(),
+                   asio::bind_cancellation_slot(cancel_servers[1].slot(),
+                                                asio::detached));
+
+    auto server =
+        bighorn::DnsServer{.ip = loopback.to_uint(),
+                           .port = udp_server.port(),
+                           .conn_method = bighorn::ServerConnMethod::Udp,
+                           .recursive = false};
+    bighorn::DefaultResolver resolver(io, {server});
+    std::vector<bighorn::Rr> resolved;
+    asio::co_spawn(io,
+                   resolver.resolve({"big", "com"}, bighorn::RrType::A,
+                                    bighorn::RrClass::In, false, 5s),
+                   [&](std::exception_ptr ex, auto resolution) {
+                       EXPECT_FALSE(ex);
+                       resolved = resolution.records;
+                       for (auto& cancel : cancel_servers) {
+                           cancel.emit(asio::cancellation_type::terminal);
+                       }
+                   });
+    io.run();
+    EXPECT_THAT(resolved, testing::UnorderedElementsAreArray(records));
+}
+
+// Answers each query after the delay with an empty, truncated reply
+asio::awaitable<void> late_truncating_server(asio::ip::udp::socket& socket,
+                                             std::chrono::milliseconds delay) {
+    std::array<uint8_t, 512> data{};
+    asio::ip::udp::endpoint client;
+    while (true) {
+        auto [err, size] = co_await socket.async_receive_from(
+            asio::buffer(data), client, asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            co_return;
+        }
+        bighorn::DataBuffer buffer(data, size);
+        bighorn::Message reply;
+        EXPECT_FALSE(bighorn::read_message(buffer, reply));
+        reply.header.qr = 1;
+        reply.header.tc = 1;
+        asio::steady_timer timer(socket.get_executor(), delay);
+        co_await timer.async_wait(asio::use_awaitable);
+        co_await socket.async_send_to(asio::buffer(reply.bytes()), client,
+                                      asio::use_awaitable);
+    }
+}
+
+TEST(ResolutionTest, LosingQueriesOutliveTheResolver) {
+    asio::io_context io;
+    auto record = bighorn::Rr::a_record({"lose", "com"}, 0x01020304, 300);
+    auto fast_server = make_dns_server(io, {record});
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, fast_server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+    asio::ip::udp::socket late_server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    asio::co_spawn(io, late_truncating_server(late_server, 300ms),
+                   asio::detached);
+
+    auto server_ref = [](int port) {
+        return bighorn::DnsServer{
+            .ip = asio::ip::address_v4::loopback().to_uint(),
+            .port = port,
+            .conn_method = bighorn::ServerConnMethod::Udp,
+            .recursive = false};
+    };
+    // The late server is asked first and loses to the hedged query, then
+    // answers with TC once the resolver is gone
+    auto resolver = std::make_unique<bighorn::DefaultResolver>(
+        io, std::vector{server_ref(late_server.local_endpoint().port()),
+                        server_ref(fast_server.port())});
+    std::vector<bighorn::Rr> resolved;
+    asio::co_spawn(io,
+                   resolver->resolve({"lose", "com"}, bighorn::RrType::A,
+                                     bighorn::RrClass::In, false, 5s),
+                   [&](std::exception_ptr ex, auto resolution) {
+                       EXPECT_FALSE(ex);
+                       resolved = resolution.records;
+                       resolver.reset();
+                   });
+    asio::steady_timer stop(io, 1s);
+    stop.async_wait([&](std::error_code) {
+        cancel_server.emit(asio::cancellation_type::terminal);
+        late_server.close();
+    });
+    io.run();
+    EXPECT_THAT(resolved, testing::ElementsAre(record));
+}
+
+// Answers every query with the given records and counts the queries
+asio::awaitable<void> fixed_answer_server(asio::ip::udp::socket& socket,
+                                          std::vector<bighorn::Rr> answers,
+                                          int& count) {
+    std::array<uint8_t, 512> data{};
+    asio::ip::udp::endpoint client;
+    while (true) {
+        auto [err, size] = co_await socket.async_receive_from(
+            asio::buffer(data), client, asio::as_tuple(asio::use_awaitable));
+        if (err) {
+            co_return;
+        }
+        ++count;
+        bighorn::DataBuffer buffer(data, size);
+        bighorn::Message reply;
+        EXPECT_FALSE(bighorn::read_message(buffer, reply));
+        reply.header.qr = 1;
+        reply.answers = answers;
+        co_await socket.async_send_to(asio::buffer(reply.bytes()), client,
+                                      asio::use_awaitable);
+    }
+}
+
+TEST(ResolutionTest, CnameChainInOneAnswerTakesOneRoundTrip) {
+    asio::io_context io;
+    auto www_record = bighorn::Rr::cname_record(
+        {"www", "shop", "com"}, {"shop", "cdn", "net"}, 3600);
+    auto cdn_record = bighorn::Rr::cname_record(
+        {"shop", "cdn", "net"}, {"edge", "cdn", "net"}, 300);
+    auto edge_record =
+        bighorn::Rr::a_record({"edge", "cdn", "net"}, 0x01020304, 60);
+    asio::ip::udp::socket socket(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    int queries = 0;
+    asio::co_spawn(io,
+                   fixed_answer_server(
+                       socket, {www_record, cdn_record, edge_record}, queries),
+                   asio::detached);
+
+    auto server = bighorn::DnsServer{
+        .ip = asio::ip::address_v4::loopback().to_uint(),
+        .port = socket.local_endpoint().port(),
+        .conn_method = bighorn::ServerConnMethod::Udp,
+        .recursive = true};
+    bighorn::RecursiveLookup lookup(io, bighorn::DefaultResolver(io, {server}));
+    auto rdata_is = [](const bighorn::Rr& record) {
+        return testing::Field(&bighorn::Rr::rdata, record.rdata);
+    };
+    auto ask = [&]() -> asio::awaitable<void> {
+        bighorn::Labels www{"www", "shop", "com"};
+        auto found = co_await lookup.find_records(
+            www, bighorn::RrType::A, bighorn::RrClass::In, true);
+        EXPECT_FALSE(found.err);
+        EXPECT_THAT(found.records.to_rrs(),
+                    testing::ElementsAre(rdata_is(www_record),
+                                         rdata_is(cdn_record),
+                                         rdata_is(edge_record)));
+        // The rest of the chain was cached link by link
+        bighorn::Labels cdn{"shop", "cdn", "net"};
+        found = co_await lookup.find_records(cdn, bighorn::RrType::A,
+                                             bighorn::RrClass::In, true);
+        EXPECT_THAT(found.records.to_rrs(),
+                    testing::ElementsAre(rdata_is(cdn_record),
+                                         rdata_is(edge_record)));
+        bighorn::Labels edge{"edge", "cdn", "net"};
+        found = co_await lookup.find_records(edge, bighorn::RrType::A,
+                                             bighorn::RrClass::In, true);
+        EXPECT_THAT(found.records.to_rrs(),
+                    testing::ElementsAre(rdata_is(edge_record)));
+        socket.close();
+    };
+    asio::co_spawn(io, ask(), asio::detached);
+    io.run();
+    EXPECT_EQ(queries, 1);
+}
+
+// TODO Test only one server selected
+TEST(ResolutionTest, ResolveManyKeepsWindowOfQueries) {
+    const size_t host_count = 50;
+    std::vector<bighorn::Rr> records;
+    for (uint32_t i = 0; i < host_count; ++i) {
+        records.push_back(bighorn::Rr::a_record(
+            {"host" + std::to_string(i), "com"}, i, 300));
+    }
+    asio::io_context io;
+    auto server = make_dns_server(io, records);
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    auto server_ref = bighorn::DnsServer{
+        .ip = asio::ip::address_v4::loopback().to_uint(),
+        .port = server.port(),
+        .conn_method = bighorn::ServerConnMethod::Udp,
+        .recursive = false};
+    bighorn::DefaultResolver resolver(io, {server_ref});
+    std::vector<bighorn::Question> questions;
+    for (const auto& record : records) {
+        questions.push_back(bighorn::Question{.labels = record.labels,
+                                              .qtype = bighorn::RrType::A,
+                                              .qclass = bighorn::RrClass::In});
+    }
+    // Counts questions taken but not yet answered
+    size_t in_flight = 0;
+    size_t most_in_flight = 0;
+    size_t taken = 0;
+    auto next = [&]() -> std::optional<bighorn::Question> {
+        if (taken == questions.size()) {
+            return std::nullopt;
+        }
+        most_in_flight = std::max(most_in_flight, ++in_flight);
+        return questions[taken++];
+    };
+    std::vector<bighorn::Rr> resolved;
+    size_t failures = 0;
+    auto on_result = [&](bighorn::BulkResult result) {
+        --in_flight;
+        if (result.resolution.err) {
+            ++failures;
+        }
+        resolved.insert(resolved.end(), result.resolution.records.begin(),
+                        result.resolution.records.end());
+    };
+    size_t resolved_count = 0;
+    asio::co_spawn(io,
+                   bighorn::resolve_many(resolver, next, on_result,
+                                         {.concurrency = 8, .timeout = 5s}),
+                   [&](std::exception_ptr ex, size_t count) {
+                       EXPECT_FALSE(ex);
+                       resolved_count = count;
+                       cancel_server.emit(asio::cancellation_type::terminal);
+                   });
+    io.run();
+    EXPECT_EQ(resolved_count, host_count);
+    EXPECT_EQ(failures, 0U);
+    EXPECT_EQ(most_in_flight, 8U);
+    EXPECT_THAT(resolved, testing::UnorderedElementsAreArray(records));
+}
+
+TEST(ResolutionTest, CancelledResolveManyStopsItsWorkers) {
+    asio::io_context io;
+    CountingResolver resolver({}, bighorn::ResponseCode::Ok, {}, 200ms);
+    size_t taken = 0;
+    auto next = [&]() -> std::optional<bighorn::Question> {
+        ++taken;
+        return bighorn::Question{.labels = {"slow", "com"},
+                                 .qtype = bighorn::RrType::A,
+                                 .qclass = bighorn::RrClass::In};
+    };
+    size_t results = 0;
+    auto on_result = [&](bighorn::BulkResult) { ++results; };
+    asio::cancellation_signal cancel;
+    bool finished = false;
+    asio::co_spawn(io,
+                   bighorn::resolve_many(resolver, next, on_result,
+                                         {.concurrency = 4, .timeout = 5s}),
+                   asio::bind_cancellation_slot(
+                       cancel.slot(), [&](std::exception_ptr, size_t) {
+                           finished = true;
+                       }));
+    asio::steady_timer deadline(io, 50ms);
+    deadline.async_wait([&](std::error_code) {
+        cancel.emit(asio::cancellation_type::terminal);
+    });
+    auto start = std::chrono::steady_clock::now();
+    io.run();
+    // Only returned once the workers stopped, without waiting out the delay
+    EXPECT_TRUE(finished);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 150ms);
+    EXPECT_EQ(taken, 4U);
+    EXPECT_EQ(resolver.count(), 4);
+    EXPECT_EQ(results, 0U);
+}
+
+TEST(ResolutionTest, RequestDeadlineCancelsUpstreamWork) {
+    asio::io_context io;
+    asio::ip::udp::socket silent_server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    int upstream_queries = 0;
+    asio::co_spawn(io, count_datagrams(silent_server, upstream_queries),
+                   asio::detached);
+
+    auto upstream = bighorn::DnsServer{
+        .ip = asio::ip::address_v4::loopback().to_uint(),
+        .port = silent_server.local_endpoint().port(),
+        .conn_method = bighorn::ServerConnMethod::Udp,
+        .recursive = true};
+    // Without the deadline the resolver would retry after each second
+    bighorn::RecursiveLookup lookup(
+        io, bighorn::DefaultResolver(io, {upstream}), 1s);
+    bighorn::UdpNameServer server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0),
+        bighorn::Responder(std::move(lookup)), 100ms);
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    auto ask = [&]() -> asio::awaitable<void> {
+        asio::ip::udp::socket client(io, asio::ip::udp::v4());
+        asio::ip::udp::endpoint server_endpoint(
+            asio::ip::address_v4::loopback(), server.port());
+        bighorn::Message query{
+            .header = {.id = 7, .opcode = bighorn::Opcode::Query, .rd = 1},
+            .questions = {bighorn::Question{.labels = {"gone", "com"},
+                                            .qtype = bighorn::RrType::A,
+                                            .qclass = bighorn::RrClass::In}}};
+        auto start = std::chrono::steady_clock::now();
+        co_await client.async_send_to(asio::buffer(query.bytes()),
+                                      server_endpoint, asio::use_awaitable);
+        std::array<uint8_t, 512> data{};
+        auto size = co_await client.async_receive(asio::buffer(data),
+                                                  asio::use_awaitable);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, 500ms);
+        bighorn::DataBuffer buffer(data, size);
+        bighorn::Message reply;
+        EXPECT_FALSE(bighorn::read_message(buffer, reply));
+        EXPECT_EQ(reply.header.id, 7);
+        EXPECT_EQ(reply.header.rcode, bighorn::ResponseCode::ServerFailure);
+
+        // Past the resolver's own timeout, no retry has gone out
+        asio::steady_timer wait(io, 1500ms);
+        co_await wait.async_wait(asio::use_awaitable);
+        cancel_server.emit(asio::cancellation_type::terminal);
+        silent_server.close();
+    };
+    asio::co_spawn(io, ask(), asio::detached);
+    io.run();
+    EXPECT_EQ(upstream_queries, 1);
+}
@@ -59,4 +59,105 @@ TEST(ResponderTest, LookupReturnedRefused) {
             EXPECT_EQ(message.header.rcode, bighorn::ResponseCode::Refused);
         });
     io.run();
-}
\ No newline at end of file
+}
+
+static_assert(SyncLookup<StaticLookup>);
+static_assert(!SyncLookup<RefusalLookup>);
+
+// A lookup whose data can change under the responder, as a database's can
+class VersionedTestLookup : public Lookup {
+   public:
+    struct State {
+        StaticLookup lookup;
+        uint64_t generation = 0;
+        int lookups = 0;
+    };
+
+    explicit VersionedTestLookup(std::shared_ptr<State> state)
+        : state_(std::move(state)) {}
+
+    asio::awaitable<FoundRecords> find_records(
+        std::span<std::string const> labels, RrType qtype, RrClass qclass,
+        bool recursive) override {
+        ++state_->lookups;
+        co_return state_->lookup.find_records_sync(labels, qtype, qclass,
+                                                   recursive);
+    }
+    std::vector<DomainAuthority> find_authorities(
+        std::span<std::string const> labels, RrClass rclass) override {
+        return state_->lookup.find_authorities(labels, rclass);
+    }
+    bool supports_recursion() override { return false; }
+
+    [[nodiscard]] uint64_t generation() const { return state_->generation; }
+
+   private:
+    std::shared_ptr<State> state_;
+};
+
+static_assert(VersionedLookup<VersionedTestLookup>);
+static_assert(VersionedLookup<StaticLookup>);
+
+TEST(ResponderTest, CachedResponsesFollowTheLookupGeneration) {
+    auto state = std::make_shared<VersionedTestLookup::State>();
+    state->lookup.add_record(Rr::a_record({"a", "com"}, 0x01020304, 300));
+    Responder responder(VersionedTestLookup(state),
+                        std::make_shared<ResponseCache>());
+    Message query{.header = {.id = 100, .opcode = Opcode::Query, .rd = 0},
+                  .questions = {Question{.labels = {"a", "com"},
+                                         .qtype = RrType::A,
+                                         .qclass = RrClass::In}}};
+
+    auto answer_count = [&](uint16_t id) {
+        query.header.id = id;
+        asio::io_context io;
+        Message response;
+        asio::co_spawn(io, responder.respond_bytes(query),
+                       [&](std::exception_ptr, auto bytes) {
+                           DataBuffer buffer(bytes);
+                           EXPECT_FALSE(read_message(buffer, response));
+                       });
+        io.run();
+        EXPECT_EQ(response.header.id, id);
+        return response.answers.size();
+    };
+    EXPECT_EQ(answer_count(1), 1);
+    EXPECT_EQ(answer_count(2), 1);
+    EXPECT_EQ(state->lookups, 1);
+
+    state->lookup.add_record(Rr::a_record({"a", "com"}, 0x05060708, 300));
+    ++state->generation;
+    EXPECT_EQ(answer_count(3), 2);
+    EXPECT_EQ(state->lookups, 2);
+}
+
+TEST(ResponderTest, ChangesToTheSharedLookupInvalidateCachedResponses) {
+    auto lookup = std::make_shared<StaticLookup>();
+    lookup->add_record(Rr::a_record({"a", "com"}, 0x01020304, 300));
+    auto cache = std::make_shared<ResponseCache>();
+    Responder responder(lookup, cache);
+    Message query{.header = {.id = 100, .opcode = Opcode::Query, .rd = 0},
+                  .questions = {Question{.labels = {"a", "com"},
+                                         .qtype = RrType::A,
+                                         .qclass = RrClass::In}}};
+
+    auto answer_count = [&] {
+        auto bytes = responder.respond_bytes_sync(query);
+        DataBuffer buffer(bytes);
+        Message response;
+        EXPECT_FALSE(read_message(buffer, response));
+        return response.answers.size();
+    };
+    EXPECT_EQ(answer_count(), 1);
+    EXPECT_EQ(answer_count(), 1);
+    EXPECT_EQ(cache->stats().hits, 1);
+
+    // Through the responder, as through the pointer it was given
+    EXPECT_EQ(&responder.lookup(), lookup.get());
+    responder.lookup().add_record(
+        Rr::a_record({"a", "com"}, 0x05060708, 300));
+    EXPECT_EQ(answer_count(), 2);
+    lookup->add_record(Rr::a_record({"a", "com"}, 0x090A0B0C, 300));
+    EXPECT_EQ(answer_count(), 3);
+    EXPECT_EQ(cache->stats().hits, 1);
+}
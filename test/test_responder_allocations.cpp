@@ -0,0 +1,185 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <asio.hpp>
+#include <atomic>
+#include <bighorn/record_cache.hpp>
+#include <bighorn/responder.hpp>
+#include <bighorn/static_lookup.hpp>
+#include <cstdlib>
+#include <new>
+
+// Counts every allocation in this binary, and notes the sizes of those made
+// while recording. The replacement operators apply to the whole executable,
+// so these tests are built on their own.
+std::atomic<size_t> allocation_count = 0;
+std::atomic<bool> recording = false;
+std::array<std::atomic<size_t>, 256> recorded_sizes;
+std::atomic<size_t> recorded_count = 0;
+
+struct alignas(std::max_align_t) AllocationHeader {
+    size_t size;
+};
+
+void *operator new(size_t size) {
+    auto *header = static_cast<AllocationHeader *>(
+        std::malloc(sizeof(AllocationHeader) + size));
+    if (header == nullptr) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    ++allocation_count;
+    if (recording) {
+        auto i = recorded_count++;
+        if (i < recorded_sizes.size()) {
+            recorded_sizes[i] = size;
+        }
+    }
+    return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr != nullptr) {
+        std::free(static_cast<AllocationHeader *>(ptr) - 1);
+    }
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+    operator delete(ptr);
+}
+
+using namespace bighorn;
+
+namespace {
+
+// Sizes of the allocations f makes
+template <typename F>
+std::vector<size_t> allocation_sizes(F &&f) {
+    recorded_count = 0;
+    recording = true;
+    f();
+    recording = false;
+    auto count = std::min(recorded_count.load(), recorded_sizes.size());
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < count; ++i) {
+        sizes.push_back(recorded_sizes[i]);
+    }
+    return sizes;
+}
+
+// A label too long for the small string buffer, so that copying a name
+// that has it allocates, and rdata larger than anything else a response
+// needs, so that copying it stands out
+const std::string LongLabel(40, 'x');
+const size_t RdataSize = 300;
+
+Rr txt_record(Labels labels, char fill) {
+    // Two character strings, since each holds at most 255 bytes
+    std::vector<uint8_t> rdata(RdataSize, static_cast<uint8_t>(fill));
+    rdata[0] = 255;
+    rdata[256] = RdataSize - 257;
+    return Rr{.labels = std::move(labels),
+              .rtype = RrType::Txt,
+              .rclass = RrClass::In,
+              .ttl = 300,
+              .rdata = std::move(rdata)};
+}
+
+}  // namespace
+
+TEST(ResponderTest, SyncLookupIsAnsweredWithoutCoroutines) {
+    auto record = Rr::a_record({"a", "com"}, 0x01020304, 300);
+    StaticLookup lookup;
+    lookup.add_record(record);
+    StaticLookup responder_lookup;
+    responder_lookup.add_record(record);
+    Responder responder(std::move(responder_lookup));
+    Message query{.header = {.id = 100, .opcode = Opcode::Query, .rd = 0},
+                  .questions = {Question{.labels = {"a", "com"},
+                                         .qtype = RrType::A,
+                                         .qclass = RrClass::In}}};
+
+    // What the lookup and writing the response itself take
+    auto before = allocation_count.load();
+    {
+        auto found = lookup.find_records_sync(query.questions[0].labels,
+                                              RrType::A, RrClass::In, false);
+        auto bytes = response_bytes(query.header, query.questions,
+                                    found.records, {}, {});
+    }
+    auto needed = allocation_count.load() - before;
+
+    before = allocation_count.load();
+    auto bytes = responder.respond_bytes_sync(query);
+    EXPECT_EQ(allocation_count.load() - before, needed);
+    EXPECT_EQ(bytes, responder.respond_sync(query).bytes());
+
+    // The awaitable entry point gives the same answer
+    asio::io_context io;
+    asio::co_spawn(io, responder.respond_bytes(query),
+                   [&](std::exception_ptr, auto response) {
+                       EXPECT_EQ(response, bytes);
+                   });
+    io.run();
+}
+
+TEST(ResponderTest, RecordsAreWrittenWithoutCopies) {
+    StaticLookup lookup;
+    Labels name{LongLabel, "com"};
+    lookup.add_record(txt_record(name, 'a'));
+    lookup.add_record(txt_record(name, 'b'));
+    lookup.add_record(txt_record({"*", "com"}, 'c'));
+    lookup.add_record(
+        Rr::mx_record(name, 10, {LongLabel, "mail", "com"}, 300));
+    lookup.add_record(
+        Rr::a_record({LongLabel, "mail", "com"}, 0x01020304, 300));
+    lookup.compact();
+    Responder responder(std::move(lookup));
+
+    for (auto qtype : {RrType::Txt, RrType::Mx, RrType::All}) {
+        Message query{
+            .header = {.id = 100, .opcode = Opcode::Query, .rd = 0},
+            .questions = {Question{
+                .labels = name, .qtype = qtype, .qclass = RrClass::In}}};
+        std::vector<uint8_t> bytes;
+        auto sizes = allocation_sizes(
+            [&] { bytes = responder.respond_bytes_sync(query); });
+        ASSERT_LT(sizes.size(), recorded_sizes.size());
+        EXPECT_EQ(bytes, responder.respond_sync(query).bytes());
+
+        // Neither rdata nor owner names are copied: the one allocation as
+        // large as a record's data is the response itself
+        EXPECT_THAT(sizes, testing::Each(testing::Ne(LongLabel.size() + 1)));
+        EXPECT_THAT(sizes, testing::Contains(bytes.size()));
+        EXPECT_THAT(sizes, testing::Each(testing::AnyOf(
+                               testing::Lt(RdataSize), bytes.size())));
+    }
+}
+
+TEST(RecordCacheTest, HitsShareTheCachedRecords) {
+    RecordCache cache;
+    Labels name{LongLabel, "com"};
+    auto now = RecordCache::Clock::now();
+    cache.insert(name, RrType::Txt, RrClass::In,
+                 {txt_record(name, 'a'), txt_record(name, 'b')}, now);
+
+    std::optional<CachedAnswer> first;
+    std::optional<CachedAnswer> later;
+    auto sizes = allocation_sizes([&] {
+        first = cache.find(name, RrType::Txt, RrClass::In, now);
+        later = cache.find(name, RrType::Txt, RrClass::In,
+                           now + std::chrono::seconds(100));
+    });
+    ASSERT_TRUE(first.has_value());
+    ASSERT_TRUE(later.has_value());
+    EXPECT_THAT(sizes, testing::Each(testing::Lt(RdataSize)));
+
+    // Each hit carries its own TTL over the same records, owner names and all
+    ASSERT_EQ(later->records.size(), 2);
+    EXPECT_EQ(first->records[0].ttl, 300);
+    EXPECT_EQ(later->records[0].ttl, 200);
+    EXPECT_EQ(first->records[0].rdata.data(), later->records[0].rdata.data());
+    EXPECT_EQ(first->records[1].labels.data(),
+              later->records[1].labels.data());
+}
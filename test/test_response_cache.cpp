@@ -0,0 +1,130 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <bighorn/response_cache.hpp>
+
+using namespace bighorn;
+using namespace std::chrono_literals;
+
+namespace {
+
+Message make_query(uint16_t id, Labels labels, uint16_t rd = 0) {
+    return Message{
+        .header = {.id = id, .opcode = Opcode::Query, .rd = rd},
+        .questions = {Question{.labels = std::move(labels),
+                               .qtype = RrType::A,
+                               .qclass = RrClass::In}}};
+}
+
+Message make_response(const Message &query, std::vector<Rr> answers) {
+    Message response{.header = query.header,
+                     .questions = query.questions,
+                     .answers = std::move(answers)};
+    response.header.qr = 1;
+    return response;
+}
+
+Message parse(const std::vector<uint8_t> &bytes) {
+    DataBuffer buffer(bytes);
+    Message message;
+    EXPECT_FALSE(read_message(buffer, message));
+    return message;
+}
+
+}  // namespace
+
+TEST(ResponseCacheTest, PatchesIdNameAndTtls) {
+    ResponseCache cache;
+    auto now = ResponseCache::Clock::now();
+    Labels name{"www", "example", "com"};
+    auto query = make_query(1, name);
+    cache.insert(query, 512, 0,
+                 make_response(query, {Rr::a_record(name, 1, 300),
+                                       Rr::a_record(name, 2, 60)})
+                     .bytes(),
+                 now);
+
+    auto second = make_query(2, {"WWW", "Example", "com"});
+    auto found = cache.find(second, 512, 0, now + 20s);
+    ASSERT_TRUE(found.has_value());
+    auto response = parse(*found);
+    EXPECT_EQ(response.header.id, 2);
+    EXPECT_EQ(response.header.qr, 1);
+    EXPECT_EQ(response.questions[0].labels, second.questions[0].labels);
+    EXPECT_THAT(response.answers,
+                testing::ElementsAre(Rr::a_record(name, 1, 280),
+                                     Rr::a_record(name, 2, 40)));
+
+    EXPECT_FALSE(cache.find(second, 512, 0, now + 60s).has_value());
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.insertions, 1);
+}
+
+TEST(ResponseCacheTest, KeysOnFlagsSizeAndGeneration) {
+    ResponseCache cache;
+    auto now = ResponseCache::Clock::now();
+    Labels name{"www", "example", "com"};
+    auto query = make_query(1, name);
+    cache.insert(query, 512, 7,
+                 make_response(query, {Rr::a_record(name, 1, 300)}).bytes(),
+                 now);
+
+    EXPECT_TRUE(cache.find(query, 512, 7, now).has_value());
+    EXPECT_FALSE(cache.find(make_query(1, name, 1), 512, 7, now).has_value());
+    auto checking_disabled = query;
+    checking_disabled.header.z = 1;
+    EXPECT_FALSE(cache.find(checking_disabled, 512, 7, now).has_value());
+    EXPECT_FALSE(cache.find(query, UINT16_MAX, 7, now).has_value());
+    EXPECT_FALSE(cache.find(query, 512, 8, now).has_value());
+
+    auto with_edns = query;
+    with_edns.edns = Edns{.udp_size = 1232};
+    EXPECT_FALSE(cache.find(with_edns, 512, 7, now).has_value());
+    cache.insert(with_edns, 512, 7,
+                 make_response(query, {Rr::a_record(name, 1, 300)}).bytes(),
+                 now);
+    EXPECT_TRUE(cache.find(with_edns, 512, 7, now).has_value());
+    auto dnssec_ok = with_edns;
+    dnssec_ok.edns->dnssec_ok = true;
+    EXPECT_FALSE(cache.find(dnssec_ok, 512, 7, now).has_value());
+    auto larger = with_edns;
+    larger.edns->udp_size = 4096;
+    EXPECT_FALSE(cache.find(larger, 512, 7, now).has_value());
+}
+
+TEST(ResponseCacheTest, SkipsResponsesWithoutTtls) {
+    ResponseCache cache;
+    auto now = ResponseCache::Clock::now();
+    Labels name{"www", "example", "com"};
+    auto query = make_query(1, name);
+
+    cache.insert(query, 512, 0, make_response(query, {}).bytes(), now);
+    cache.insert(query, 512, 0,
+                 make_response(query, {Rr::a_record(name, 1, 0)}).bytes(),
+                 now);
+    auto failure = make_response(query, {Rr::a_record(name, 1, 300)});
+    failure.header.rcode = ResponseCode::ServerFailure;
+    cache.insert(query, 512, 0, failure.bytes(), now);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(ResponseCacheTest, EvictsOldestFirst) {
+    ResponseCache cache({.capacity = 2});
+    auto now = ResponseCache::Clock::now();
+    std::vector<Message> queries;
+    for (const auto *host : {"a", "b", "c"}) {
+        Labels name{host, "com"};
+        queries.push_back(make_query(1, name));
+        cache.insert(
+            queries.back(), 512, 0,
+            make_response(queries.back(), {Rr::a_record(name, 1, 300)})
+                .bytes(),
+            now);
+    }
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_FALSE(cache.find(queries[0], 512, 0, now).has_value());
+    EXPECT_TRUE(cache.find(queries[2], 512, 0, now).has_value());
+    EXPECT_EQ(cache.stats().evictions, 1);
+}
@@ -243,4 +243,61 @@ TEST(StandardQueryTest, Example626) {
     EXPECT_EQ(result.additional.size(), 3);
     ASSERT_THAT(result.additional,
                 testing::UnorderedElementsAreArray(a_records));
-}
\ No newline at end of file
+}
+TEST(StandardQueryTest, BytesAreTheSerializedMessage) {
+    auto resolver = get_resolver();
+    std::vector<bighorn::Question> questions{
+        {.labels = {"sri-nic", "arpa"},
+         .qtype = bighorn::RrType::A,
+         .qclass = bighorn::RrClass::In},
+        {.labels = {"sri-nic", "arpa"},
+         .qtype = bighorn::RrType::Mx,
+         .qclass = bighorn::RrClass::In},
+        {.labels = {"sri-nic", "arpa"},
+         .qtype = bighorn::RrType::All,
+         .qclass = bighorn::RrClass::In},
+        {.labels = {"sir-nic", "arpa"},
+         .qtype = bighorn::RrType::A,
+         .qclass = bighorn::RrClass::In},
+        {.labels = {"brl", "mil"},
+         .qtype = bighorn::RrType::A,
+         .qclass = bighorn::RrClass::In},
+    };
+    for (const auto& question : questions) {
+        bighorn::Message msg{
+            .header = {.id = 627, .opcode = bighorn::Opcode::Query, .rd = 0},
+            .questions = {question}};
+        EXPECT_EQ(resolver.respond_bytes_sync(msg),
+                  resolver.respond_sync(msg).bytes());
+    }
+}
+
+TEST(StandardQueryTest, ResponsesAreCutToFit) {
+    auto resolver = get_resolver();
+    bighorn::Message msg{
+        .header = {.id = 628, .opcode = bighorn::Opcode::Query, .rd = 0},
+        .questions = {{.labels = {"sri-nic", "arpa"},
+                       .qtype = bighorn::RrType::Mx,
+                       .qclass = bighorn::RrClass::In}}};
+    auto full = resolver.respond_sync(msg);
+    ASSERT_FALSE(full.additional.empty());
+    auto read = [](const std::vector<uint8_t>& bytes) {
+        bighorn::DataBuffer buffer(bytes);
+        bighorn::Message response;
+        EXPECT_FALSE(bighorn::read_message(buffer, response));
+        return response;
+    };
+
+    // The additional records go first
+    auto size = full.bytes().size();
+    auto without_additional = read(resolver.respond_bytes_sync(msg, size - 1));
+    EXPECT_EQ(without_additional.header.tc, 0);
+    EXPECT_EQ(without_additional.answers, full.answers);
+    EXPECT_TRUE(without_additional.additional.empty());
+
+    // Then the answer, leaving the client to retry over TCP
+    auto truncated = read(resolver.respond_bytes_sync(msg, 40));
+    EXPECT_EQ(truncated.header.tc, 1);
+    EXPECT_TRUE(truncated.answers.empty());
+    EXPECT_EQ(truncated.questions, full.questions);
+}
@@ -0,0 +1,210 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <asio.hpp>
+#include <atomic>
+#include <bighorn/static_lookup.hpp>
+#include <random>
+#include <thread>
+
+using namespace bighorn;
+
+const int HostCount = 1000;
+
+StaticLookup make_lookup() {
+    StaticLookup lookup;
+    for (int i = 0; i < HostCount; ++i) {
+        lookup.add_record(Rr::a_record(
+            {"host" + std::to_string(i), "example", "com"}, i, 300));
+    }
+    lookup.add_record(Rr::a_record({"*", "wild", "example", "com"}, 1, 300));
+    return lookup;
+}
+
+TEST(StaticLookupTest, MissDoesNotInsert) {
+    auto lookup = make_lookup();
+    auto names = lookup.name_count();
+    Labels missing{"missing", "example", "com"};
+    auto found =
+        lookup.find_records_sync(missing, RrType::A, RrClass::In, false);
+    EXPECT_THAT(found.records, testing::IsEmpty());
+    EXPECT_EQ(lookup.name_count(), names);
+}
+
+asio::awaitable<void> query(StaticLookup& lookup, uint32_t seed,
+                            std::atomic_int& hits, std::atomic_int& misses) {
+    std::mt19937 rng(seed);
+    for (int i = 0; i < 100; ++i) {
+        Labels labels;
+        switch (rng() % 3) {
+            case 0:
+                labels = {"host" + std::to_string(rng() % HostCount),
+                          "example", "com"};
+                break;
+            case 1:
+                labels = {std::to_string(rng()), "wild", "example", "com"};
+                break;
+            default:
+                labels = {std::to_string(rng()), std::to_string(rng()),
+                          "example", "com"};
+        }
+        auto found =
+            co_await lookup.find_records(labels, RrType::A, RrClass::In, false);
+        if (found.records.empty()) {
+            ++misses;
+        } else {
+            ++hits;
+        }
+    }
+}
+
+// Run with -DBIGHORN_SANITIZE_THREAD=ON to check for data races
+TEST(StaticLookupTest, ConcurrentRandomMisses) {
+    auto lookup = make_lookup();
+    auto names = lookup.name_count();
+    std::atomic_int hits = 0;
+    std::atomic_int misses = 0;
+
+    asio::io_context io;
+    const int query_count = 2000;
+    for (int i = 0; i < query_count; ++i) {
+        asio::co_spawn(io, query(lookup, i, hits, misses), asio::detached);
+    }
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 8; ++i) {
+            threads.emplace_back([&] { io.run(); });
+        }
+    }
+    EXPECT_EQ(hits + misses, query_count * 100);
+    EXPECT_GT(hits, 0);
+    EXPECT_GT(misses, 0);
+    EXPECT_EQ(lookup.name_count(), names);
+}
+
+TEST(StaticLookupTest, GroupsRrsetsAndSurvivesCompaction) {
+    StaticLookup lookup;
+    Labels name{"multi", "example", "com"};
+    lookup.add_record(Rr::a_record(name, 1, 300));
+    lookup.add_record(Rr::mx_record(name, 10, {"mail", "example", "com"}, 300));
+    lookup.add_record(Rr::a_record(name, 2, 300));
+    lookup.add_record(Rr::a_record({"other", "example", "com"}, 3, 300));
+    lookup.add_record(Rr::a_record(name, 3, 300));
+
+    auto expected = testing::ElementsAre(
+        Rr::a_record(name, 1, 300), Rr::a_record(name, 2, 300),
+        Rr::a_record(name, 3, 300),
+        Rr::mx_record(name, 10, {"mail", "example", "com"}, 300));
+    EXPECT_THAT(
+        lookup.find_records_sync(name, RrType::All, RrClass::In, false).records,
+        expected);
+    lookup.compact();
+    EXPECT_THAT(
+        lookup.find_records_sync(name, RrType::All, RrClass::In, false).records,
+        expected);
+    EXPECT_EQ(lookup.name_count(), 2);
+
+    lookup.add_record(Rr::a_record(name, 4, 300));
+    EXPECT_THAT(
+        lookup.find_records_sync(name, RrType::All, RrClass::In, false).records,
+        testing::ElementsAre(
+            Rr::a_record(name, 1, 300), Rr::a_record(name, 2, 300),
+            Rr::a_record(name, 3, 300), Rr::a_record(name, 4, 300),
+            Rr::mx_record(name, 10, {"mail", "example", "com"}, 300)));
+}
+
+TEST(StaticLookupTest, GenerationMovesOnWhenDataChanges) {
+    StaticLookup lookup;
+    auto initial = lookup.generation();
+    Labels name{"a", "example", "com"};
+    lookup.add_record(Rr::a_record(name, 1, 300));
+    auto after_record = lookup.generation();
+    EXPECT_NE(after_record, initial);
+
+    lookup.compact();
+    EXPECT_EQ(lookup.find_records_sync(name, RrType::A, RrClass::In, false)
+                  .records.size(),
+              1);
+    EXPECT_EQ(lookup.generation(), after_record);
+
+    lookup.add_authority(DomainAuthority{.domain = {"example", "com"},
+                                         .name = {"ns", "example", "com"},
+                                         .rclass = RrClass::In,
+                                         .ips = {0x01020304},
+                                         .ttl = 300});
+    EXPECT_NE(lookup.generation(), after_record);
+}
+
+TEST(StaticLookupTest, OversizedRdataIsRejected) {
+    StaticLookup lookup;
+    auto generation = lookup.generation();
+    Rr record{.labels = {"big", "example", "com"},
+              .rtype = RrType::Txt,
+              .rclass = RrClass::In,
+              .ttl = 300,
+              .rdata = std::vector<uint8_t>(UINT16_MAX + 1)};
+    EXPECT_EQ(lookup.add_record(record), ZoneError::RdataTooLong);
+    EXPECT_EQ(lookup.name_count(), 0);
+    EXPECT_EQ(lookup.generation(), generation);
+
+    record.rdata.resize(UINT16_MAX);
+    EXPECT_FALSE(lookup.add_record(record));
+    EXPECT_EQ(lookup.name_count(), 1);
+}
+
+TEST(StaticLookupTest, KeepsDotsWithinLabels) {
+    StaticLookup lookup;
+    Labels dotted{"a.b", "example", "com"};
+    Labels split{"a", "b", "example", "com"};
+    lookup.add_record(Rr::a_record(dotted, 1, 300));
+    lookup.add_record(Rr::a_record(split, 2, 300));
+
+    EXPECT_THAT(
+        lookup.find_records_sync(dotted, RrType::A, RrClass::In, false).records,
+        testing::ElementsAre(Rr::a_record(dotted, 1, 300)));
+    EXPECT_THAT(
+        lookup.find_records_sync(split, RrType::A, RrClass::In, false).records,
+        testing::ElementsAre(Rr::a_record(split, 2, 300)));
+    EXPECT_EQ(labels_to_string(dotted), "a\\.b.example.com");
+    EXPECT_EQ(string_to_labels(labels_to_string(dotted)), dotted);
+}
+
+TEST(StaticLookupTest, AnswersCarryAddressesOfTargets) {
+    StaticLookup lookup;
+    Labels name{"example", "com"};
+    Labels mail{"mail", "example", "com"};
+    Labels ns{"ns", "example", "com"};
+    lookup.add_record(Rr::mx_record(name, 10, mail, 300));
+    lookup.add_record(Rr::mx_record(name, 20, mail, 300));
+    lookup.add_record(Rr::mx_record(name, 30, {"mail", "other", "com"}, 300));
+    lookup.add_record(Rr::ns_record(name, ns, 300));
+    lookup.add_record(Rr::a_record(mail, 1, 300));
+    lookup.add_record(Rr::aaaa_record(mail, {0x20, 0x01}, 300));
+    lookup.add_record(Rr::a_record(ns, 2, 300));
+
+    auto mx_additional = testing::ElementsAre(
+        Rr::a_record(mail, 1, 300), Rr::aaaa_record(mail, {0x20, 0x01}, 300));
+    EXPECT_THAT(
+        lookup.find_records_sync(name, RrType::Mx, RrClass::In, false)
+            .additional,
+        mx_additional);
+    lookup.compact();
+    EXPECT_THAT(
+        lookup.find_records_sync(name, RrType::Mx, RrClass::In, false)
+            .additional,
+        mx_additional);
+    EXPECT_THAT(
+        lookup.find_records_sync(name, RrType::Ns, RrClass::In, false)
+            .additional,
+        testing::ElementsAre(Rr::a_record(ns, 2, 300)));
+    EXPECT_THAT(
+        lookup.find_records_sync(mail, RrType::A, RrClass::In, false)
+            .additional,
+        testing::IsEmpty());
+
+    // Names added after compaction are found too
+    lookup.add_record(Rr::a_record({"mail", "other", "com"}, 3, 300));
+    EXPECT_EQ(lookup.find_records_sync(name, RrType::Mx, RrClass::In, false)
+                  .additional.size(),
+              3);
+}
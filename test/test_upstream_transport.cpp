@@ -0,0 +1,310 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <asio.hpp>
+#include <bighorn/static_lookup.hpp>
+#include <bighorn/tcp.hpp>
+#include <bighorn/udp.hpp>
+#include <bighorn/upstream_transport.hpp>
+
+using namespace bighorn;
+using namespace std::chrono_literals;
+
+Message make_query(Labels labels) {
+    return Message{.header = {.id = 0, .opcode = Opcode::Query, .rd = 0},
+                   .questions = {Question{.labels = std::move(labels),
+                                          .qtype = RrType::A,
+                                          .qclass = RrClass::In}}};
+}
+
+TEST(UpstreamTransportTest, DemultiplexesConcurrentQueries) {
+    asio::io_context io;
+    StaticLookup lookup;
+    const uint32_t host_count = 500;
+    for (uint32_t i = 0; i < host_count; ++i) {
+        lookup.add_record(
+            Rr::a_record({"host" + std::to_string(i), "com"}, i, 300));
+    }
+    UdpNameServer server(io, 0, Responder(std::move(lookup)));
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    UpstreamTransport transport(io, 2);
+    asio::ip::udp::endpoint endpoint(asio::ip::address_v4::loopback(),
+                                     server.port());
+    uint32_t answered = 0;
+    for (uint32_t i = 0; i < host_count; ++i) {
+        Labels name{"host" + std::to_string(i), "com"};
+        asio::co_spawn(io, transport.query(endpoint, make_query(name), 5s),
+                       [&, i, name](std::exception_ptr, UpstreamReply reply) {
+                           EXPECT_FALSE(reply.err);
+                           EXPECT_THAT(reply.message.answers,
+                                       testing::ElementsAre(
+                                           Rr::a_record(name, i, 300)));
+                           if (++answered == host_count) {
+                               cancel_server.emit(
+                                   asio::cancellation_type::terminal);
+                           }
+                       });
+    }
+    io.run();
+    EXPECT_EQ(answered, host_count);
+    EXPECT_EQ(transport.rejected_count(), 0);
+}
+
+// Answers every query three times: with the wrong ID, with the wrong
+// question, and finally correctly
+asio::awaitable<void> spoofing_server(asio::ip::udp::socket &socket) {
+    std::array<uint8_t, 512> data{};
+    asio::ip::udp::endpoint client;
+    auto size = co_await socket.async_receive_from(asio::buffer(data), client,
+                                                   asio::use_awaitable);
+    DataBuffer buffer(data, size);
+    Message query;
+    EXPECT_FALSE(read_message(buffer, query));
+
+    Message reply = query;
+    reply.header.qr = 1;
+    reply.answers = {Rr::a_record(query.questions[0].labels, 1, 300)};
+
+    Message wrong_id = reply;
+    wrong_id.header.id = query.header.id + 1;
+    Message wrong_question = reply;
+    wrong_question.questions[0].labels = {"other", "com"};
+    for (const auto &message : {wrong_id, wrong_question, reply}) {
+        co_await socket.async_send_to(asio::buffer(message.bytes()), client,
+                                      asio::use_awaitable);
+    }
+}
+
+TEST(UpstreamTransportTest, RejectsMismatchedReplies) {
+    asio::io_context io;
+    asio::ip::udp::socket server(
+        io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    asio::co_spawn(io, spoofing_server(server), asio::detached);
+
+    UpstreamTransport transport(io, 1);
+    std::optional<UpstreamReply> result;
+    asio::co_spawn(io,
+                   transport.query(server.local_endpoint(),
+                                   make_query({"example", "com"}), 5s),
+                   [&](std::exception_ptr, UpstreamReply reply) {
+                       result = std::move(reply);
+                   });
+    io.run();
+    ASSERT_TRUE(result.has_value());
+    EXPECT_FALSE(result->err);
+    EXPECT_THAT(result->message.answers,
+                testing::ElementsAre(Rr::a_record({"example", "com"}, 1, 300)));
+    EXPECT_EQ(transport.rejected_count(), 2);
+}
+
+TEST(UpstreamTransportTest, PipelinesQueriesOverOneTcpConnection) {
+    asio::io_context io;
+    StaticLookup lookup;
+    const uint32_t host_count = 200;
+    for (uint32_t i = 0; i < host_count; ++i) {
+        lookup.add_record(
+            Rr::a_record({"host" + std::to_string(i), "com"}, i, 300));
+    }
+    TcpNameServer server(
+        io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0),
+        Responder(std::move(lookup)));
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    UpstreamTransport transport(io);
+    asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(),
+                                     server.port());
+    uint32_t answered = 0;
+    for (uint32_t i = 0; i < host_count; ++i) {
+        Labels name{"host" + std::to_string(i), "com"};
+        asio::co_spawn(io, transport.query_tcp(endpoint, make_query(name), 5s),
+                       [&, i, name](std::exception_ptr, UpstreamReply reply) {
+                           EXPECT_FALSE(reply.err);
+                           EXPECT_THAT(reply.message.answers,
+                                       testing::ElementsAre(
+                                           Rr::a_record(name, i, 300)));
+                           if (++answered == host_count) {
+                               cancel_server.emit(
+                                   asio::cancellation_type::terminal);
+                           }
+                       });
+    }
+    io.run();
+    EXPECT_EQ(answered, host_count);
+    EXPECT_EQ(transport.tcp_connect_count(), 1);
+    EXPECT_EQ(transport.rejected_count(), 0);
+}
+
+TEST(UpstreamTransportTest, ReconnectsWhenServerClosedIdleConnection) {
+    asio::io_context io;
+    StaticLookup lookup;
+    lookup.add_record(Rr::a_record({"example", "com"}, 1, 300));
+    TcpNameServer server(
+        io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0),
+        Responder(std::move(lookup)), 50ms);
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    UpstreamTransport transport(io);
+    asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(),
+                                     server.port());
+    auto query_twice = [&]() -> asio::awaitable<void> {
+        for (int i = 0; i < 2; ++i) {
+            auto reply = co_await transport.query_tcp(
+                endpoint, make_query({"example", "com"}), 5s);
+            EXPECT_FALSE(reply.err) << reply.err.message();
+            EXPECT_EQ(reply.message.answers.size(), 1);
+            // Long enough for the server to close the idle connection
+            asio::steady_timer idle(io, 200ms);
+            co_await idle.async_wait(asio::use_awaitable);
+        }
+        cancel_server.emit(asio::cancellation_type::terminal);
+    };
+    asio::co_spawn(io, query_twice(), asio::detached);
+    io.run();
+    EXPECT_EQ(transport.tcp_connect_count(), 2);
+}
+
+TEST(UpstreamTransportTest, ServerClosesConnectionStalledMidMessage) {
+    asio::io_context io;
+    StaticLookup lookup;
+    TcpNameServer server(
+        io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0),
+        Responder(std::move(lookup)), 50ms);
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    std::optional<std::chrono::steady_clock::duration> closed_after;
+    auto stall = [&]() -> asio::awaitable<void> {
+        asio::ip::tcp::socket socket(io);
+        co_await socket.async_connect(
+            {asio::ip::address_v4::loopback(),
+             static_cast<unsigned short>(server.port())},
+            asio::use_awaitable);
+        // Promises a 30 byte message but sends only some of it
+        std::array<uint8_t, 6> partial{0, 30, 1, 2, 3, 4};
+        co_await asio::async_write(socket, asio::buffer(partial),
+                                   asio::use_awaitable);
+        auto start = std::chrono::steady_clock::now();
+        std::array<uint8_t, 2> data{};
+        auto [err, _] = co_await asio::async_read(
+            socket, asio::buffer(data), asio::as_tuple(asio::use_awaitable));
+        if (err == asio::error::eof) {
+            closed_after = std::chrono::steady_clock::now() - start;
+        }
+        cancel_server.emit(asio::cancellation_type::terminal);
+    };
+    asio::co_spawn(io, stall(), asio::detached);
+    io.run();
+    ASSERT_TRUE(closed_after.has_value());
+    EXPECT_LT(*closed_after, 1s);
+}
+
+// Holds every lookup until released, counting those started
+class HeldLookup : public Lookup {
+   public:
+    struct State {
+        explicit State(asio::io_context &io) : release(io) {
+            release.expires_at(asio::steady_timer::time_point::max());
+        }
+        asio::steady_timer release;
+        bool released = false;
+        int started = 0;
+    };
+
+    explicit HeldLookup(std::shared_ptr<State> state)
+        : state_(std::move(state)) {}
+
+    asio::awaitable<FoundRecords> find_records(
+        std::span<std::string const> labels, RrType /*qtype*/,
+        RrClass /*qclass*/, bool /*recursive*/) override {
+        ++state_->started;
+        if (!state_->released) {
+            co_await state_->release.async_wait(
+                asio::as_tuple(asio::use_awaitable));
+        }
+        co_return FoundRecords{
+            .records = std::vector{Rr::a_record(
+                Labels(labels.begin(), labels.end()), 1, 300)},
+            .err = {}};
+    }
+    std::vector<DomainAuthority> find_authorities(
+        std::span<std::string const> /*labels*/,
+        RrClass /*rclass*/) override {
+        return {};
+    }
+    bool supports_recursion() override { return false; }
+
+   private:
+    std::shared_ptr<State> state_;
+};
+
+TEST(UpstreamTransportTest, ServerLimitsPipelinedRequests) {
+    asio::io_context io;
+    auto state = std::make_shared<HeldLookup::State>(io);
+    TcpNameServer server(
+        io, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0),
+        Responder(HeldLookup(state)), 5s, 3);
+    asio::cancellation_signal cancel_server;
+    asio::co_spawn(
+        io, server.start(),
+        asio::bind_cancellation_slot(cancel_server.slot(), asio::detached));
+
+    const int query_count = 10;
+    int answered = 0;
+    int started_before_release = 0;
+    auto pipeline = [&]() -> asio::awaitable<void> {
+        asio::ip::tcp::socket socket(io);
+        co_await socket.async_connect(
+            {asio::ip::address_v4::loopback(),
+             static_cast<unsigned short>(server.port())},
+            asio::use_awaitable);
+        std::vector<uint8_t> queries;
+        for (int i = 0; i < query_count; ++i) {
+            auto query = make_query({"host" + std::to_string(i), "com"});
+            query.header.id = i;
+            auto bytes = query.bytes();
+            queries.push_back(static_cast<uint8_t>(bytes.size() >> 8));
+            queries.push_back(static_cast<uint8_t>(bytes.size() & 0xFF));
+            queries.insert(queries.end(), bytes.begin(), bytes.end());
+        }
+        co_await asio::async_write(socket, asio::buffer(queries),
+                                   asio::use_awaitable);
+
+        // Time for the server to read everything it is willing to
+        asio::steady_timer wait(io, 100ms);
+        co_await wait.async_wait(asio::use_awaitable);
+        started_before_release = state->started;
+        state->released = true;
+        state->release.cancel();
+
+        for (int i = 0; i < query_count; ++i) {
+            std::array<uint8_t, 2> length{};
+            co_await asio::async_read(socket, asio::buffer(length),
+                                      asio::use_awaitable);
+            std::vector<uint8_t> data(length[0] << 8 | length[1]);
+            co_await asio::async_read(socket, asio::buffer(data),
+                                      asio::use_awaitable);
+            DataBuffer buffer(data);
+            Message response;
+            EXPECT_FALSE(read_message(buffer, response));
+            EXPECT_EQ(response.answers.size(), 1);
+            ++answered;
+        }
+        cancel_server.emit(asio::cancellation_type::terminal);
+    };
+    asio::co_spawn(io, pipeline(), asio::detached);
+    io.run();
+    EXPECT_EQ(started_before_release, 3);
+    EXPECT_EQ(answered, query_count);
+}
@@ -0,0 +1,199 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <bighorn/static_lookup.hpp>
+#include <bighorn/zone_file.hpp>
+#include <sstream>
+
+using namespace bighorn;
+
+std::vector<Rr> parse_all(std::string_view text,
+                          ZoneParseOptions options = {},
+                          ZoneParseResult* result_out = nullptr) {
+    std::vector<Rr> records;
+    auto result = parse_zone(text, options,
+                             [&](Rr record) { records.push_back(record); });
+    if (result_out != nullptr) {
+        *result_out = result;
+    } else {
+        EXPECT_FALSE(result.err) << result.err.message() << " on line "
+                                 << result.line;
+    }
+    return records;
+}
+
+TEST(ZoneFileTest, Rfc1035Example) {
+    const char* zone = R"(
+$ORIGIN isi.edu.
+$TTL 1d
+@   IN  SOA     venera  action\.domains (
+                                20     ; SERIAL
+                                7200   ; REFRESH
+                                600    ; RETRY
+                                3600000; EXPIRE
+                                60)    ; MINIMUM
+
+        NS      a.isi.edu.
+        NS      venera
+        MX      10      venera
+a       A       26.3.0.103
+venera  300 IN  A       10.1.0.52
+        A       128.9.0.32
+)";
+    auto records = parse_all(zone);
+    ASSERT_EQ(records.size(), 7);
+    EXPECT_EQ(records[0].rtype, RrType::Soa);
+    EXPECT_THAT(records[0].labels, testing::ElementsAre("isi", "edu"));
+    EXPECT_EQ(records[0].ttl, 86400);
+    EXPECT_EQ(records[1], Rr::ns_record({"isi", "edu"}, {"a", "isi", "edu"},
+                                        86400));
+    EXPECT_EQ(records[2], Rr::ns_record({"isi", "edu"},
+                                        {"venera", "isi", "edu"}, 86400));
+    EXPECT_EQ(records[3], Rr::mx_record({"isi", "edu"}, 10,
+                                        {"venera", "isi", "edu"}, 86400));
+    EXPECT_EQ(records[4], Rr::a_record({"a", "isi", "edu"}, 0x1A030067, 86400));
+    EXPECT_EQ(records[5],
+              Rr::a_record({"venera", "isi", "edu"}, 0x0A010034, 300));
+    EXPECT_EQ(records[6],
+              Rr::a_record({"venera", "isi", "edu"}, 0x80090020, 86400));
+    EXPECT_EQ(records[0].rdata.size(), 16 + 24 + 20);
+}
+
+TEST(ZoneFileTest, CharacterStringsAndAddresses) {
+    const char* zone = R"(
+host.example.   HINFO   "DEC-2060" TOPS20
+host.example.   TXT     "hello world" "a\"b" c\059d
+host.example.   AAAA    ::1
+host.example.   TYPE10  \# 3 abcdef
+)";
+    auto records = parse_all(zone);
+    ASSERT_EQ(records.size(), 4);
+    EXPECT_EQ(records[0], Rr::hinfo_record({"host", "example"}, "DEC-2060",
+                                           "TOPS20", 3600));
+    std::vector<uint8_t> txt{11, 'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r',
+                             'l', 'd', 3,   'a', '"', 'b', 3,   'c', ';', 'd'};
+    EXPECT_EQ(records[1].rdata, txt);
+    EXPECT_EQ(records[2], Rr::aaaa_record({"host", "example"},
+                                          {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                           0, 0, 0, 1},
+                                          3600));
+    EXPECT_EQ(records[3].rtype, RrType::Null);
+    EXPECT_THAT(records[3].rdata, testing::ElementsAre(0xAB, 0xCD, 0xEF));
+}
+
+TEST(ZoneFileTest, OriginFromOptions) {
+    ZoneParseOptions options{.origin = {"example", "com"}, .default_ttl = 60};
+    auto records = parse_all("www CNAME @\n* A 127.0.0.1\n", options);
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(records[0], Rr::cname_record({"www", "example", "com"},
+                                           {"example", "com"}, 60));
+    EXPECT_EQ(records[1],
+              Rr::a_record({"*", "example", "com"}, 0x7F000001, 60));
+}
+
+TEST(ZoneFileTest, ReportsErrorLine) {
+    ZoneParseResult result;
+    parse_all("a.example. A 1.2.3.4\n\nb.example. A 1.2.3\n", {}, &result);
+    EXPECT_EQ(result.err, ZoneError::InvalidRdata);
+    EXPECT_EQ(result.line, 3);
+    EXPECT_EQ(result.record_count, 1);
+
+    parse_all("a.example. A (1.2.3.4\n", {}, &result);
+    EXPECT_EQ(result.err, ZoneError::UnbalancedParentheses);
+    parse_all("  A 1.2.3.4\n", {}, &result);
+    EXPECT_EQ(result.err, ZoneError::MissingOwner);
+    parse_all("a.example. BOGUS 1.2.3.4\n", {}, &result);
+    EXPECT_EQ(result.err, ZoneError::UnknownType);
+    parse_all("$INCLUDE other.zone\n", {}, &result);
+    EXPECT_EQ(result.err, ZoneError::UnsupportedDirective);
+}
+
+TEST(ZoneFileTest, ThreadedMatchesSequential) {
+    std::stringstream zone;
+    zone << "$ORIGIN example.\n$TTL 300\n";
+    for (int i = 0; i < 100000; ++i) {
+        if (i % 20000 == 0) {
+            zone << "$ORIGIN zone" << i << ".example.\n";
+        }
+        zone << "host" << i << " IN A 10.0." << (i / 256) % 256 << "."
+             << i % 256 << "\n";
+        zone << "  MX ( 10\n   mail" << i << " )\n";
+    }
+    auto text = zone.str();
+    ASSERT_GT(text.size(), 2U << 20);
+
+    auto sequential =
+        parse_all(text, ZoneParseOptions{.origin = {}, .threads = 1});
+    auto threaded =
+        parse_all(text, ZoneParseOptions{.origin = {}, .threads = 4});
+    ASSERT_EQ(sequential.size(), 200000);
+    EXPECT_EQ(sequential, threaded);
+}
+
+TEST(ZoneFileTest, ThreadedAppliesDirectiveOnFirstLine) {
+    std::stringstream zone;
+    zone << "$TTL 300\n";
+    for (int i = 0; i < 100000; ++i) {
+        zone << "host" << i << ".example. IN A 10.0." << (i / 256) % 256 << "."
+             << i % 256 << "\n";
+    }
+    auto text = zone.str();
+    ASSERT_GT(text.size(), 2U << 20);
+
+    auto sequential =
+        parse_all(text, ZoneParseOptions{.origin = {}, .threads = 1});
+    auto threaded =
+        parse_all(text, ZoneParseOptions{.origin = {}, .threads = 4});
+    ASSERT_EQ(sequential.size(), 100000);
+    EXPECT_EQ(sequential, threaded);
+    for (const auto &record : threaded) {
+        ASSERT_EQ(record.ttl, 300);
+    }
+}
+
+TEST(ZoneFileTest, ThreadedStopsAtFirstError) {
+    std::stringstream zone;
+    for (int i = 0; i < 400000; ++i) {
+        zone << "host" << i << ".example. IN A 10.0." << (i / 256) % 256 << "."
+             << i % 256 << "\n";
+        if (i == 150000) {
+            zone << "bad.example. IN BOGUS 1.2.3.4\n";
+        }
+    }
+    auto text = zone.str();
+    ASSERT_GT(text.size(), 8U << 20);
+
+    // Every chunk after the failing one is abandoned, even those already
+    // parsed ahead of the sink
+    ZoneParseResult sequential_result;
+    auto sequential = parse_all(
+        text, ZoneParseOptions{.origin = {}, .threads = 1},
+        &sequential_result);
+    ZoneParseResult threaded_result;
+    auto threaded = parse_all(
+        text, ZoneParseOptions{.origin = {}, .threads = 4}, &threaded_result);
+    EXPECT_EQ(threaded_result.err, ZoneError::UnknownType);
+    EXPECT_EQ(threaded_result.line, 150002);
+    EXPECT_EQ(threaded_result.line, sequential_result.line);
+    EXPECT_EQ(threaded_result.record_count, sequential_result.record_count);
+    EXPECT_EQ(sequential.size(), 150001);
+    EXPECT_EQ(sequential, threaded);
+}
+
+TEST(ZoneFileTest, FeedsStaticLookup) {
+    StaticLookup lookup;
+    auto result = parse_zone("a.example. A 1.2.3.4\n", {}, [&](Rr record) {
+        lookup.add_record(std::move(record));
+    });
+    ASSERT_FALSE(result.err);
+
+    Labels labels{"a", "example"};
+    asio::io_context io;
+    auto future = asio::co_spawn(
+        io, lookup.find_records(labels, RrType::A, RrClass::In, false),
+        asio::use_future);
+    io.run();
+    EXPECT_THAT(future.get().records,
+                testing::ElementsAre(
+                    Rr::a_record({"a", "example"}, 0x01020304, 3600)));
+}